@@ -0,0 +1,117 @@
+/**
+ * @file distributed_spmv.cpp
+ * @brief distributed product by a matrix split by rows over the MPI processes. Build it with
+ *  make distributed and run it with e.g. mpirun -np 4 ./distributed_spmv data/matrix.mtx
+ *
+ */
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mpi.h>
+#include "DistributedMatrix.hpp"
+#include "Laplacian.hpp"
+#include "Matrix.hpp"
+#include "chrono.hpp"
+
+using namespace algebra;
+
+// y=A*x gathered on process 0, x(i)=1+i%7 with i the global index
+std::vector<double>
+gathered_product(const DistributedMatrix<double> &A, int processes){
+  const std::size_t n_local=A.local_size();
+  std::vector<double> x(n_local), y(n_local);
+  for (std::size_t i = 0; i < n_local; ++i)
+    x[i]=1.0+(A.first_row()+i)%7;
+  A.multiply(x, y);
+  std::vector<int> counts(processes), displs(processes+1, 0);
+  const int count=n_local;
+  MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+  for (int p = 0; p < processes; ++p)
+    displs[p+1]=displs[p]+counts[p];
+  std::vector<double> y_global(A.global_size());
+  MPI_Gatherv(y.data(), count, MPI_DOUBLE, y_global.data(), counts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  return y_global;
+}
+
+// maximum difference between the distributed product and the product of the whole matrix,
+// relative to the largest element of the product
+double
+max_difference(Matrix<double> &A, const std::vector<double> &y_distributed){
+  std::vector<double> x(A.cols()), y(A.rows());
+  for (std::size_t i = 0; i < x.size(); ++i)
+    x[i]=1.0+i%7;
+  A.multiply(x, y);
+  double difference{0}, largest{0};
+  for (std::size_t i = 0; i < y.size(); ++i){
+    difference=std::max(difference, std::abs(y[i]-y_distributed[i]));
+    largest=std::max(largest, std::abs(y[i]));
+  }
+  return largest>0 ? difference/largest : difference;
+}
+
+int main(int argc, char** argv)
+{
+  MPI_Init(&argc, &argv);
+  int rank, processes;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &processes);
+  const std::string filename= argc>1 ? argv[1] : "data/matrix.mtx";
+  // the products differ only by the order of the sums
+  const double tolerance{1e-12};
+  int failed{0};
+
+  // every process reads only its own rows of the file
+  DistributedMatrix<double> A(MPI_COMM_WORLD, filename);
+  for (int p = 0; p < processes; ++p){
+    if (p==rank)
+      std::cout<<"Process "<<rank<<": rows "<<A.first_row()<<"-"<<A.first_row()+A.local_size()
+               <<", elements "<<A.local_nnz()<<", ghost columns "<<A.ghost_size()<<std::endl;
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+  const std::vector<double> y_file=gathered_product(A, processes);
+  if (rank==0){
+    Matrix<double> A_serial;
+    A_serial.read_market_matrix(filename);
+    A_serial.compress();
+    const double difference=max_difference(A_serial, y_file);
+    std::cout<<"Product by "<<filename<<", maximum relative difference from one process: "
+             <<difference<<std::endl;
+    failed+= !(difference<=tolerance);
+  }
+
+  // 2D Laplacian on a grid of nx*nx nodes: each process builds an equal block of rows, the
+  // constructor moves them to the processes of the partition balanced by the non-zeros
+  const std::size_t nx{400}, n{nx*nx};
+  const Triplets<double, std::uint64_t> own=make_laplacian<double, std::uint64_t>(nx, n*rank/processes, n*(rank+1)/processes);
+  DistributedMatrix<double> L(MPI_COMM_WORLD, n, own.rows, own.cols, own.values);
+  const std::vector<double> y_laplacian=gathered_product(L, processes);
+  if (rank==0){
+    const Triplets<double> laplacian=make_laplacian(nx);
+    Matrix<double> L_serial(n, n, laplacian.rows, laplacian.cols, laplacian.values);
+    const double difference=max_difference(L_serial, y_laplacian);
+    std::cout<<"Product by the Laplacian on "<<n<<" rows, maximum relative difference from one process: "
+             <<difference<<std::endl;
+    failed+= !(difference<=tolerance);
+  }
+
+  // repeated products, as in an iterative solver: the buffers of the exchange are reused
+  const unsigned int n_products{200};
+  std::vector<double> x(L.local_size(), 1.0), y(L.local_size());
+  Timings::Chrono clock;
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    L.multiply(x, y);
+  MPI_Barrier(MPI_COMM_WORLD);
+  clock.stop();
+  if (rank==0)
+    std::cout<<n_products<<" distributed products on "<<processes<<" processes. "<<clock;
+
+  MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (rank==0 && failed>0)
+    std::cerr<<"ERROR: the distributed product differs from the product on one process by more than "<<tolerance<<std::endl;
+  MPI_Finalize();
+  return failed>0 ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+#ifndef HH_BFLOAT16_HH
+#define HH_BFLOAT16_HH
+#include <bit>
+#include <cstdint>
+#include <iostream>
+
+namespace algebra{
+
+    /**
+     * @brief brain floating point number (bfloat16) emulated in software: the 16 most significant
+     *  bits of a float (sign, 8 bits of exponent, 7 bits of mantissa). It has the range of a float
+     *  with about 3 significant digits. It is meant as a storage type for the values of a matrix:
+     *  the arithmetic is done after the conversion to float (or double).
+     *
+     */
+    struct bfloat16{
+        std::uint16_t bits{0};
+
+        bfloat16()=default;
+
+        // conversion with rounding to the nearest even, a NaN stays a (quiet) NaN
+        explicit bfloat16(float value){
+            const std::uint32_t u=std::bit_cast<std::uint32_t>(value);
+            if((u & 0x7fffffffu) > 0x7f800000u)
+                bits=static_cast<std::uint16_t>((u >> 16) | 0x0040u);
+            else
+                bits=static_cast<std::uint16_t>((u + 0x7fffu + ((u >> 16) & 1u)) >> 16);
+        }
+
+        // the conversion to float is exact
+        operator float() const{
+            return std::bit_cast<float>(static_cast<std::uint32_t>(bits) << 16);
+        }
+    };
+
+    inline std::ostream&
+    operator<<(std::ostream& out, const bfloat16& value){
+        return out << static_cast<float>(value);
+    }
+
+}// namespace algebra
+#endif // HH_BFLOAT16_HH
@@ -0,0 +1,163 @@
+#ifndef HH_COMPRESSED_ARRAY_HH
+#define HH_COMPRESSED_ARRAY_HH
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace algebra{
+
+    /**
+     * @brief contiguous array used for the vectors of the compressed state. It behaves as a
+     *  std::vector, but it can also be a view on memory owned by someone else (e.g. the pages of
+     *  a memory-mapped file), kept alive by a shared pointer. A view is read and written in
+     *  place; any operation changing the size first copies the data in an owned vector.
+     *
+     * @tparam T type of the elements
+     */
+    template<class T>
+    class CompressedArray{
+        private:
+        std::vector<T>        m_owned;
+        T*                    m_ptr{nullptr};
+        std::size_t           m_size{0};
+        std::shared_ptr<void> m_owner; // not null if the array is a view
+
+        // make the pointer and the size refer to the owned vector
+        void
+        sync(){
+            m_ptr=m_owned.data();
+            m_size=m_owned.size();
+        }
+
+        // copy the data of a view in the owned vector before modifying the size
+        void
+        detach(){
+            if(m_owner){
+                m_owned.assign(m_ptr, m_ptr+m_size);
+                m_owner.reset();
+                sync();
+            }
+        }
+
+        public:
+        using value_type=T;
+        using iterator=T*;
+        using const_iterator=const T*;
+
+        CompressedArray()=default;
+
+        CompressedArray(const std::vector<T>& v): m_owned(v){ sync(); }
+        CompressedArray(std::vector<T>&& v): m_owned(std::move(v)){ sync(); }
+
+        // a copy always owns its data, so that copies of a matrix never share values
+        CompressedArray(const CompressedArray& other): m_owned(other.begin(), other.end()){ sync(); }
+
+        CompressedArray(CompressedArray&& other) noexcept:
+        m_owned(std::move(other.m_owned)),
+        m_ptr{std::exchange(other.m_ptr, nullptr)},
+        m_size{std::exchange(other.m_size, 0)},
+        m_owner(std::move(other.m_owner))
+        {
+            if(!m_owner)
+                sync();
+            other.sync();
+        }
+
+        CompressedArray&
+        operator=(const CompressedArray& other){
+            if(this!=&other){
+                m_owned.assign(other.begin(), other.end());
+                m_owner.reset();
+                sync();
+            }
+            return *this;
+        }
+
+        CompressedArray&
+        operator=(CompressedArray&& other) noexcept{
+            if(this!=&other){
+                m_owned=std::move(other.m_owned);
+                m_owner=std::move(other.m_owner);
+                m_ptr=other.m_ptr;
+                m_size=other.m_size;
+                if(!m_owner)
+                    sync();
+                other.m_owned.clear();
+                other.sync();
+            }
+            return *this;
+        }
+
+        CompressedArray&
+        operator=(const std::vector<T>& v){
+            m_owned=v;
+            m_owner.reset();
+            sync();
+            return *this;
+        }
+
+        CompressedArray&
+        operator=(std::vector<T>&& v){
+            m_owned=std::move(v);
+            m_owner.reset();
+            sync();
+            return *this;
+        }
+
+        /**
+         * @brief make the array a view on external memory
+         *
+         * @param owner object keeping the memory alive (e.g. the mapped file)
+         * @param ptr first element
+         * @param n number of elements
+         */
+        void
+        view(std::shared_ptr<void> owner, T* ptr, std::size_t n){
+            m_owned.clear();
+            m_owned.shrink_to_fit();
+            m_owner=std::move(owner);
+            m_ptr=ptr;
+            m_size=n;
+        }
+
+        //! true if the array is a view on external memory
+        inline bool
+        is_view() const{ return m_owner!=nullptr; }
+
+        inline std::size_t size() const{ return m_size; }
+        inline bool empty() const{ return m_size==0; }
+        inline T* data(){ return m_ptr; }
+        inline const T* data() const{ return m_ptr; }
+        inline T* begin(){ return m_ptr; }
+        inline T* end(){ return m_ptr+m_size; }
+        inline const T* begin() const{ return m_ptr; }
+        inline const T* end() const{ return m_ptr+m_size; }
+        inline T& operator[](std::size_t i){ return m_ptr[i]; }
+        inline const T& operator[](std::size_t i) const{ return m_ptr[i]; }
+        inline T& back(){ return m_ptr[m_size-1]; }
+        inline const T& back() const{ return m_ptr[m_size-1]; }
+
+        //! copy of the elements in a std::vector
+        std::vector<T>
+        to_vector() const{
+            return std::vector<T>(begin(), end());
+        }
+
+        // operations changing the size: a view is copied in the owned vector first
+        void clear(){ m_owner.reset(); m_owned.clear(); sync(); }
+        void shrink_to_fit(){ detach(); m_owned.shrink_to_fit(); sync(); }
+        void reserve(std::size_t n){ detach(); m_owned.reserve(n); sync(); }
+        void resize(std::size_t n){ detach(); m_owned.resize(n); sync(); }
+        void resize(std::size_t n, const T& value){ detach(); m_owned.resize(n, value); sync(); }
+        void assign(std::size_t n, const T& value){ m_owner.reset(); m_owned.assign(n, value); sync(); }
+        template<class It>
+        void assign(It first, It last){ std::vector<T> tmp(first, last); *this=std::move(tmp); }
+        void push_back(const T& value){ detach(); m_owned.push_back(value); sync(); }
+        template<class... Args>
+        T& emplace_back(Args&&... args){ detach(); m_owned.emplace_back(std::forward<Args>(args)...); sync(); return m_owned.back(); }
+    };
+
+}// namespace algebra
+
+#endif// HH_COMPRESSED_ARRAY_HH
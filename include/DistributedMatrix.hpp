@@ -0,0 +1,383 @@
+#ifndef HH_DISTRIBUTED_MATRIX_HH
+#define HH_DISTRIBUTED_MATRIX_HH
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include <mpi.h>
+#include "MappedFile.hpp"
+#include "Matrix.hpp"
+#include "MatrixMarket.hpp"
+
+namespace algebra{
+
+    //! MPI datatype of the values
+    template<class T>
+    MPI_Datatype
+    mpi_datatype(){
+        if constexpr(std::is_same_v<T, double>)
+            return MPI_DOUBLE;
+        else if constexpr(std::is_same_v<T, float>)
+            return MPI_FLOAT;
+        else if constexpr(std::is_same_v<T, std::complex<double>>)
+            return MPI_C_DOUBLE_COMPLEX;
+        else if constexpr(std::is_same_v<T, std::complex<float>>)
+            return MPI_C_FLOAT_COMPLEX;
+        else
+            static_assert(is_complex<T>::value && !is_complex<T>::value, "no MPI datatype for the values");
+    }
+
+    /**
+     * @brief sparse matrix distributed by blocks of rows over the processes of a communicator.
+     *  Each process owns a contiguous range of rows and the same range of the columns,
+     *  that is the elements of x and y it holds (the matrix is square). The ranges are balanced by
+     *  the number of non-zeros, like the partition of the threads of a product. The global indices
+     *  are 64-bit, the rows of one process are stored with local indices in two CSR matrices:
+     *  the local block, on the owned columns, and the halo block, on the columns owned by other
+     *  processes (ghost columns), numbered in the order of the ghosts.
+     *  The ghost columns, and who sends what to whom, are computed once by the constructor; the
+     *  product y=A*x posts the nonblocking exchange of the ghost values, multiplies the local block
+     *  while the messages travel, then adds the product of the halo block.
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class DistributedMatrix{
+        public:
+        using index_type=std::uint64_t;//type of the global indices
+
+        private:
+        MPI_Comm                 m_comm;
+        int                      m_rank{0};
+        int                      m_processes{1};
+        index_type               m_global_size{0};
+        std::vector<index_type>  m_offsets;          // rows (and columns) of process p: [m_offsets[p], m_offsets[p+1])
+        Matrix<T>                m_local;            // owned rows x owned columns
+        Matrix<T>                m_halo;             // owned rows x ghost columns
+        std::vector<index_type>  m_ghosts;           // global indices of the ghost columns, sorted
+        // ghost values received from each process: m_ghost_values[m_recv_offsets[k]...m_recv_offsets[k+1]] from m_recv_ranks[k]
+        std::vector<int>         m_recv_ranks;
+        std::vector<int>         m_recv_offsets;
+        // local indices of the values sent to each process, in the order of its ghosts
+        std::vector<int>         m_send_ranks;
+        std::vector<int>         m_send_offsets;
+        std::vector<unsigned int> m_send_indices;
+        // buffers of the exchange, allocated by the constructor and reused by every product
+        mutable std::vector<T>           m_ghost_values;
+        mutable std::vector<T>           m_send_values;
+        mutable std::vector<MPI_Request> m_requests;
+
+        // process that owns the global row (column) i in the partition offsets
+        static int
+        owner(const std::vector<index_type> &offsets, index_type i){
+            return static_cast<int>(std::upper_bound(offsets.begin(), offsets.end(), i)-offsets.begin())-1;
+        }
+
+        // send every entry to the process that owns its row in the partition offsets
+        void
+        redistribute(const std::vector<index_type> &offsets, std::vector<index_type> &rows,
+                     std::vector<index_type> &cols, std::vector<T> &values) const;
+
+        // partition of the rows balanced by the non-zeros, from the entries of the rows of offsets
+        std::vector<index_type>
+        balanced_offsets(const std::vector<index_type> &offsets, const std::vector<index_type> &rows) const;
+
+        // balance the rows, split the rows of the process in the two blocks and build the plan of the exchange
+        void
+        setup(std::vector<index_type> rows, std::vector<index_type> cols, std::vector<T> values);
+
+        public:
+        /**
+         * @brief build the matrix from entries given by all the processes (global indices): each
+         *  process passes any entries, e.g. those of the rows it builds, and they are sent to the
+         *  process that owns their row once the rows are balanced by the non-zeros. Entries outside
+         *  the matrix are ignored. Collective on the communicator.
+         *
+         * @param comm communicator
+         * @param n number of rows (and columns) of the whole matrix
+         * @param rows row indices
+         * @param cols column indices
+         * @param values values (duplicated entries are summed)
+         */
+        DistributedMatrix(MPI_Comm comm, index_type n,
+                          const std::vector<index_type> &rows, const std::vector<index_type> &cols,
+                          const std::vector<T> &values);
+
+        /**
+         * @brief read a square matrix in Matrix Market format: every process maps the file and keeps
+         *  only the entries of an equal block of rows (the mirrored ones too, for a symmetric file),
+         *  then the rows are balanced by the non-zeros as by the other constructor. Collective
+         *  on the communicator; an invalid file gives an empty matrix, with a warning.
+         *
+         * @param comm communicator
+         * @param filename name of the file
+         */
+        DistributedMatrix(MPI_Comm comm, const std::string &filename);
+
+        /**
+         * @brief distributed product y = A*x. Collective on the communicator: every process passes
+         *  its own elements of x and y. The ghost values are exchanged with nonblocking messages,
+         *  overlapped with the product of the local block; nothing is allocated.
+         *
+         * @param x elements of x owned by this process (local_size())
+         * @param y elements of y owned by this process (local_size())
+         */
+        void
+        multiply(std::span<const T> x, std::span<T> y) const;
+
+        //! number of rows (and columns) of the whole matrix
+        index_type
+        global_size() const{
+            return m_global_size;
+        }
+        //! first global row owned by the process
+        index_type
+        first_row() const{
+            return m_offsets[m_rank];
+        }
+        //! number of rows owned by the process
+        std::size_t
+        local_size() const{
+            return m_offsets[m_rank+1]-m_offsets[m_rank];
+        }
+        //! number of ghost columns, the values received by every product
+        std::size_t
+        ghost_size() const{
+            return m_ghosts.size();
+        }
+        //! number of elements stored by the process
+        std::size_t
+        local_nnz() const{
+            return m_local.values().size()+m_halo.values().size();
+        }
+    };
+
+    template<class T>
+    DistributedMatrix<T>::DistributedMatrix(MPI_Comm comm, index_type n,
+                                            const std::vector<index_type> &rows, const std::vector<index_type> &cols,
+                                            const std::vector<T> &values):
+    m_comm{comm}, m_global_size{n}
+    {
+        setup(rows, cols, values);
+    }
+
+    template<class T>
+    DistributedMatrix<T>::DistributedMatrix(MPI_Comm comm, const std::string &filename):
+    m_comm{comm}
+    {
+        MPI_Comm_rank(m_comm, &m_rank);
+        MPI_Comm_size(m_comm, &m_processes);
+        MappedFile file(filename);
+        market::Header header;
+        if(file.is_open())
+            header=market::parse_header(file.data(), file.data()+file.size());
+        if(!header.valid || header.rows!=header.cols || (header.complex && !is_complex<T>::value)){
+            if(m_rank==0)
+                std::cerr<<"WARNING! "<<filename<<" is not a square Matrix Market matrix that can be read: the matrix is empty"<<std::endl;
+            setup({}, {}, {});
+            return;
+        }
+        m_global_size=header.rows;
+        //an equal block of rows, so that the entries need not move twice: setup balances them
+        const index_type first=m_global_size*m_rank/m_processes, last=m_global_size*(m_rank+1)/m_processes;
+        std::vector<index_type> rows, cols;
+        std::vector<T>          values;
+        const char* p=header.body;
+        const char* end=file.data()+file.size();
+        for(std::size_t k = 0; k < header.nnz && p<end; ++k, p=market::next_line(p, end)){
+            std::size_t i, j;
+            T value{1};
+            if(!market::parse_index(p, end, i) || !market::parse_index(p, end, j) ||
+               (!header.pattern && !market::parse_value(p, end, header, value)))
+                break;
+            --i;//Matrix Market indices start from 1
+            --j;
+            if(i>=first && i<last){
+                rows.push_back(i); cols.push_back(j); values.push_back(value);
+            }
+            //the other triangle of a symmetric file
+            if(header.symmetric && i!=j && j>=first && j<last){
+                rows.push_back(j); cols.push_back(i);
+                values.push_back(header.skew ? -value : header.hermitian ? conj_if_complex(value) : value);
+            }
+        }
+        setup(std::move(rows), std::move(cols), std::move(values));
+    }
+
+    template<class T>
+    void
+    DistributedMatrix<T>::redistribute(const std::vector<index_type> &offsets, std::vector<index_type> &rows,
+                                       std::vector<index_type> &cols, std::vector<T> &values) const
+    {
+        //the entries are packed by destination, those outside the matrix are dropped
+        std::vector<int> destination(rows.size(), -1), send_counts(m_processes, 0), recv_counts(m_processes, 0);
+        for(std::size_t k = 0; k < rows.size(); ++k)
+            if(rows[k]<m_global_size && cols[k]<m_global_size){
+                destination[k]=owner(offsets, rows[k]);
+                ++send_counts[destination[k]];
+            }
+        MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, m_comm);
+        std::vector<int> send_displs(m_processes+1, 0), recv_displs(m_processes+1, 0);
+        for(int p = 0; p < m_processes; ++p){
+            send_displs[p+1]=send_displs[p]+send_counts[p];
+            recv_displs[p+1]=recv_displs[p]+recv_counts[p];
+        }
+        std::vector<index_type> send_rows(send_displs.back()), send_cols(send_displs.back());
+        std::vector<T>          send_values(send_displs.back());
+        std::vector<int>        position(send_displs.begin(), send_displs.end()-1);
+        for(std::size_t k = 0; k < rows.size(); ++k)
+            if(destination[k]>=0){
+                const int q=position[destination[k]]++;
+                send_rows[q]=rows[k]; send_cols[q]=cols[k]; send_values[q]=values[k];
+            }
+        rows.resize(recv_displs.back());
+        cols.resize(recv_displs.back());
+        values.resize(recv_displs.back());
+        MPI_Alltoallv(send_rows.data(), send_counts.data(), send_displs.data(), MPI_UINT64_T,
+                      rows.data(), recv_counts.data(), recv_displs.data(), MPI_UINT64_T, m_comm);
+        MPI_Alltoallv(send_cols.data(), send_counts.data(), send_displs.data(), MPI_UINT64_T,
+                      cols.data(), recv_counts.data(), recv_displs.data(), MPI_UINT64_T, m_comm);
+        MPI_Alltoallv(send_values.data(), send_counts.data(), send_displs.data(), mpi_datatype<T>(),
+                      values.data(), recv_counts.data(), recv_displs.data(), mpi_datatype<T>(), m_comm);
+    }
+
+    template<class T>
+    std::vector<typename DistributedMatrix<T>::index_type>
+    DistributedMatrix<T>::balanced_offsets(const std::vector<index_type> &offsets, const std::vector<index_type> &rows) const
+    {
+        //non-zeros of the own rows, and of the rows before them
+        const index_type begin=offsets[m_rank], end=offsets[m_rank+1];
+        std::vector<index_type> row_nnz(end-begin, 0);
+        for(const auto i : rows)
+            ++row_nnz[i-begin];
+        index_type own=rows.size(), before=0, nnz=0;
+        MPI_Exscan(&own, &before, 1, MPI_UINT64_T, MPI_SUM, m_comm);
+        MPI_Allreduce(&own, &nnz, 1, MPI_UINT64_T, MPI_SUM, m_comm);
+        if(m_rank==0)
+            before=0;//MPI_Exscan leaves it undefined on the first process
+        if(nnz==0)
+            return offsets;
+        //as nnz_balanced_partition of Matrix, the p-th bound is the first row whose starting index
+        //reaches the p-th fraction of the non-zeros: it follows the row where that fraction falls,
+        //found by the process that owns the row; the other processes leave 0 for the maximum
+        std::vector<index_type> bounds(m_processes+1, 0), balanced(m_processes+1, 0);
+        index_type start=before;
+        int p=1;
+        for(index_type i = begin; i < end && p < m_processes; ++i){
+            const index_type stop=start+row_nnz[i-begin];
+            for(; p < m_processes && nnz*p/m_processes<=stop; ++p)
+                if(nnz*p/m_processes>start)
+                    bounds[p]=i+1;
+            start=stop;
+        }
+        MPI_Allreduce(bounds.data(), balanced.data(), m_processes+1, MPI_UINT64_T, MPI_MAX, m_comm);
+        balanced.back()=m_global_size;
+        return balanced;
+    }
+
+    template<class T>
+    void
+    DistributedMatrix<T>::setup(std::vector<index_type> rows, std::vector<index_type> cols, std::vector<T> values)
+    {
+        MPI_Comm_rank(m_comm, &m_rank);
+        MPI_Comm_size(m_comm, &m_processes);
+        //the entries are gathered on equal blocks of rows, counted, and sent to the blocks balanced by the non-zeros
+        std::vector<index_type> equal(m_processes+1);
+        for(int p = 0; p <= m_processes; ++p)
+            equal[p]=m_global_size*p/m_processes;
+        redistribute(equal, rows, cols, values);
+        m_offsets=balanced_offsets(equal, rows);
+        redistribute(m_offsets, rows, cols, values);
+        const index_type first=first_row();
+        const std::size_t n_local=local_size();
+
+        //the ghost columns are the columns of the entries outside the own range
+        for(const auto j : cols)
+            if(j<first || j>=first+n_local)
+                m_ghosts.push_back(j);
+        std::sort(m_ghosts.begin(), m_ghosts.end());
+        m_ghosts.erase(std::unique(m_ghosts.begin(), m_ghosts.end()), m_ghosts.end());
+
+        //split the entries: the local columns are shifted, the ghost ones are numbered by their position
+        std::vector<unsigned int> local_rows, local_cols, halo_rows, halo_cols;
+        std::vector<T>            local_values, halo_values;
+        for(std::size_t k = 0; k < rows.size(); ++k){
+            const index_type i=rows[k]-first, j=cols[k];
+            if(j>=first && j<first+n_local){
+                local_rows.push_back(i); local_cols.push_back(j-first); local_values.push_back(values[k]);
+            }else{
+                halo_rows.push_back(i);
+                halo_cols.push_back(std::lower_bound(m_ghosts.begin(), m_ghosts.end(), j)-m_ghosts.begin());
+                halo_values.push_back(values[k]);
+            }
+        }
+        m_local=Matrix<T>(n_local, n_local, local_rows, local_cols, local_values);
+        m_halo=Matrix<T>(n_local, m_ghosts.size(), halo_rows, halo_cols, halo_values);
+
+        //the ghosts are sorted, so those of the same owner are contiguous
+        std::vector<int> recv_counts(m_processes, 0), send_counts(m_processes, 0);
+        for(const auto j : m_ghosts)
+            ++recv_counts[owner(m_offsets, j)];
+        //every process learns how many values it sends to each other one, and which ones
+        MPI_Alltoall(recv_counts.data(), 1, MPI_INT, send_counts.data(), 1, MPI_INT, m_comm);
+        std::vector<int> recv_displs(m_processes+1, 0), send_displs(m_processes+1, 0);
+        for(int p = 0; p < m_processes; ++p){
+            recv_displs[p+1]=recv_displs[p]+recv_counts[p];
+            send_displs[p+1]=send_displs[p]+send_counts[p];
+        }
+        std::vector<index_type> to_send(send_displs.back());
+        MPI_Alltoallv(m_ghosts.data(), recv_counts.data(), recv_displs.data(), MPI_UINT64_T,
+                      to_send.data(), send_counts.data(), send_displs.data(), MPI_UINT64_T, m_comm);
+
+        //only the processes with something to exchange are kept
+        m_recv_offsets.push_back(0);
+        m_send_offsets.push_back(0);
+        for(int p = 0; p < m_processes; ++p){
+            if(recv_counts[p]>0){
+                m_recv_ranks.push_back(p);
+                m_recv_offsets.push_back(recv_displs[p+1]);
+            }
+            if(send_counts[p]>0){
+                m_send_ranks.push_back(p);
+                m_send_offsets.push_back(send_displs[p+1]);
+            }
+        }
+        m_send_indices.reserve(to_send.size());
+        for(const auto j : to_send)
+            m_send_indices.push_back(j-first);
+        m_ghost_values.resize(m_ghosts.size());
+        m_send_values.resize(m_send_indices.size());
+        m_requests.resize(m_recv_ranks.size()+m_send_ranks.size());
+    }
+
+    template<class T>
+    void
+    DistributedMatrix<T>::multiply(std::span<const T> x, std::span<T> y) const
+    {
+        const MPI_Datatype type=mpi_datatype<T>();
+        const std::size_t n_recv=m_recv_ranks.size();
+        //post the receives first, then pack and send the values requested by the other processes
+        for(std::size_t k = 0; k < n_recv; ++k)
+            MPI_Irecv(m_ghost_values.data()+m_recv_offsets[k], m_recv_offsets[k+1]-m_recv_offsets[k], type,
+                      m_recv_ranks[k], 0, m_comm, &m_requests[k]);
+        for(std::size_t k = 0; k < m_send_indices.size(); ++k)
+            m_send_values[k]=x[m_send_indices[k]];
+        for(std::size_t k = 0; k < m_send_ranks.size(); ++k)
+            MPI_Isend(m_send_values.data()+m_send_offsets[k], m_send_offsets[k+1]-m_send_offsets[k], type,
+                      m_send_ranks[k], 0, m_comm, &m_requests[n_recv+k]);
+        //the local block needs only the own elements of x: it is computed while the messages travel
+        m_local.multiply(x, y);
+        //then the halo block is added with the ghost values
+        MPI_Waitall(n_recv, m_requests.data(), MPI_STATUSES_IGNORE);
+        if(!m_ghosts.empty())
+            m_halo.multiply(std::span<const T>(m_ghost_values), y, T(1), T(1));
+        //the send buffer is reused by the next product
+        MPI_Waitall(m_send_ranks.size(), m_requests.data()+n_recv, MPI_STATUSES_IGNORE);
+    }
+
+}// namespace algebra
+#endif // HH_DISTRIBUTED_MATRIX_HH
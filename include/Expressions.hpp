@@ -0,0 +1,411 @@
+#ifndef HH_EXPRESSIONS_HH
+#define HH_EXPRESSIONS_HH
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "Matrix.hpp"
+
+namespace algebra{
+
+    /**
+     * @brief lazy linear operators built from matrices, without building the result: sums,
+     *  scalings, products and transposes. An expression is evaluated only when it is applied to a
+     *  vector, y = alpha*E*x + beta*y, and each matrix is applied with its own product in
+     *  caller-owned storage. The matrices are referenced, not copied, and must outlive the
+     *  expression. An expression is built with lazy(A):
+     *
+     *      auto E=2.0*lazy(A)+lazy(B)*lazy(C);
+     *      E.apply(x, y);
+     *
+     *  Every expression has rows(), cols(), apply and apply_transpose, and also multiply,
+     *  multiply_dot and residual (ExpressionBase), so it can be passed to the solvers in place of
+     *  a matrix.
+     *
+     */
+    template<class E>
+    concept Expression=std::remove_cvref_t<E>::is_expression;
+
+    /**
+     * @brief members shared by the expressions, written in terms of apply: the interface of a
+     *  matrix used by the solvers
+     *
+     * @tparam Derived expression
+     * @tparam T type of the values
+     */
+    template<class Derived, class T>
+    class ExpressionBase{
+        private:
+        const Derived&
+        derived() const{
+            return static_cast<const Derived&>(*this);
+        }
+
+        protected:
+        // false, with an error message, if x or y are shorter than the columns and rows of y=E*x
+        bool
+        valid_sizes(std::size_t x_size, std::size_t y_size) const{
+            if(x_size<derived().cols() || y_size<derived().rows()){
+                std::cerr<<"ERROR: the product needs vectors of "<<derived().cols()<<" and "<<derived().rows()
+                         <<" elements, not "<<x_size<<" and "<<y_size<<std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        public:
+        static constexpr bool is_expression=true;
+        using value_type=T;
+
+        //! y = alpha*E*x + beta*y, as Matrix::multiply
+        void
+        multiply(std::span<const T> x, std::span<T> y, T alpha=T(1), T beta=T(0)) const{
+            derived().apply(x, y, alpha, beta);
+        }
+        //! y = E*x returning x^H y and, if requested, ||y||^2, as Matrix::multiply_dot
+        FusedDot<T>
+        multiply_dot(std::span<const T> x, std::span<T> y, bool with_norm=false) const{
+            FusedDot<T> result;
+            //x^H y needs x as long as y: the operator is square
+            const std::size_t n=derived().rows();
+            if(!valid_sizes(x.size(), y.size()))
+                return result;
+            if(x.size()<n){
+                std::cerr<<"ERROR: the dot product x^H y needs x of "<<n<<" elements, not "<<x.size()<<std::endl;
+                return result;
+            }
+            derived().apply(x, y);
+            for(std::size_t i = 0; i < n; ++i){
+                result.x_dot_y+=conj_if_complex(x[i])*y[i];
+                if(with_norm)
+                    result.y_norm2+=conj_if_complex(y[i])*y[i];
+            }
+            return result;
+        }
+        //! r = b - E*x returning ||r||^2, as Matrix::residual (r can be b itself)
+        T
+        residual(std::span<const T> b, std::span<const T> x, std::span<T> r) const{
+            const std::size_t n=derived().rows();
+            if(!valid_sizes(x.size(), b.size()) || !valid_sizes(x.size(), r.size()))
+                return T(0);
+            if(r.data()!=b.data())
+                std::copy(b.begin(), b.begin()+n, r.begin());
+            derived().apply(x, r, T(-1), T(1));
+            T sum{0};
+            for(std::size_t i = 0; i < n; ++i)
+                sum+=conj_if_complex(r[i])*r[i];
+            return sum;
+        }
+    };
+
+    /**
+     * @brief leaf of an expression: a matrix with a coefficient, c*A
+     *
+     * @tparam T type of the values
+     */
+    template<class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+    class MatrixTerm: public ExpressionBase<MatrixTerm<T, Order, Map, Index, Offset>, T>{
+        private:
+        const Matrix<T, Order, Map, Index, Offset> *m_matrix;
+        T                                          m_coefficient;
+
+        public:
+        using matrix_type=Matrix<T, Order, Map, Index, Offset>;
+        static constexpr StorageOrder storage_order=Order;
+
+        explicit MatrixTerm(const matrix_type &A, T coefficient=T(1)):
+        m_matrix{&A}, m_coefficient{coefficient} {}
+
+        const matrix_type&
+        matrix() const{
+            return *m_matrix;
+        }
+        T
+        coefficient() const{
+            return m_coefficient;
+        }
+        std::size_t
+        rows() const{
+            return m_matrix->rows();
+        }
+        std::size_t
+        cols() const{
+            return m_matrix->cols();
+        }
+        //! y = alpha*c*A*x + beta*y
+        void
+        apply(std::span<const T> x, std::span<T> y, T alpha=T(1), T beta=T(0)) const{
+            m_matrix->multiply(x, y, alpha*m_coefficient, beta);
+        }
+        //! y = alpha*c*A^T*x + beta*y
+        void
+        apply_transpose(std::span<const T> x, std::span<T> y, T alpha=T(1), T beta=T(0)) const{
+            m_matrix->multiply_transpose(x, y, alpha*m_coefficient, beta);
+        }
+    };
+
+    /**
+     * @brief scaled expression c*E
+     *
+     */
+    template<Expression E>
+    class Scaled: public ExpressionBase<Scaled<E>, typename E::value_type>{
+        public:
+        using value_type=typename E::value_type;
+
+        private:
+        E          m_expression;
+        value_type m_coefficient;
+
+        public:
+        Scaled(const E &expression, value_type coefficient):
+        m_expression{expression}, m_coefficient{coefficient} {}
+
+        std::size_t
+        rows() const{
+            return m_expression.rows();
+        }
+        std::size_t
+        cols() const{
+            return m_expression.cols();
+        }
+        void
+        apply(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            m_expression.apply(x, y, alpha*m_coefficient, beta);
+        }
+        void
+        apply_transpose(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            m_expression.apply_transpose(x, y, alpha*m_coefficient, beta);
+        }
+    };
+
+    /**
+     * @brief sum of two expressions L+R. The second term is accumulated on the result of the first
+     *  one, so y is written by the first product and updated by the second. When both terms are
+     *  matrices in CSR format (general storage, no pending insertions) each thread computes the
+     *  rows of its block of the partition of L in tiles: the kernels of the two matrices run on the
+     *  tile one after the other, while it is in cache. The terms must have the same size
+     *  (std::invalid_argument otherwise).
+     *
+     */
+    template<Expression L, Expression R>
+    class Sum: public ExpressionBase<Sum<L, R>, typename L::value_type>{
+        public:
+        using value_type=typename L::value_type;
+        static_assert(std::is_same_v<value_type, typename R::value_type>, "the terms of a sum must have the same type of values");
+
+        private:
+        L m_left;
+        R m_right;
+
+        // rows of a tile of the fused loop
+        static constexpr std::size_t tile=256;
+
+        // true if both the terms can be computed by the fused loop on the rows
+        bool
+        fused() const{
+            if constexpr(requires { m_left.matrix(); m_right.matrix(); }){
+                auto csr=[](const auto &A){
+                    return A.format()==StorageFormat::Compressed && A.symmetry()==Symmetry::General &&
+                           A.delta_size()==0 && A.inner_indices().size()==A.rows()+1;
+                };
+                return L::storage_order==StorageOrder::RowWise && R::storage_order==StorageOrder::RowWise &&
+                       csr(m_left.matrix()) && csr(m_right.matrix());
+            }else
+                return false;
+        }
+
+        public:
+        Sum(const L &left, const R &right):
+        m_left{left}, m_right{right}
+        {
+            if(left.rows()!=right.rows() || left.cols()!=right.cols())
+                throw std::invalid_argument("The terms of the sum have different sizes");
+        }
+
+        std::size_t
+        rows() const{
+            return m_left.rows();
+        }
+        std::size_t
+        cols() const{
+            return m_left.cols();
+        }
+        void
+        apply(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            if constexpr(requires { m_left.matrix(); m_right.matrix(); }){
+                if(fused()){
+                    //the kernels read x and write y through pointers, with no check of their own
+                    if(!this->valid_sizes(x.size(), y.size()))
+                        return;
+                    const auto &A=m_left.matrix(), &B=m_right.matrix();
+                    const value_type a=alpha*m_left.coefficient(), b=alpha*m_right.coefficient();
+                    const auto bounds=A.product_partition();
+                    const unsigned int n_threads=bounds.size()-1;
+                    #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+                    for(unsigned int t = 0; t < n_threads; ++t){
+                        for(std::size_t begin = bounds[t]; begin < bounds[t+1]; begin+=tile){
+                            const std::size_t end=std::min(begin+tile, bounds[t+1]);
+                            A.multiply_rows(x, y, begin, end, a, beta);
+                            B.multiply_rows(x, y, begin, end, b, value_type(1));
+                        }
+                    }
+                    return;
+                }
+            }
+            m_left.apply(x, y, alpha, beta);
+            m_right.apply(x, y, alpha, value_type(1));
+        }
+        void
+        apply_transpose(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            m_left.apply_transpose(x, y, alpha, beta);
+            m_right.apply_transpose(x, y, alpha, value_type(1));
+        }
+    };
+
+    /**
+     * @brief product of two expressions L*R, applied as L*(R*x). The intermediate vector R*x is a
+     *  workspace of the expression, allocated by the first apply and reused: for this reason two
+     *  threads must not apply the same product at the same time. The columns of L must be the
+     *  rows of R (std::invalid_argument otherwise).
+     *
+     */
+    template<Expression L, Expression R>
+    class Product: public ExpressionBase<Product<L, R>, typename L::value_type>{
+        public:
+        using value_type=typename L::value_type;
+        static_assert(std::is_same_v<value_type, typename R::value_type>, "the factors of a product must have the same type of values");
+
+        private:
+        L                               m_left;
+        R                               m_right;
+        mutable std::vector<value_type> m_workspace;
+
+        // view of the workspace with n elements: memory is allocated only when n grows
+        std::span<value_type>
+        workspace(std::size_t n) const{
+            if(m_workspace.size()<n)
+                m_workspace.resize(n);
+            return {m_workspace.data(), n};
+        }
+
+        public:
+        Product(const L &left, const R &right):
+        m_left{left}, m_right{right}
+        {
+            if(left.cols()!=right.rows())
+                throw std::invalid_argument("The factors of the product have incompatible sizes");
+        }
+
+        std::size_t
+        rows() const{
+            return m_left.rows();
+        }
+        std::size_t
+        cols() const{
+            return m_right.cols();
+        }
+        void
+        apply(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            auto t=workspace(m_right.rows());
+            m_right.apply(x, t);
+            m_left.apply(t, y, alpha, beta);
+        }
+        //! (L*R)^T x = R^T (L^T x)
+        void
+        apply_transpose(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            auto t=workspace(m_left.cols());
+            m_left.apply_transpose(x, t);
+            m_right.apply_transpose(t, y, alpha, beta);
+        }
+    };
+
+    /**
+     * @brief transpose of an expression E^T (for complex values the transpose, not the conjugate
+     *  transpose, as Matrix::multiply_transpose)
+     *
+     */
+    template<Expression E>
+    class Transposed: public ExpressionBase<Transposed<E>, typename E::value_type>{
+        public:
+        using value_type=typename E::value_type;
+
+        private:
+        E m_expression;
+
+        public:
+        explicit Transposed(const E &expression):
+        m_expression{expression} {}
+
+        std::size_t
+        rows() const{
+            return m_expression.cols();
+        }
+        std::size_t
+        cols() const{
+            return m_expression.rows();
+        }
+        void
+        apply(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            m_expression.apply_transpose(x, y, alpha, beta);
+        }
+        void
+        apply_transpose(std::span<const value_type> x, std::span<value_type> y, value_type alpha=value_type(1), value_type beta=value_type(0)) const{
+            m_expression.apply(x, y, alpha, beta);
+        }
+    };
+
+    /**
+     * @brief leaf of an expression on the matrix A (referenced, not copied)
+     *
+     * @param A matrix
+     * @return MatrixTerm
+     */
+    template<class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+    MatrixTerm<T, Order, Map, Index, Offset>
+    lazy(const Matrix<T, Order, Map, Index, Offset> &A){
+        return MatrixTerm<T, Order, Map, Index, Offset>(A);
+    }
+
+    //the coefficient of a matrix term is folded in the term, so that the fused sum sees the matrix
+    template<class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+    MatrixTerm<T, Order, Map, Index, Offset>
+    operator*(T c, const MatrixTerm<T, Order, Map, Index, Offset> &term){
+        return MatrixTerm<T, Order, Map, Index, Offset>(term.matrix(), c*term.coefficient());
+    }
+
+    template<Expression E>
+    Scaled<E>
+    operator*(typename E::value_type c, const E &expression){
+        return Scaled<E>(expression, c);
+    }
+
+    template<Expression L, Expression R>
+    Sum<L, R>
+    operator+(const L &left, const R &right){
+        return Sum<L, R>(left, right);
+    }
+
+    template<Expression L, Expression R>
+    auto
+    operator-(const L &left, const R &right){
+        return left+typename R::value_type(-1)*right;
+    }
+
+    template<Expression L, Expression R>
+    Product<L, R>
+    operator*(const L &left, const R &right){
+        return Product<L, R>(left, right);
+    }
+
+    template<Expression E>
+    Transposed<E>
+    transpose(const E &expression){
+        return Transposed<E>(expression);
+    }
+
+}// namespace algebra
+#endif // HH_EXPRESSIONS_HH
@@ -0,0 +1,57 @@
+#ifndef HH_LAPLACIAN_HH
+#define HH_LAPLACIAN_HH
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace algebra{
+
+    /**
+     * @brief lists of entries (triplets) of a sparse matrix, as taken by Matrix::set_from_triplets
+     *
+     * @tparam T type of the values
+     * @tparam I type of the indices
+     */
+    template<class T, class I=unsigned int>
+    struct Triplets{
+        std::vector<I> rows;
+        std::vector<I> cols;
+        std::vector<T> values;
+    };
+
+    /**
+     * @brief 5-point Laplacian on a grid of nx*nx nodes numbered row by row: 4 on the diagonal,
+     *  -1 for each neighbour of the node. The test matrix of the examples.
+     *
+     * @tparam T type of the values
+     * @tparam I type of the indices
+     * @param nx number of nodes on each side of the grid
+     * @param first first row to build
+     * @param last end of the rows to build (the whole matrix by default), e.g. the rows of one process
+     * @return Triplets<T, I> the entries of the rows first <= k < last
+     */
+    template<class T=double, class I=unsigned int>
+    Triplets<T, I>
+    make_laplacian(std::size_t nx, std::size_t first=0, std::size_t last=std::numeric_limits<std::size_t>::max()){
+        Triplets<T, I> laplacian;
+        last=std::min(last, nx*nx);
+        auto add=[&laplacian](std::size_t row, std::size_t col, T value){
+            laplacian.rows.push_back(static_cast<I>(row));
+            laplacian.cols.push_back(static_cast<I>(col));
+            laplacian.values.push_back(value);
+        };
+        for(std::size_t k = first; k < last; ++k){
+            const std::size_t x=k%nx, y=k/nx;
+            add(k, k, T(4));
+            if(x > 0)    add(k, k-1,  T(-1));
+            if(x < nx-1) add(k, k+1,  T(-1));
+            if(y > 0)    add(k, k-nx, T(-1));
+            if(y < nx-1) add(k, k+nx, T(-1));
+        }
+        return laplacian;
+    }
+
+}// namespace algebra
+
+#endif// HH_LAPLACIAN_HH
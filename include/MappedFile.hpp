@@ -0,0 +1,92 @@
+#ifndef HH_MAPPED_FILE_HH
+#define HH_MAPPED_FILE_HH
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace algebra{
+
+    /**
+     * @brief read-only memory mapping of a whole file (POSIX mmap), released by the destructor.
+     *  The mapping is private: the pages can be modified in memory without touching the file.
+     *
+     */
+    class MappedFile{
+        private:
+        char*       m_data{nullptr};
+        std::size_t m_size{0};
+
+        public:
+        MappedFile()=default;
+
+        /**
+         * @brief map the file in memory
+         *
+         * @param filename name of the file
+         * @param sequential true to advise the kernel that the file will be read sequentially
+         */
+        explicit MappedFile(const std::string& filename, bool sequential=true){
+            int fd=::open(filename.c_str(), O_RDONLY);
+            if(fd<0)
+                return;
+            struct stat st;
+            if(::fstat(fd, &st)==0 && st.st_size>0){
+                void* ptr=::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                if(ptr!=MAP_FAILED){
+                    m_data=static_cast<char*>(ptr);
+                    m_size=st.st_size;
+                    if(sequential)
+                        ::madvise(ptr, m_size, MADV_SEQUENTIAL);
+                }
+            }
+            ::close(fd);//the mapping stays valid after closing the file
+        }
+
+        ~MappedFile(){
+            if(m_data)
+                ::munmap(m_data, m_size);
+        }
+
+        MappedFile(const MappedFile&)=delete;
+        MappedFile& operator=(const MappedFile&)=delete;
+
+        MappedFile(MappedFile&& other) noexcept:
+        m_data{std::exchange(other.m_data, nullptr)},
+        m_size{std::exchange(other.m_size, 0)}
+        {}
+
+        MappedFile& operator=(MappedFile&& other) noexcept{
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            return *this;
+        }
+
+        /**
+         * @brief true if the file has been mapped
+         *
+         */
+        inline bool
+        is_open() const{
+            return m_data!=nullptr;
+        }
+
+        //! pointer to the first byte of the file
+        inline char*
+        data() const{
+            return m_data;
+        }
+
+        //! size of the file in bytes
+        inline std::size_t
+        size() const{
+            return m_size;
+        }
+    };
+
+}// namespace algebra
+
+#endif// HH_MAPPED_FILE_HH
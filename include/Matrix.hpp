@@ -10,6 +10,22 @@
 #include <sstream>
 #include <fstream>
 #include <complex>
+#include <numeric>
+#include <span>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <bit>
+#include <limits>
+#include <type_traits>
+#include <stdexcept>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "SpMV_kernels.hpp"
+#include "MappedFile.hpp"
+#include "CompressedArray.hpp"
+#include "MatrixMarket.hpp"
 /**
  * @brief namespace containing the ordering and the class Matrix
  * 
@@ -25,6 +41,36 @@ namespace algebra{
         ColWise
     };
 
+    /**
+     * @brief enumerator that indicates the format in which the matrix is stored
+     * 
+     */
+    enum class StorageFormat{
+        COOmap,     // uncompressed: the map m_data
+        Compressed, // CSR (row-major ordering) or CSC (column-major ordering)
+        SELL,       // sliced ELLPACK (SELL-C-sigma)
+        BSR         // block compressed row storage
+    };
+
+    /**
+     * @brief enumerator that indicates the renumbering of rows and columns applied by compress()
+     * 
+     */
+    enum class Reordering{
+        None, // the numbering of the user is kept
+        RCM   // reverse Cuthill-McKee: reduces the bandwidth of the matrix
+    };
+
+    /**
+     * @brief enumerator that indicates if only one triangle of the matrix is stored
+     * 
+     */
+    enum class Symmetry{
+        General,   // all the elements are stored
+        Symmetric, // A=A^T: only the lower triangle (row >= column) is stored
+        Hermitian  // A=A^H: only the lower triangle is stored, the upper one is its conjugate
+    };
+
     // type alias for the key of the map
     // key is something of the type (i,j) where i is the row index, while j the column one.
     using Indices = std::array<std::size_t, 2>;
@@ -65,22 +111,67 @@ namespace algebra{
         }
     };
 
+    /**
+     * @brief combiner for duplicated entries that keeps the last value (use std::plus<T> to sum them)
+     * 
+     */
+    struct LastWins{
+        template<class T>
+        T operator()(const T&, const T& incoming) const{
+            return incoming;
+        }
+    };
+
+    /**
+     * @brief results of the fused product y=A*x with the dot products (see Matrix::multiply_dot)
+     * 
+     * @tparam T type of the values
+     */
+    template<class T>
+    struct FusedDot{
+        T x_dot_y{0}; // x^H y (x^T y for real values)
+        T y_norm2{0}; // ||y||^2 (0 if not requested)
+    };
+
+    /**
+     * @brief plan of the assembly of a list of contributions on the frozen pattern of a compressed
+     *  matrix (see Matrix::assembly_plan and Matrix::refill). The contributions are grouped by
+     *  the position (slot) of their element in the values: each value is the sum of its own
+     *  group, so that the threads write disjoint values without atomics
+     * 
+     */
+    struct AssemblyPlan{
+        std::size_t              n_contributions{0}; // length of the list of contributions
+        std::vector<std::size_t> ptr;   // the group of slot s is order[ptr[s]] ... order[ptr[s+1]-1]
+        std::vector<std::size_t> order; // positions in the list of the contributions of each group
+    };
+
     // create a type: in COOmap format each elemet is mapped by to integer to which correspond a values
     template <class T, StorageOrder Order>
     using ElemType = std::map<Indices,T, CustomCompare<Order>>;
 
+// include the vector-based alternative to ElemType
+#include "VectorMap.hpp"
+
     /**
     * @brief Class to handle compressed and uncomprees sparse matrix format 
     * 
     */
     //declare the template classe Matrix with partial specialization for the ordering
-    template <class T, StorageOrder Order=StorageOrder::RowWise>
+    //Map is the container of the COOmap format: ElemType (std::map) or VectorMap
+    //Index is the type of the column (row) indices of the compressed formats and Offset the type of
+    //the row (column) pointers: e.g. std::uint16_t indices halve the traffic of the indices for
+    //matrices with at most 65536 columns (rows), std::uint64_t pointers store more than 2^32 non-zeros
+    template <class T, StorageOrder Order=StorageOrder::RowWise, template<class, StorageOrder> class Map=ElemType,
+              class Index=unsigned int, class Offset=unsigned int>
     class Matrix {
+        static_assert(std::is_unsigned_v<Index> && std::is_unsigned_v<Offset>,
+                      "The indices and the pointers of the compressed formats must be unsigned integers");
         
         private:
         T m_dummy_value;
         //map that stores the values accordingly to the StorageOrder
-        ElemType<T, Order> m_data; 
+        Map<T, Order> m_data; 
         
         // number of non-zero elements of the map
         std::size_t m_nnz;
@@ -94,11 +185,15 @@ namespace algebra{
         // m_size[1] = number of columns
         std::array<std::size_t,2> m_size; 
 
-        // State of the matrix can be compressed (CSR or CSC) or uncompressed
-        bool m_state; // true if compressed
+        // State of the matrix can be uncompressed (COOmap) or compressed (CSR/CSC or SELL-C-sigma)
+        StorageFormat m_format;
+
+        // number of threads used by the matrix-vector product
+        unsigned int m_threads;
 
-        //Vector that stores the data of the matrix when compressed
-        std::vector<T>           m_val;
+        //Vector that stores the data of the matrix when compressed.
+        //The compressed vectors can also be views on a memory-mapped snapshot (see load_snapshot)
+        CompressedArray<T>       m_val;
         /*We store two vectors of indexes. The first (the inner indexes),
         of length the number of rows plus one, contains the starting index for the elements of
         each row. The second vector of indexes (the outer indexes), of length the number of non-
@@ -107,9 +202,79 @@ namespace algebra{
         stored in the elements of the vector of values in the interval inner(i) ≤ k < inner(i + 1)
         (the interval is open on the right) and the corresponding column index is outer(k).
         Using this scheme, we have a row-wise storage, since transversing the vector of values
-        provides the non-zero elements ”by row”.*/
-        std::vector<unsigned int> m_outer_index;
-        std::vector<unsigned int> m_inner_index;
+        provides the non-zero elements ”by row”.
+        The outer indexes have type Index, the inner indexes (positions in the other vectors) Offset.*/
+        CompressedArray<Index>  m_outer_index;
+        CompressedArray<Offset> m_inner_index;
+
+        /*In SELL-C-sigma format the rows are sorted by decreasing number of non-zeros inside
+        windows of sigma rows, then they are packed in slices of C rows (the chunk). Each slice
+        is stored column by column and padded with zeros to its longest row, so that the k-th
+        elements of the C rows of a slice are contiguous. m_val and m_outer_index hold the
+        padded values and column indices, the slice s occupies the interval
+        m_sell_slice_ptr[s] <= k < m_sell_slice_ptr[s+1].*/
+        unsigned int              m_sell_chunk;
+        std::vector<Offset>       m_sell_slice_ptr;
+        std::vector<unsigned int> m_sell_perm;    // original row of each sorted position
+        std::vector<unsigned int> m_sell_row_pos; // sorted position of each original row
+        std::vector<unsigned int> m_sell_row_len; // non-zeros of each sorted position
+
+        /*In BSR format the matrix is split in dense blocks of size B x B. m_inner_index and
+        m_outer_index are the block row pointers and the block column indices (one index for
+        B*B values) and m_val stores the blocks one after the other, each of them row-major.
+        The kernel of the product is chosen at compress time, when B is a compile-time constant.*/
+        unsigned int              m_block_size;
+        simd::CsrKernel<T, Index, Offset> m_bsr_kernel;
+
+        /*Optional hash tables for the long rows (columns) of the CSR (CSC) format, used by the
+        element access. Each row with at least m_hash_threshold elements has an open addressing
+        table, with a power of two number of slots, holding the positions in m_outer_index of its
+        elements (empty slots are marked by hash_empty). The table of row i occupies the interval
+        m_hash_ptr[i] <= k < m_hash_ptr[i+1] of m_hash_slots, empty for the other rows.*/
+        static constexpr Offset   hash_empty=std::numeric_limits<Offset>::max();
+        unsigned int              m_hash_threshold;
+        // the rows (columns) with at most m_linear_threshold elements and no hash table are
+        // searched with a linear scan, the longer ones with a binary search
+        unsigned int              m_linear_threshold;
+        std::vector<Offset>       m_hash_ptr;
+        std::vector<Offset>       m_hash_slots;
+
+        /*Data of the product in the compressed formats, cached when the matrix is compressed (and
+        when the number of threads changes) so that nothing is recomputed at each product: the
+        number of rows and columns, the threads used, the first row/column/slice of each
+        thread and the instruction set of the kernels (scalar for the matrices too large for the
+        gathers).*/
+        std::size_t              m_rows;
+        std::size_t              m_cols;
+        unsigned int             m_product_threads;
+        std::vector<std::size_t> m_bounds;
+        simd::SimdLevel          m_simd_level;
+
+        /*Renumbering of rows and columns applied by compress() (square matrices only): the
+        compressed matrix is P*A*P^T, with m_permutation[k] the original index of the row and
+        column k. The permutation refers to the numbering of the user even after several
+        compressions, and it is empty if the matrix has never been renumbered.*/
+        Reordering                m_reordering;
+        std::vector<unsigned int> m_permutation;
+
+        /*With a symmetric (hermitian) storage only the lower triangle is read and compressed, and
+        each stored element is used twice by the product: gathered in its own row (column) and
+        scattered, as the mirrored element, in the row (column) of its index. The scatter of a
+        thread goes directly in y for the rows of its own block, and in its part of the workspace for
+        the others: the interval m_sym_lo[t] <= r < m_sym_hi[t] of rows, starting at m_sym_offset[t].*/
+        Symmetry                  m_symmetry;
+        std::vector<std::size_t>  m_sym_lo, m_sym_hi, m_sym_offset;
+
+        /*Insertions in CSR/CSC format: operator() puts the elements that are not in the compressed
+        arrays in the small map m_delta, in the numbering of the compressed matrix (the lower
+        triangle with a symmetric storage). The element access and the products read it too.
+        When it holds more than m_delta_threshold elements, or an element falls outside the rows
+        and columns of the matrix, it is merged in the arrays in linear time by merge_delta().*/
+        Map<T, Order>             m_delta;
+        std::size_t               m_delta_threshold;
+
+        // with a frozen pattern the positions of the elements in m_val (the slots) cannot change
+        bool                      m_frozen;
 
         // utility to update some private variables of the class
         void 
@@ -126,11 +291,294 @@ namespace algebra{
         //method to read the value when the matrix is compressed, given a key 
         T&
         read_compressed_matrix(const Indices& key);
+
+        // position of the element in the arrays of the CSR/CSC format (no_slot if not present)
+        std::size_t
+        find_slot(const Indices& key) const;
+
+        // print a warning and return true if the pattern is frozen: the operation is not done
+        bool
+        frozen_warning(const char* operation) const;
+
+        /**
+         * @brief split the rows (CSR), the columns (CSC) or the slices (SELL) of the compressed
+         *  matrix in contiguous blocks holding roughly the same number of non-zero elements
+         * 
+         * @param ptr vector of the starting positions (m_inner_index or m_sell_slice_ptr)
+         * @param parts number of blocks
+         * @return std::vector<std::size_t> first row/column of each block, plus the end (size parts+1)
+         */
+        static std::vector<std::size_t>
+        nnz_balanced_partition(std::span<const Offset> ptr, unsigned int parts);
+
+        // contiguous piece of a list of entries: major is the row (column) index and minor
+        // the column (row) index for row-major (column-major) ordering
+        struct TripletChunk{
+            const unsigned int* major;
+            const unsigned int* minor;
+            const T*            val;
+            std::size_t         size;
+        };
+
+        /**
+         * @brief fill the compressed vectors (CSR or CSC) directly from lists of entries, without
+         *  the map. It is a parallel counting sort on the major index, one chunk per thread, followed
+         *  by the sorting of each row/column; the order of the chunks is kept, so duplicated entries
+         *  are combined in the order in which they appear.
+         * 
+         * @param chunks lists of entries
+         * @param n_major number of rows (CSR) or columns (CSC)
+         * @param combine combine(old, new) returns the value of a duplicated entry
+         */
+        template<class Combine>
+        void
+        assemble_compressed(const std::vector<TripletChunk> &chunks, std::size_t n_major, Combine combine);
+
+        // true if the arrays are a valid CSR (CSC) matrix: pointers from 0 to the number of
+        // indices, increasing; sorted indices without repetitions in each row (column), smaller
+        // than n_minor; only the lower triangle with a symmetric storage
+        static bool
+        valid_arrays(std::span<const Index> outer_index, std::span<const Offset> inner_index,
+                     std::size_t n_minor, Symmetry symmetry);
+
+        // clear the map and the vectors of every compressed format
+        void
+        clear_storage();
+
+        /**
+         * @brief reverse Cuthill-McKee ordering of the pattern of the map, symmetrized: a breadth
+         *  first search from a pseudo-peripheral node of each connected component, that visits the
+         *  neighbours by increasing degree, reversed at the end
+         * 
+         * @param n number of rows and columns
+         * @return std::vector<unsigned int> original index of each new index
+         */
+        std::vector<unsigned int>
+        rcm_permutation(std::size_t n) const;
+
+        // permutation of m_reordering for the rows and columns of the map (empty, with a warning,
+        // if the matrix is not square)
+        std::vector<unsigned int>
+        renumbering() const;
+
+        // compress the map renumbering rows and columns with perm (original index of each new
+        // index): the elements are counted by new row (column), then scattered in the arrays one
+        // row (column) of the map at a time, releasing it, and each new row (column) is sorted
+        void
+        compress_renumbered(const std::vector<unsigned int> &perm);
+
+        /**
+         * @brief position of the first element not smaller than value in a sorted array,
+         *  with a fixed number of iterations and no unpredictable branches
+         * 
+         * @param first first element
+         * @param n number of elements
+         * @param value value to search
+         * @return std::size_t position (n if every element is smaller)
+         */
+        static std::size_t
+        branchless_lower_bound(const Index* first, std::size_t n, Index value);
+
+        // slot of the hash table with 2^bits slots where the search for index starts
+        static inline std::size_t
+        hash_slot(std::size_t index, unsigned int bits){
+            return (static_cast<unsigned int>(index)*2654435761u)>>(32-bits);
+        }
+
+        // build the hash tables of the long rows (columns) of the CSR (CSC) format
+        void
+        build_row_hash();
+
+        // scratch buffer of n elements for the products that need one (CSC with more than one
+        // thread, BSR with a size not multiple of the block size, one stored triangle, the
+        // partial dot products). There is one buffer for each calling thread, kept between the
+        // calls: two threads can multiply by the same matrix at the same time. U is the type of
+        // the vectors of the product
+        template<class U=T>
+        static U*
+        workspace(std::size_t n);
+
+        // rows of the product y=A*x: a symmetric matrix in the uncompressed state is square
+        std::size_t
+        product_rows() const{
+            return m_format==StorageFormat::COOmap && m_symmetry!=Symmetry::General ? std::max(m_size[0], m_size[1]) : rows();
+        }
+
+        // false, with an error message, if x or y are shorter than the columns and rows of the
+        // product y=A*x (y=A^T*x if transpose), or if the uncompressed matrix is not resized
+        bool
+        valid_product_sizes(std::size_t x_size, std::size_t y_size, bool transpose) const;
+
+        // cache the sizes and the partition among the threads used by the product
+        void
+        cache_product_data();
+
+        // y=alpha*A*x+beta*y reading the compressed arrays as CSR: each thread gathers its rows
+        void
+        gather_product(const T* x, T* y, T alpha, T beta) const;
+
+        // number of rows of a tile of the fused products: the tile of y stays in the L1 cache
+        static constexpr std::size_t fused_tile=256;
+
+        // x^H y, or ||y||^2 if x and y are the same vector (parallel, in the scratch buffer)
+        T
+        dot(const T* x, const T* y, std::size_t n) const;
+
+        // y=alpha*A*x+beta*y reading the compressed arrays as CSC (n_out is the size of y): each
+        // thread scatters its columns in its part of the scratch buffer, then they are summed.
+        // The vectors can have another type than the values
+        template<class U>
+        void
+        scatter_product(const U* x, U* y, std::size_t n_out, U alpha, U beta) const;
+
+        // y=alpha*A*x+beta*y (A^T if transpose) with one stored triangle, in CSR or CSC format.
+        // The vectors can have another type than the values
+        template<class U>
+        void
+        symmetric_product(const U* x, U* y, U alpha, U beta, bool transpose) const;
+
+        // y=alpha*A*x+beta*y (A^T if transpose) in the uncompressed state (the upper triangle
+        // is skipped and mirrored with a symmetric storage)
+        template<class U>
+        void
+        map_product(const U* x, U* y, U alpha, U beta, bool transpose) const;
+
+        // y+=alpha*D*x (D^T if transpose) for the elements D of a map: the pending insertions of
+        // the compressed state, or the whole matrix in the uncompressed state
+        template<class U>
+        void
+        add_map_product(const Map<T, Order>& data, const U* x, U* y, U alpha, bool transpose) const;
+
+        // number of columns (CSR) or rows (CSC) of a compressed matrix: the size of the matrix,
+        // or the largest index present
+        std::size_t
+        minor_size() const;
+
+        // true if n_minor column (CSR) or row (CSC) indices and nnz elements can be stored with
+        // the Index and Offset types, otherwise a warning is printed
+        static bool
+        fits_index_types(std::size_t n_minor, std::size_t nnz);
+
+        /**
+         * @brief Gustavson's row-wise product C=A*B of two matrices in CSR format (CSC matrices
+         *  are passed as the CSR arrays of their transposes). A symbolic pass counts the
+         *  elements of each row of C, a numeric pass accumulates the rows in a dense vector
+         *  of each thread; the indices of every row of C are sorted.
+         * 
+         * @param a_ptr,a_idx,a_val CSR arrays of A
+         * @param a_major number of rows of A
+         * @param b_ptr,b_idx,b_val CSR arrays of B
+         * @param b_major number of rows of B (the columns of A beyond it are ignored)
+         * @param n_minor number of columns of B
+         * @param n_threads number of threads
+         * @param c_ptr,c_idx,c_val CSR arrays of C
+         * @return false if the elements of C exceed the Offset type (C is left empty)
+         */
+        static bool
+        gustavson_product(const Offset* a_ptr, const Index* a_idx, const T* a_val, std::size_t a_major,
+                          const Offset* b_ptr, const Index* b_idx, const T* b_val, std::size_t b_major,
+                          std::size_t n_minor, unsigned int n_threads,
+                          std::vector<Offset> &c_ptr, std::vector<Index> &c_idx, std::vector<T> &c_val);
+        // element (i,j) for an assignment: an element that is not present is inserted (in the
+        // buffer of the insertions in CSR/CSC format). With one stored triangle (i,j) is in the
+        // lower triangle: Reference mirrors the elements of the upper one
+        T&
+        element_reference(unsigned int i, unsigned int j);
+
+        // value of the element (i,j), 0 if it is not present: nothing is inserted
+        T
+        element_value(unsigned int i, unsigned int j);
+
         public:
+        /**
+         * @brief element (i,j) returned by operator(): it reads the value without changing the
+         *  matrix, and inserts the element only when it is assigned (=, +=, -=, *=, /=). With
+         *  symmetric (hermitian) storage an assignment above the diagonal is applied to the
+         *  mirrored element (with the conjugate value), in the uncompressed and compressed states
+         * 
+         */
+        class Reference{
+            private:
+            Matrix&      m_matrix;
+            unsigned int m_i, m_j;
+
+            // true if the element is stored as its mirror in the lower triangle
+            bool
+            mirrored() const{
+                return m_matrix.m_symmetry!=Symmetry::General && m_i<m_j;
+            }
+            // the stored element, inserted if it is not present
+            T&
+            stored() const{
+                return mirrored() ? m_matrix.element_reference(m_j, m_i) : m_matrix.element_reference(m_i, m_j);
+            }
+            // value applied to the stored element: the conjugate for the mirror of a hermitian matrix
+            T
+            stored_value(const T& value) const;
+
+            public:
+            Reference(Matrix& matrix, unsigned int i, unsigned int j): m_matrix(matrix), m_i(i), m_j(j){}
+
+            operator T() const{
+                return m_matrix.element_value(m_i, m_j);
+            }
+            Reference& operator=(const T& value){
+                stored()=stored_value(value);
+                return *this;
+            }
+            Reference& operator=(const Reference& other){
+                return *this=T(other);
+            }
+            Reference& operator+=(const T& value){
+                stored()+=stored_value(value);
+                return *this;
+            }
+            Reference& operator-=(const T& value){
+                stored()-=stored_value(value);
+                return *this;
+            }
+            Reference& operator*=(const T& value){
+                stored()*=stored_value(value);
+                return *this;
+            }
+            Reference& operator/=(const T& value){
+                stored()/=stored_value(value);
+                return *this;
+            }
+            friend std::ostream& operator<<(std::ostream& out, const Reference& element){
+                return out<<T(element);
+            }
+        };
+
         //The default constructor
         Matrix();
         // constuctor that takes the size of the matrix
         Matrix(unsigned int i, unsigned int j); 
+
+        /**
+         * @brief constructor from lists of entries (triplets), see set_from_triplets
+         * 
+         * @param i number of rows
+         * @param j number of columns
+         * @param rows row indices
+         * @param cols column indices
+         * @param values values
+         * @param combine combine(old, new) returns the value of a duplicated entry
+         */
+        template<class Combine=std::plus<T>>
+        Matrix(unsigned int i, unsigned int j,
+               const std::vector<unsigned int> &rows, const std::vector<unsigned int> &cols,
+               const std::vector<T> &values, Combine combine=Combine());
+
+        /**
+         * @brief conversion from a matrix with another type of values, e.g. double values
+         *  stored as float or bfloat16 to halve (quarter) the memory read by the products.
+         *  The format is kept, except BSR that is converted in the uncompressed state.
+         * 
+         * @param other matrix to convert
+         */
+        template<class U>
+        explicit Matrix(const Matrix<U, Order, Map, Index, Offset> &other);
         
         /**
          * @brief return the size of the matrix
@@ -147,8 +595,267 @@ namespace algebra{
          * @return false if uncompressed (COOmap format)
          */
         inline bool 
-        is_compressed(){
-            return m_state;
+        is_compressed() const{
+            return m_format!=StorageFormat::COOmap;
+        }
+        /**
+         * @brief method to interrogate the format of the matrix
+         * 
+         * @return StorageFormat COOmap, Compressed (CSR/CSC), SELL or BSR
+         */
+        inline StorageFormat
+        format() const{
+            return m_format;
+        }
+        /**
+         * @brief read-only views on the arrays of the compressed state (for CSR: the values,
+         *  the column indices and the row pointers). They are empty in the uncompressed state and
+         *  invalidated by any change of format. The insertions pending in the buffer of the
+         *  compressed state are not in the arrays until merge_delta() is called.
+         * 
+         */
+        inline std::span<const T>
+        values() const{
+            return {m_val.data(), m_val.size()};
+        }
+        inline std::span<const Index>
+        outer_indices() const{
+            return {m_outer_index.data(), m_outer_index.size()};
+        }
+        inline std::span<const Offset>
+        inner_indices() const{
+            return {m_inner_index.data(), m_inner_index.size()};
+        }
+        /**
+         * @brief partition of the rows (columns) among the threads of the product in CSR/CSC
+         *  format, balanced by the number of non-zero elements: the thread t computes the rows
+         *  (columns) bounds[t] <= i < bounds[t+1]
+         * 
+         */
+        inline std::span<const std::size_t>
+        product_partition() const{
+            return m_bounds;
+        }
+        /**
+         * @brief y = alpha*A*x + beta*y on the rows begin <= i < end only, with the kernel of the
+         *  product (vectorized if the CPU supports it), on the calling thread. Only for CSR format
+         *  with general storage and no pending insertions: it is the building block of the loops
+         *  on the rows of other operators, e.g. the fused sum of Expressions.hpp
+         * 
+         * @param x vector with cols() elements
+         * @param y vector with rows() elements, only the rows begin <= i < end are written
+         */
+        void
+        multiply_rows(std::span<const T> x, std::span<T> y, std::size_t begin, std::size_t end, T alpha=T(1), T beta=T(0)) const{
+            simd::csr_kernel<T, Index, Offset>(m_simd_level)(m_val.data(), m_outer_index.data(), m_inner_index.data(),
+                                                             begin, end, x.data(), y.data(), alpha, beta);
+        }
+        /**
+         * @brief number of elements inserted in CSR/CSC format and not yet merged in the arrays
+         * 
+         */
+        inline std::size_t
+        delta_size() const{
+            return m_delta.size();
+        }
+        /**
+         * @brief set the number of elements inserted in CSR/CSC format that are kept in the
+         *  buffer before it is merged in the compressed arrays (1024 by default). The buffer is
+         *  merged now if it is already larger.
+         * 
+         * @param n maximum size of the buffer (0 merges every insertion immediately)
+         */
+        void
+        set_delta_threshold(std::size_t n);
+        /**
+         * @brief merge the elements inserted in CSR/CSC format in the compressed arrays: one pass
+         *  over the arrays, O(nnz + d log d) for d pending elements. The views on the arrays are
+         *  invalidated.
+         * 
+         * @return true if the buffer is empty afterwards (false if the indices do not fit)
+         */
+        bool
+        merge_delta();
+        /**
+         * @brief slot returned for the elements that are not stored
+         * 
+         */
+        static constexpr std::size_t no_slot=std::numeric_limits<std::size_t>::max();
+        /**
+         * @brief freeze the pattern of a matrix in CSR/CSC format: the positions of the elements
+         *  in the values (the slots) stay valid, and every operation that would change the
+         *  pattern (insertions, uncompress, resize, compress...) is refused with a warning. The
+         *  pending insertions are merged before.
+         * 
+         * @param frozen true to freeze the pattern, false to release it
+         */
+        void
+        freeze_pattern(bool frozen=true);
+        /**
+         * @brief return true if the pattern is frozen
+         * 
+         */
+        inline bool
+        pattern_frozen() const{
+            return m_frozen;
+        }
+        /**
+         * @brief position of the element (i,j) in the values of the CSR/CSC format, to be used
+         *  with slot_values()
+         * 
+         * @param i index of the row
+         * @param j index of the column
+         * @return std::size_t the slot, no_slot if the element is not stored (with a symmetric
+         *  storage the upper triangle is not stored)
+         */
+        std::size_t
+        slot(std::size_t i, std::size_t j) const;
+        /**
+         * @brief writable view on the values of a frozen pattern, indexed by slot (empty if the
+         *  pattern is not frozen)
+         * 
+         */
+        inline std::span<T>
+        slot_values(){
+            return m_frozen ? std::span<T>(m_val.data(), m_val.size()) : std::span<T>();
+        }
+        /**
+         * @brief find once the slots of a list of contributions (i.e. the entries of the element
+         *  matrices of an assembly, with repetitions), and group them by slot. The contributions
+         *  outside the pattern (or above the diagonal with a symmetric storage) are skipped.
+         * 
+         * @param rows row index of each contribution
+         * @param cols column index of each contribution
+         * @return AssemblyPlan empty if the pattern is not frozen
+         */
+        AssemblyPlan
+        assembly_plan(const std::vector<unsigned int> &rows, const std::vector<unsigned int> &cols) const;
+        /**
+         * @brief assemble the values of a frozen pattern from a list of contributions: every value
+         *  becomes the sum of its contributions (zero if it has none). The slots are split among
+         *  the threads, so that each value is written by one of them.
+         * 
+         * @param plan the plan of the list, from assembly_plan
+         * @param values value of each contribution, in the order of the plan
+         */
+        void
+        refill(const AssemblyPlan &plan, std::span<const T> values);
+        /**
+         * @brief set the number of threads used by the matrix-vector product in compressed state.
+         *  In CSR format each row is summed by one thread, so the result does not depend on
+         *  the number of threads; it is bit-for-bit identical only to the product with the same
+         *  kernel: the vectorized (AVX2/AVX-512) kernels sum the elements of a row in another
+         *  order than the scalar loop, and can differ from it in the last bits.
+         * 
+         * @param n number of threads (0 restores the default, i.e. the OpenMP maximum)
+         */
+        void
+        set_num_threads(unsigned int n);
+        /**
+         * @brief return the number of threads used by the matrix-vector product
+         * 
+         */
+        inline unsigned int
+        num_threads() const{
+            return m_threads;
+        }
+        /**
+         * @brief enable the hash tables for the element access in CSR/CSC format: the rows
+         *  (columns) with at least n elements get a hash table, the other ones are searched
+         *  with a binary search. The tables are built now if the matrix is compressed, otherwise
+         *  at the next compression.
+         * 
+         * @param n minimum length of a row (column) with a hash table (0 disables the tables)
+         */
+        void
+        set_row_hash_threshold(unsigned int n);
+        /**
+         * @brief set the length of the rows (columns) searched with a linear scan by the element
+         *  access in CSR/CSC format: the short rows fit in one or two cache lines, where a scan
+         *  is faster than the binary search (16 by default). The rows with a hash table use it.
+         * 
+         * @param n maximum length of a row (column) searched linearly (0 always uses the binary search)
+         */
+        inline void
+        set_linear_search_threshold(unsigned int n){
+            m_linear_threshold=n;
+        }
+        /**
+         * @brief choose the renumbering of rows and columns applied by the next compress() from
+         *  the COOmap format, to improve the locality of the product. The matrix becomes P*A*P^T
+         *  (it stays renumbered if it is uncompressed): the vectors are moved to the new numbering
+         *  with permute() and back with unpermute(), once outside of the loop of the products.
+         *  Only square matrices are renumbered, and only when they are compressed from the map:
+         *  set_from_triplets, set_compressed and read_market_matrix_compressed keep the numbering.
+         * 
+         * @param reordering Reordering::RCM or Reordering::None
+         */
+        inline void
+        set_reordering(Reordering reordering){
+            m_reordering=reordering;
+        }
+        /**
+         * @brief store only the lower triangle of a symmetric (hermitian) matrix: the elements
+         *  above the diagonal are not read by the products and are dropped by compress(), at()
+         *  and the products expand the triangle implicitly. It can be changed only in the COOmap
+         *  format. A Matrix Market file with the symmetric/hermitian qualifier sets it when read.
+         *  The SELL-C-sigma and BSR formats, the product of two matrices and ILU(0) need the
+         *  general storage.
+         * 
+         * @param symmetry Symmetry::General, Symmetry::Symmetric or Symmetry::Hermitian
+         */
+        void
+        set_symmetry(Symmetry symmetry);
+        /**
+         * @brief return the storage of the matrix (one or both triangles)
+         * 
+         */
+        inline Symmetry
+        symmetry() const{
+            return m_symmetry;
+        }
+        /**
+         * @brief permutation of the rows and columns: the row (column) k of the matrix is the row
+         *  (column) permutation()[k] of the original one. Empty if the matrix is not renumbered.
+         * 
+         */
+        inline const std::vector<unsigned int>&
+        permutation() const{
+            return m_permutation;
+        }
+        /**
+         * @brief move a vector to the numbering of the matrix: x_new[k]=x[permutation()[k]]
+         *  (a copy if the matrix is not renumbered)
+         * 
+         * @param x vector in the original numbering
+         * @param x_new vector in the numbering of the matrix
+         */
+        void
+        permute(std::span<const T> x, std::span<T> x_new) const;
+        /**
+         * @brief move a vector back to the original numbering: y[permutation()[k]]=y_new[k]
+         *  (a copy if the matrix is not renumbered)
+         * 
+         * @param y_new vector in the numbering of the matrix
+         * @param y vector in the original numbering
+         */
+        void
+        unpermute(std::span<const T> y_new, std::span<T> y) const;
+        /**
+         * @brief number of rows of the matrix, i.e. the size of the result of the product
+         * 
+         */
+        inline std::size_t
+        rows() const{
+            return m_format==StorageFormat::COOmap ? m_size[0] : m_rows;
+        }
+        /**
+         * @brief number of columns of the matrix, i.e. the size of the vector of the product
+         * 
+         */
+        inline std::size_t
+        cols() const{
+            return m_format==StorageFormat::COOmap ? m_size[1] : m_cols;
         }
         /**
          * @brief resize the matrix according given dimensions 
@@ -161,14 +868,16 @@ namespace algebra{
         resize(unsigned int i, unsigned int j);
 
         /**
-         * @brief useful method for update the vector of values when one of them has been modified
+         * @brief useful method for update the vector of values when one of them has been modified.
+         *  It is a copy: values() is a view on the same values without copies
          * 
          * @param val vector of values
          */
         void
         update_compressed_values(std::vector<T>   &val);
         /**
-         * @brief The metod allows to uncompress a matrix from CSR/CSC to COOmap format
+         * @brief The metod allows to uncompress a matrix from CSR/CSC to COOmap format. It is
+         *  needed only to remove elements: new elements can be inserted in CSR/CSC format
          * 
          */
         void 
@@ -176,15 +885,98 @@ namespace algebra{
 
         /**
          * @brief This method allows the compression from COOmap format to a compressed format
-         *          CSR or CSC
+         *  CSR or CSC. The arrays are filled in place, and the elements of the map are released
+         *  row by row (column by column) as soon as they are copied: the arrays grow while the map
+         *  shrinks, and their spare capacity is released at the end. The arrays can be read with values(),
+         *  outer_indices() and inner_indices(). In CSR/CSC format only the pending insertions
+         *  are merged.
+         * 
+         */
+        void
+        compress();
+
+        /**
+         * @brief This method allows the compression from COOmap format to a compressed format
+         *          CSR or CSC, and returns a copy of the arrays (prefer compress() and the views)
          * @param val vector of non-zero values of the sparse matrix 
          * @param outer_index vector containing the indeces of the colums/rows on the non-zero elements
          * @param inner_index vector containing the index indicating in the other vector where a new row/column starts
          */
         void 
         compress(std::vector<T>   &val,
-        std::vector<unsigned int> &outer_index,
-        std::vector<unsigned int> &inner_index);
+        std::vector<Index>  &outer_index,
+        std::vector<Offset> &inner_index);
+
+        /**
+         * @brief This method takes the arrays of the CSR (CSC) format built elsewhere, by move:
+         *  no copies are made. The previous content of the matrix is replaced. The arrays are
+         *  checked (sizes, increasing pointers, sorted indices without repetitions in each
+         *  row/column, only the lower triangle with a symmetric storage).
+         * 
+         * @param val values
+         * @param outer_index column (row) index of each value
+         * @param inner_index position of the first value of each row (column), plus the end
+         * @return true if the arrays are valid, false otherwise (the matrix and the arrays are not changed)
+         */
+        bool
+        set_compressed(std::vector<T> &&val, std::vector<Index> &&outer_index, std::vector<Offset> &&inner_index);
+
+        /**
+         * @brief This method builds the compressed state (CSR or CSC) directly from unsorted lists of
+         *  entries (row[k], col[k], values[k]), without the map: the entries are split among the threads
+         *  and sorted with a parallel counting sort on the rows (columns), then each row (column) is
+         *  sorted and the duplicates are merged with combine, in the order of the lists.
+         *  Besides the result, each thread uses one counter for each row (column) between the
+         *  first and the last one of its part of the lists: about one counter per row (column)
+         *  in total for the lists built element by element, one per row and per thread at worst.
+         *  The size of the matrix is enlarged if some index is outside of it. The numbering is
+         *  kept: the renumbering of set_reordering is applied only by compress(). With symmetric
+         *  (hermitian) storage an entry above the diagonal is stored as its mirror (conjugated),
+         *  combined with the entry of the lower triangle if both are given.
+         * 
+         * @param rows row indices
+         * @param cols column indices
+         * @param values values
+         * @param combine combine(old, new) returns the value of a duplicated entry:
+         *  std::plus<T> (default) sums them, LastWins keeps the last one
+         */
+        template<class Combine=std::plus<T>>
+        void
+        set_from_triplets(const std::vector<unsigned int> &rows, const std::vector<unsigned int> &cols,
+                          const std::vector<T> &values, Combine combine=Combine());
+
+        /**
+         * @brief This method allows the compression from COOmap format to the SELL-C-sigma format.
+         *  The slices are built on the rows whatever the storage ordering is.
+         * 
+         * @param chunk number of rows of a slice (C), the SIMD width: 4 for AVX2, 8 for AVX-512
+         *  (at most simd::max_sell_chunk)
+         * @param sigma number of rows of the sorting window, rounded to a multiple of chunk
+         *  (1 keeps the original order, the number of rows sorts globally)
+         */
+        void
+        compress_sell(unsigned int chunk=8, unsigned int sigma=256);
+
+        /**
+         * @brief This method allows the compression from COOmap format to the block compressed row
+         *  format (BSR) with dense blocks of size B x B. The blocks are built on the rows whatever
+         *  the storage ordering is, the zeros inside a non-empty block are stored explicitly.
+         *  The size of the matrix is enlarged if the map contains elements outside of it.
+         * 
+         * @tparam B size of the blocks (e.g. 2, 3 or 4 for vector-valued problems)
+         */
+        template<unsigned int B>
+        void
+        compress_bsr();
+
+        /**
+         * @brief return the size of the blocks (0 if the matrix is not in BSR format)
+         * 
+         */
+        inline unsigned int
+        block_size() const{
+            return m_format==StorageFormat::BSR ? m_block_size : 0;
+        }
 
         /**
          * @brief method to read the matrix provided a specific key
@@ -205,7 +997,9 @@ namespace algebra{
         erase(unsigned int i, unsigned int j);
 
         /**
-         * @brief This method read a matrix in Matrix Market format (.mtx)
+         * @brief This method read a matrix in Matrix Market format (.mtx). The symmetry of the
+         *  storage becomes the one of the file: only the lower triangle of a symmetric or
+         *  hermitian file is stored, a general file is stored in full (see set_symmetry).
          * 
          * @param filename 
          * @return true if the file has been read successfully
@@ -213,16 +1007,153 @@ namespace algebra{
          */
         bool
         read_market_matrix(const std::string& filename);
+
         /**
-         * @brief the call operator() must be used for inserting values in a key={i,j}
+         * @brief This method reads a matrix in Matrix Market format (.mtx) directly in the compressed
+         *  state (CSR or CSC), without filling the map. The file is mapped in memory and split in
+         *  chunks of lines parsed in parallel; the number of non-zeros of the header is used to
+         *  preallocate the vectors. Duplicated entries keep the first value, as in read_market_matrix.
+         *  The numbering of the file is kept (see set_reordering).
+         * 
+         * @param filename 
+         * @return true if the file has been read successfully
+         * @return false if the reading has failed
+         */
+        bool
+        read_market_matrix_compressed(const std::string& filename);
+
+        /**
+         * @brief This method saves the compressed state (CSR or CSC) in a versioned binary file:
+         *  a header with the storage order, the type of the values and the sizes, followed by
+         *  m_val, m_outer_index, m_inner_index and the renumbering of rows and columns (see
+         *  set_reordering), each of them aligned to 64 bytes.
+         * 
+         * @param filename 
+         * @return true if the file has been written successfully
+         * @return false if the matrix is not in CSR/CSC format or the writing has failed
+         */
+        bool
+        save_snapshot(const std::string& filename) const;
+
+        /**
+         * @brief This method loads a file written by save_snapshot. The file is mapped in memory
+         *  and the compressed vectors are views on its pages: nothing is copied, and the product
+         *  runs directly on the mapped pages. The mapping is private, so modifications of the values
+         *  are never written back to the file; copies of the matrix own their data. The file is
+         *  validated before it is used (sizes and alignment of the arrays, increasing pointers,
+         *  sorted indices inside the matrix, renumbering): it is read once, and a corrupted file
+         *  leaves the matrix unchanged.
+         * 
+         * @param filename 
+         * @return true if the file has been loaded successfully
+         * @return false if the file cannot be mapped, it is not compatible with Matrix<T, Order> or it is corrupted
+         */
+        bool
+        load_snapshot(const std::string& filename);
+        /**
+         * @brief the call operator() must be used for inserting values in a key={i,j}: the element
+         *  is inserted when it is assigned, a read does not change the matrix (0 if the element is
+         *  not present). In CSR/CSC format a new element goes in a buffer merged in the arrays when
+         *  it grows (see set_delta_threshold); in SELL-C-sigma and BSR format only the existing
+         *  elements can be modified.
          * 
          * @param i index of the row 
          * @param j index of the columns
-         * @return T& value to be inserted
+         * @return Reference to the element (i,j)
          */
         
-        T&
-        operator()(const unsigned int k, const unsigned int z);
+        Reference
+        operator()(const unsigned int k, const unsigned int z){
+            return Reference(*this, k, z);
+        }
+
+        /**
+         * @brief matrix-vector product in caller-owned storage, y = alpha*A*x + beta*y, in every
+         *  format (the uncompressed one needs the resize). Nothing is allocated, except the first
+         *  time a scratch buffer is needed (CSC with more than one thread, BSR with a size not
+         *  multiple of the block size): the buffer belongs to the calling thread, so several
+         *  threads can multiply by the same matrix at the same time. With beta=0 y is only written.
+         *  If x or y are too short an error is printed and y is not changed.
+         * 
+         * @param x vector with cols() elements
+         * @param y vector with rows() elements
+         * @param alpha coefficient of the product
+         * @param beta coefficient of the previous content of y
+         */
+        void
+        multiply(std::span<const T> x, std::span<T> y, T alpha=T(1), T beta=T(0)) const;
+
+        /**
+         * @brief mixed-precision product y = alpha*A*x + beta*y with vectors of type U: the values
+         *  are converted to U in the registers and the products are accumulated in U, e.g. a
+         *  matrix with float values and double vectors. Available in CSR/CSC, SELL-C-sigma and
+         *  uncompressed formats, on the threads of the product; in BSR format it throws
+         *  std::logic_error (uncompress the matrix, or compress it in another format).
+         * 
+         * @tparam U type of the vectors
+         * @param x vector with cols() elements
+         * @param y vector with rows() elements
+         * @param alpha coefficient of the product
+         * @param beta coefficient of the previous content of y
+         */
+        template<class U>
+        requires (!std::is_same_v<U, T>)
+        void
+        multiply(std::span<const U> x, std::span<U> y, U alpha=U(1), U beta=U(0)) const;
+
+        /**
+         * @brief transpose product y = alpha*A^T*x + beta*y on the same storage, without building
+         *  the transpose: the rows of a CSR matrix are scattered (with a buffer for each thread),
+         *  the columns of a CSC matrix are gathered. Available in CSR/CSC format and in the
+         *  uncompressed state (with the resize). For complex values it is the transpose, not the
+         *  conjugate transpose.
+         * 
+         * @param x vector with rows() elements
+         * @param y vector with cols() elements
+         * @param alpha coefficient of the product
+         * @param beta coefficient of the previous content of y
+         */
+        void
+        multiply_transpose(std::span<const T> x, std::span<T> y, T alpha=T(1), T beta=T(0)) const;
+
+        /**
+         * @brief fused product y = A*x returning x^H y and, if requested, ||y||^2 (for a square
+         *  matrix, e.g. p^T A p in CG). In CSR format the rows are computed in tiles and the dot
+         *  products are accumulated while the tile of y is still in cache, so y is not read again
+         *  from memory. In the other formats the dot products are a second pass on y.
+         * 
+         * @param x vector with cols() elements (and rows(), for the dot product)
+         * @param y vector with rows() elements
+         * @param with_norm true to compute ||y||^2 too
+         * @return FusedDot<T> x^H y and ||y||^2
+         */
+        FusedDot<T>
+        multiply_dot(std::span<const T> x, std::span<T> y, bool with_norm=false) const;
+
+        /**
+         * @brief fused residual r = b - A*x, returning ||r||^2. In CSR format b is read and r is
+         *  written once, in tiles of rows; in the other formats the residual is a second pass.
+         * 
+         * @param b vector with rows() elements
+         * @param x vector with cols() elements
+         * @param r vector with rows() elements (it can be b itself)
+         * @return T ||r||^2
+         */
+        T
+        residual(std::span<const T> b, std::span<const T> x, std::span<T> r) const;
+
+        /**
+         * @brief product by a block of k vectors, stored as a row-major dense multi-vector:
+         *  X(j,c) is X[j*k+c]. In CSR/CSC format each element of the matrix is read once and
+         *  applied to the k columns; k = 1, 2, 4, 8, 16 have unrolled kernels. In the other
+         *  formats the k products are computed one after the other.
+         * 
+         * @param X multi-vector with one row for each column of the matrix and k columns
+         * @param k number of vectors
+         * @return std::vector<T> row-major multi-vector with one row for each row of the matrix
+         */
+        std::vector<T>
+        multiply_block(const std::vector<T> &X, unsigned int k) const;
 
         
         /**
@@ -234,9 +1165,9 @@ namespace algebra{
          * @param A Matrix object
          * @return std::ostream& 
          */
-        template<class U, StorageOrder order>
+        template<class U, StorageOrder order, template<class, StorageOrder> class M, class I, class O>
         friend std::ostream& 
-        operator<<(std::ostream& out, const Matrix<U, order>& A);
+        operator<<(std::ostream& out, const Matrix<U, order, M, I, O>& A);
 
         /**
          * @brief Matrix-vector product. Matrix can be compressed or uncompressed. 
@@ -247,9 +1178,40 @@ namespace algebra{
          * @return template<class U, StorageOrder order> 
          */
         //operator* overloading
-        template<class U, StorageOrder order>
+        template<class U, StorageOrder order, template<class, StorageOrder> class M, class I, class O>
         friend std::vector<U> 
-        operator*(const Matrix<U, order> &A,const std::vector<U> &b);
+        operator*(const Matrix<U, order, M, I, O> &A,const std::vector<U> &b);
+
+        /**
+         * @brief Matrix-matrix product of two matrices in CSR (or both in CSC) format.
+         *  The result is returned in the same compressed format, without passing through the map.
+         * 
+         * @param A left matrix (compressed)
+         * @param B right matrix (compressed), with as many rows as the columns of A
+         * @return Matrix<U, order, M, I, O> product A*B in compressed state (empty, with an
+         *  error, if the sizes do not match)
+         */
+        template<class U, StorageOrder order, template<class, StorageOrder> class M, class I, class O>
+        friend Matrix<U, order, M, I, O>
+        operator*(const Matrix<U, order, M, I, O> &A, const Matrix<U, order, M, I, O> &B);
+
+        /**
+         * @brief Matrix-vector product with a vector of another type: the values are converted,
+         *  and the products accumulated, in the type of the vector (e.g. float values and
+         *  double vectors, see multiply).
+         * 
+         * @param A Matrix (compressed or uncompressed)
+         * @param b vector
+         * @return std::vector<V> 
+         */
+        template<class U, class V, StorageOrder order, template<class, StorageOrder> class M, class I, class O>
+        requires (!std::is_same_v<U, V>)
+        friend std::vector<V>
+        operator*(const Matrix<U, order, M, I, O> &A, const std::vector<V> &b);
+
+        // the conversion constructor reads the storage of the matrices with other types of values
+        template<class U, StorageOrder order, template<class, StorageOrder> class M, class I, class O>
+        friend class Matrix;
 
 
     };
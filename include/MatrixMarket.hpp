@@ -0,0 +1,153 @@
+#ifndef HH_MATRIX_MARKET_HH
+#define HH_MATRIX_MARKET_HH
+#include <charconv>
+#include <complex>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+namespace algebra{
+
+    //! true if T is a std::complex
+    template<class T>
+    struct is_complex: std::false_type{};
+    template<class U>
+    struct is_complex<std::complex<U>>: std::true_type{};
+
+/**
+ * @brief helpers to parse a Matrix Market (.mtx) file held in memory, based on std::from_chars
+ *
+ */
+namespace market{
+
+    /**
+     * @brief information read from the banner and from the size line
+     *
+     */
+    struct Header{
+        bool        valid{false};
+        bool        pattern{false};  // no values: every entry is 1
+        bool        complex{false};  // two numbers (real and imaginary part) for each value
+        bool        symmetric{false};// only one triangle is listed, the other one is its mirror
+        bool        hermitian{false};// the mirror is the conjugate (with symmetric)
+        bool        skew{false};     // skew-symmetric: the mirror is the opposite (with symmetric)
+        std::size_t rows{0};
+        std::size_t cols{0};
+        std::size_t nnz{0};
+        const char* body{nullptr};   // first character of the entries
+    };
+
+    //! skip spaces and tabs
+    inline const char*
+    skip_blanks(const char* p, const char* end){
+        while(p<end && (*p==' ' || *p=='\t'))
+            ++p;
+        return p;
+    }
+
+    //! return the first character of the next line
+    inline const char*
+    next_line(const char* p, const char* end){
+        while(p<end && *p!='\n')
+            ++p;
+        return p<end ? p+1 : end;
+    }
+
+    //! parse an unsigned integer, p is moved after it
+    inline bool
+    parse_index(const char*& p, const char* end, std::size_t& value){
+        p=skip_blanks(p, end);
+        auto [ptr, ec]=std::from_chars(p, end, value);
+        p=ptr;
+        return ec==std::errc();
+    }
+
+    //! parse a real number (a leading '+' is accepted), p is moved after it
+    template<class U>
+    bool
+    parse_real(const char*& p, const char* end, U& value){
+        p=skip_blanks(p, end);
+        if(p<end && *p=='+')
+            ++p;
+        auto [ptr, ec]=std::from_chars(p, end, value);
+        p=ptr;
+        return ec==std::errc();
+    }
+
+    /**
+     * @brief parse the value of an entry according to the field of the file
+     *
+     * @tparam T type of the values of the matrix
+     * @param p position in the line, moved after the value
+     * @param end end of the file
+     * @param header header of the file (pattern and complex fields)
+     * @param value parsed value
+     * @return true if the value has been read
+     */
+    template<class T>
+    bool
+    parse_value(const char*& p, const char* end, const Header& header, T& value){
+        if(header.pattern){
+            value=T(1);
+            return true;
+        }
+        if constexpr(is_complex<T>::value){
+            typename T::value_type re{0}, im{0};
+            if(!parse_real(p, end, re))
+                return false;
+            if(header.complex && !parse_real(p, end, im))
+                return false;
+            value=T(re, im);
+            return true;
+        }else{
+            //complex files cannot be read in a real matrix
+            return !header.complex && parse_real(p, end, value);
+        }
+    }
+
+    /**
+     * @brief parse the banner, the comments and the size line of a coordinate Matrix Market file
+     *
+     * @param begin first character of the file
+     * @param end end of the file
+     * @return Header (valid is false if the file is not a coordinate Matrix Market file)
+     */
+    inline Header
+    parse_header(const char* begin, const char* end){
+        Header header;
+        const char* line_end=next_line(begin, end);
+        std::string_view banner(begin, line_end-begin);
+        if(banner.find("%%MatrixMarket")!=0 || banner.find("coordinate")==std::string_view::npos)
+            return header;
+        header.pattern=banner.find("pattern")!=std::string_view::npos;
+        header.complex=banner.find("complex")!=std::string_view::npos;
+        header.skew=banner.find("skew-symmetric")!=std::string_view::npos;
+        header.hermitian=banner.find("hermitian")!=std::string_view::npos;
+        header.symmetric=header.hermitian || banner.find("symmetric")!=std::string_view::npos;
+        //skip the comments
+        const char* p=line_end;
+        while(p<end && *p=='%')
+            p=next_line(p, end);
+        if(!parse_index(p, end, header.rows) || !parse_index(p, end, header.cols) || !parse_index(p, end, header.nnz))
+            return header;
+        header.body=next_line(p, end);
+        header.valid=true;
+        return header;
+    }
+
+    /**
+     * @brief return p if it is the beginning of a line, otherwise the beginning of the
+     *  following one: used to split the body of the file in chunks of whole lines
+     *
+     */
+    inline const char*
+    align_to_line(const char* p, const char* begin, const char* end){
+        if(p<=begin || p>=end)
+            return p<=begin ? begin : end;
+        return p[-1]=='\n' ? p : next_line(p, end);
+    }
+
+}// namespace market
+}// namespace algebra
+
+#endif// HH_MATRIX_MARKET_HH
@@ -5,26 +5,243 @@
 
 using namespace algebra;
 
+// conjugate of a complex value, the value itself if it is real
+template<class T>
+inline T
+conj_if_complex(const T& value){
+    if constexpr(is_complex<T>::value)
+        return std::conj(value);
+    else
+        return value;
+}
+
+// number of threads available by default (1 if OpenMP is not enabled)
+inline unsigned int
+default_num_threads(){
+#ifdef _OPENMP
+    return static_cast<unsigned int>(omp_get_max_threads());
+#else
+    return 1;
+#endif
+}
+
 //Default Constructor 
-template <class T, StorageOrder Order>
-Matrix<T, Order>::Matrix():
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+Matrix<T, Order, Map, Index, Offset>::Matrix():
 m_size{0},        //initialize the size to 0 rows and columns
-m_state{false}    //the state of the matrix is initialized to false(uncompressed state)
+m_format{StorageFormat::COOmap}, //the matrix is initialized in the uncompressed state
+m_threads{default_num_threads()},
+m_sell_chunk{0},
+m_block_size{0},
+m_bsr_kernel{nullptr},
+m_hash_threshold{0},
+m_linear_threshold{16},
+m_rows{0},
+m_cols{0},
+m_product_threads{1},
+m_simd_level{simd::SimdLevel::Scalar},
+m_reordering{Reordering::None},
+m_symmetry{Symmetry::General},
+m_delta_threshold{1024},
+m_frozen{false}
 {}
 
-template <class T, StorageOrder Order>
-Matrix<T, Order>::Matrix(unsigned int i, unsigned int j)
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+Matrix<T, Order, Map, Index, Offset>::Matrix(unsigned int i, unsigned int j)
 {
     m_size[0]=i;  //number of rows
     m_size[1]=j;  //number of columns
     m_size={0,0}; //initialize the size to 0 rows and columns
-    m_state=false;//the state of the matrix is initialized to false(uncompressed state)
-  
+    m_format=StorageFormat::COOmap;//the matrix is initialized in the uncompressed state
+    m_threads=default_num_threads();
+    m_sell_chunk=0;
+    m_block_size=0;
+    m_bsr_kernel=nullptr;
+    m_hash_threshold=0;
+    m_linear_threshold=16;
+    m_rows=0;
+    m_cols=0;
+    m_product_threads=1;
+    m_simd_level=simd::SimdLevel::Scalar;
+    m_reordering=Reordering::None;
+    m_symmetry=Symmetry::General;
+    m_delta_threshold=1024;
+    m_frozen=false;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class Combine>
+Matrix<T, Order, Map, Index, Offset>::Matrix(unsigned int i, unsigned int j,
+                         const std::vector<unsigned int> &rows, const std::vector<unsigned int> &cols,
+                         const std::vector<T> &values, Combine combine):
+Matrix()
+{
+    m_size[0]=i;  //number of rows
+    m_size[1]=j;  //number of columns
+    set_from_triplets(rows, cols, values, combine);
+}
+
+//Conversion from another type of values
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class U>
+Matrix<T, Order, Map, Index, Offset>::Matrix(const Matrix<U, Order, Map, Index, Offset> &other):
+Matrix()
+{
+    if(other.m_format==StorageFormat::BSR){
+        //the kernel of the blocks is bound to their size: the copy passes through the map
+        Matrix<U, Order, Map, Index, Offset> copy(other);
+        copy.uncompress();
+        *this=Matrix(copy);
+        return;
+    }
+    m_size=other.m_size;
+    m_nnz=other.m_nnz;
+    m_m=other.m_m;
+    m_format=other.m_format;
+    m_threads=other.m_threads;
+    m_hash_threshold=other.m_hash_threshold;
+    m_linear_threshold=other.m_linear_threshold;
+    m_reordering=other.m_reordering;
+    m_permutation=other.m_permutation;
+    m_symmetry=other.m_symmetry;
+    m_delta_threshold=other.m_delta_threshold;
+    m_frozen=other.m_frozen;
+    for (const auto& [key, value] : other.m_data)
+        m_data.insert({key, static_cast<T>(value)});
+    for (const auto& [key, value] : other.m_delta)
+        m_delta.insert({key, static_cast<T>(value)});
+    //the values are converted, the indices are copied as they are
+    std::vector<T> val(other.m_val.size());
+    std::transform(other.m_val.begin(), other.m_val.end(), val.begin(),
+                   [](const U& value){ return static_cast<T>(value); });
+    m_val=std::move(val);
+    m_outer_index=other.m_outer_index;
+    m_inner_index=other.m_inner_index;
+    m_sell_chunk=other.m_sell_chunk;
+    m_sell_slice_ptr=other.m_sell_slice_ptr;
+    m_sell_perm=other.m_sell_perm;
+    m_sell_row_pos=other.m_sell_row_pos;
+    m_sell_row_len=other.m_sell_row_len;
+    m_hash_ptr=other.m_hash_ptr;
+    m_hash_slots=other.m_hash_slots;
+    if(m_format!=StorageFormat::COOmap)
+        cache_product_data();
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::set_num_threads(unsigned int n){
+#ifdef _OPENMP
+    m_threads= n==0 ? default_num_threads() : n;
+#else
+    //without OpenMP the product is always serial
+    m_threads=1;
+#endif
+    if(is_compressed())
+        cache_product_data();//the partition depends on the number of threads
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::set_symmetry(Symmetry symmetry){
+    if(m_format!=StorageFormat::COOmap){
+        std::cerr<<"WARNING! The symmetry of the storage can be changed only in the uncompressed state. No changes."<<std::endl;
+        return;
+    }
+    if constexpr(!is_complex<T>::value)
+        //a real hermitian matrix is symmetric
+        if(symmetry==Symmetry::Hermitian)
+            symmetry=Symmetry::Symmetric;
+    m_symmetry=symmetry;
 }
 
-template <class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 void
-Matrix<T, Order>::resize(unsigned int i, unsigned int j){
+Matrix<T, Order, Map, Index, Offset>::set_delta_threshold(std::size_t n){
+    m_delta_threshold=n;
+    if(m_delta.size()>m_delta_threshold)
+        merge_delta();
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool
+Matrix<T, Order, Map, Index, Offset>::merge_delta(){
+    //with a frozen pattern the buffer is always empty
+    if(m_delta.empty())
+        return true;
+    //position of the row (column) and of the column (row) inside the key
+    constexpr std::size_t major= Order==StorageOrder::RowWise ? 0 : 1, minor=1-major;
+    const std::size_t n_old=m_inner_index.size()-1;
+    std::size_t n_major=n_old, n_minor=minor_size();
+    for (const auto& [key, value] : m_delta){
+        n_major=std::max(n_major, key[major]+1);
+        n_minor=std::max(n_minor, key[minor]+1);
+        m_size[0]=std::max(m_size[0], key[0]+1);
+        m_size[1]=std::max(m_size[1], key[1]+1);
+    }
+    if(!fits_index_types(n_minor, m_val.size()+m_delta.size()))
+        return false;
+
+    std::vector<T>      val;
+    std::vector<Index>  outer_index;
+    std::vector<Offset> inner_index;
+    val.reserve(m_val.size()+m_delta.size());
+    outer_index.reserve(m_val.size()+m_delta.size());
+    inner_index.reserve(n_major+1);
+    inner_index.emplace_back(0);
+    //both the rows (columns) of the arrays and the buffer are sorted: each row is a merge
+    //of the two, as the buffer has only elements that are not in the arrays
+    auto it=m_delta.begin();
+    for (std::size_t m=0; m<n_major; ++m){
+        std::size_t k= m<n_old ? m_inner_index[m] : 0;
+        const std::size_t last= m<n_old ? m_inner_index[m+1] : 0;
+        for (; it!=m_delta.end() && (*it).first[major]==m; ++it){
+            const auto [key, value]=*it;
+            for (; k<last && m_outer_index[k]<key[minor]; ++k){
+                val.emplace_back(m_val[k]);
+                outer_index.emplace_back(m_outer_index[k]);
+            }
+            val.emplace_back(value);
+            outer_index.emplace_back(static_cast<Index>(key[minor]));
+        }
+        for (; k<last; ++k){
+            val.emplace_back(m_val[k]);
+            outer_index.emplace_back(m_outer_index[k]);
+        }
+        inner_index.emplace_back(val.size());
+    }
+    m_delta.clear();
+    m_val=std::move(val);
+    m_outer_index=std::move(outer_index);
+    m_inner_index=std::move(inner_index);
+    m_nnz=m_val.size();
+    m_m=n_major;
+    build_row_hash();
+    cache_product_data();
+    return true;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::vector<std::size_t>
+Matrix<T, Order, Map, Index, Offset>::nnz_balanced_partition(std::span<const Offset> ptr, unsigned int parts){
+    const std::size_t n=ptr.size()-1;//number of rows (CSR), columns (CSC) or slices (SELL)
+    const std::size_t nnz=ptr.back();
+    std::vector<std::size_t> bounds(parts+1,n);
+    bounds[0]=0;
+    for(unsigned int t=1; t<parts; ++t){
+        //first row/column whose starting index is beyond the t-th fraction of the non-zeros
+        std::size_t target=nnz*t/parts;
+        auto it=std::lower_bound(ptr.begin(), ptr.end()-1, target);
+        bounds[t]=std::max<std::size_t>(bounds[t-1], it-ptr.begin());
+    }
+    return bounds;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::resize(unsigned int i, unsigned int j){
+   if(frozen_warning("resize"))
+       return;
    // check the state of matrix, and uncompress if it is compressed 
    if(this->is_compressed())
    {
@@ -34,36 +251,68 @@ Matrix<T, Order>::resize(unsigned int i, unsigned int j){
     m_size[0]=i;
     m_size[1]=j;
 }
-template<class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 void
-Matrix<T, Order>::uncompress(){
-    if (is_compressed()){
-        if (Order==StorageOrder::RowWise){
-            unsigned int j=m_inner_index[0];
-            //fill the map with the elements of the compressed matrix
-            for (auto it=m_inner_index.begin(); it!=(m_inner_index.end()-1); ++it){
-                for(auto i=*it; i<*(it+1); ++i){
-                    m_data.insert({{j,m_outer_index[i]} , m_val[i]});//insert the element in the map
-                }
-                ++j;//increment the row index
+Matrix<T, Order, Map, Index, Offset>::uncompress(){
+    if(frozen_warning("uncompress"))
+        return;
+    if (m_format==StorageFormat::SELL){
+        //fill the map skipping the padding of each sorted row
+        for (std::size_t p=0; p<m_sell_perm.size(); ++p){
+            const std::size_t s=p/m_sell_chunk, r=p%m_sell_chunk;
+            for (unsigned int k=0; k<m_sell_row_len[p]; ++k){
+                const std::size_t idx=m_sell_slice_ptr[s]+k*m_sell_chunk+r;
+                m_data.insert({{m_sell_perm[p], m_outer_index[idx]}, m_val[idx]});
             }
-        }    
+        }
+        m_sell_slice_ptr.clear();
+        m_sell_perm.clear();
+        m_sell_row_pos.clear();
+        m_sell_row_len.clear();
+    }else if (m_format==StorageFormat::BSR){
+        //fill the map with the elements of the blocks, the zeros added to complete the blocks are dropped
+        const std::size_t B=m_block_size;
+        for (std::size_t br=0; br+1<m_inner_index.size(); ++br){
+            for (std::size_t k=m_inner_index[br]; k<m_inner_index[br+1]; ++k){
+                for (std::size_t r=0; r<B; ++r)
+                    for (std::size_t c=0; c<B; ++c)
+                        if (m_val[k*B*B+r*B+c]!=get_zero())
+                            m_data.insert({{br*B+r, m_outer_index[k]*B+c}, m_val[k*B*B+r*B+c]});
+            }
+        }
+    }else if (is_compressed()){
+        //fill the map with the elements of the compressed matrix: the row (column) j and the column
+        //(row) of each element. They come in the order of the map, so every insertion is at the end
+        for (std::size_t j=0; j+1<m_inner_index.size(); ++j){
+            for (std::size_t i=m_inner_index[j]; i<m_inner_index[j+1]; ++i){
+                const Indices key= Order==StorageOrder::RowWise ? Indices{j, m_outer_index[i]} : Indices{m_outer_index[i], j};
+                m_data.insert(m_data.end(), {key, m_val[i]});//insert the element in the map
+            }
+        }
+        //the elements inserted in compressed state
+        for (const auto& [key, value] : m_delta)
+            m_data.insert({key, value});
+        m_delta.clear();
     }
     // update the state and clear the vectors of the comprres state for memory saving
-    m_state=false;
+    m_format=StorageFormat::COOmap;
     m_val.clear();
     m_outer_index.clear();
     m_inner_index.clear();
+    m_hash_ptr.clear();
+    m_hash_slots.clear();
 }
 //Update Properties of the matrix
-template <class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 void
-Matrix<T, Order>::update_properties()
+Matrix<T, Order, Map, Index, Offset>::update_properties()
 {
     m_nnz=0; //initialize the number of non zero elements to 0
     m_m=0;   //initialize the number of non empty rows/columns to 0
 
-    auto it=m_data.rbegin(); //get the last element of the map
+    if(m_data.empty())
+        return;
+    auto it=std::prev(m_data.end()); //get the last element of the map
     // The number of rows can be found looking at the last element of the map.
     // The same is true for column-major ordering for the number of columns.
     
@@ -76,17 +325,71 @@ Matrix<T, Order>::update_properties()
     m_nnz=m_data.size(); //use the size of the map to retrieve the number of elements 
 }
 
-template <class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 T
-Matrix<T, Order>::get_zero()
+Matrix<T, Order, Map, Index, Offset>::get_zero()
 {
     static T zeroValue;
     return zeroValue;
 }
 
-template <class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 T&
-Matrix<T, Order>::read_compressed_matrix(const Indices& key){
+Matrix<T, Order, Map, Index, Offset>::read_compressed_matrix(const Indices& key){
+    if(m_format==StorageFormat::SELL){
+        //look for the column in the sorted position of the row, skipping the padding
+        if(key[0]<m_sell_row_pos.size()){
+            const std::size_t p=m_sell_row_pos[key[0]];
+            const std::size_t s=p/m_sell_chunk, r=p%m_sell_chunk;
+            for(unsigned int k=0; k<m_sell_row_len[p]; ++k){
+                const std::size_t idx=m_sell_slice_ptr[s]+k*m_sell_chunk+r;
+                if(m_outer_index[idx]==key[1])
+                    return m_val[idx];
+            }
+        }
+        m_dummy_value=get_zero();//if the element is not present I will return 0
+        return m_dummy_value;
+    }
+    if(m_format==StorageFormat::BSR){
+        //look for the block column in the block row, then for the element inside the block
+        const std::size_t B=m_block_size;
+        const std::size_t br=key[0]/B;
+        if(br+1<m_inner_index.size()){
+            auto first=m_outer_index.begin()+m_inner_index[br], last=m_outer_index.begin()+m_inner_index[br+1];
+            auto it=std::lower_bound(first, last, key[1]/B);
+            if(it!=last && *it==key[1]/B){
+                const std::size_t k=it-m_outer_index.begin();
+                return m_val[k*B*B+(key[0]%B)*B+key[1]%B];
+            }
+        }
+        m_dummy_value=get_zero();//if the element is not present I will return 0
+        return m_dummy_value;
+    }
+    if(m_symmetry!=Symmetry::General && key[0]<key[1]){
+        //only the lower triangle is stored: the mirrored element is read. The conjugate of a
+        //hermitian matrix is a copy, it cannot be modified
+        T& mirrored=read_compressed_matrix({key[1], key[0]});
+        if(m_symmetry==Symmetry::Symmetric || &mirrored==&m_dummy_value)
+            return mirrored;
+        m_dummy_value=conj_if_complex(mirrored);
+        return m_dummy_value;
+    }
+    const std::size_t k=find_slot(key);
+    if(k!=no_slot)
+        return m_val[k];
+    //the element can be one of those inserted after the compression
+    if(!m_delta.empty()){
+        auto it=m_delta.find(key);
+        if(it!=m_delta.end())
+            return it->second;
+    }
+    m_dummy_value=get_zero();//if the element is not present I will return 0
+    return m_dummy_value;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::size_t
+Matrix<T, Order, Map, Index, Offset>::find_slot(const Indices& key) const{
     int i, j;
     //check the order of the storage
     if constexpr(Order==StorageOrder::RowWise){
@@ -96,45 +399,210 @@ Matrix<T, Order>::read_compressed_matrix(const Indices& key){
         i=1;
         j=0;
     }
-    //search the element in the outer_index vector
-    auto it=std::find(m_outer_index.begin()+m_inner_index[key[i]], 
-                     m_outer_index.begin()+m_inner_index[key[i]+1], key[j]);
-    //if the element is present in the outer_index vector
-    //I can find the value in the m_val vector
-    if(it != m_outer_index.begin() +m_inner_index[key[i]+1]){
-        std::size_t index=it-m_outer_index.begin();
-        return m_val[index];
-    }else{
-        //std::cerr<<"Warning:Matrix is compressed: reading only"<<std::endl;
-        m_dummy_value=get_zero();//if the element is not present I will return 0
-        return m_dummy_value;
-    }      
+    const std::size_t row=key[i];
+    if(key[j]>std::numeric_limits<Index>::max())
+        //the index cannot be stored in the matrix: the element is not present
+        return no_slot;
+    const Index index=static_cast<Index>(key[j]);
+    if(row+1<m_hash_ptr.size() && m_hash_ptr[row]!=m_hash_ptr[row+1]){
+        //long row: probe its hash table until the element or an empty slot is found
+        const Offset* slots=m_hash_slots.data()+m_hash_ptr[row];
+        const std::size_t n_slots=m_hash_ptr[row+1]-m_hash_ptr[row];
+        for(std::size_t s=hash_slot(index, std::countr_zero(n_slots)); slots[s]!=hash_empty; s=(s+1)&(n_slots-1)){
+            if(m_outer_index[slots[s]]==index)
+                return slots[s];
+        }
+    }else if(row+1<m_inner_index.size()){
+        const std::size_t begin=m_inner_index[row], n=m_inner_index[row+1]-begin;
+        if(n<=m_linear_threshold){
+            //short row: linear scan
+            const Index* first=m_outer_index.data()+begin;
+            const std::size_t k=std::find(first, first+n, index)-first;
+            return k<n ? begin+k : no_slot;
+        }
+        //the indices of a row are sorted by compress(): binary search in the row
+        const std::size_t k=begin+branchless_lower_bound(m_outer_index.data()+begin, n, index);
+        if(k<begin+n && m_outer_index[k]==index)
+            return k;
+    }
+    return no_slot;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool
+Matrix<T, Order, Map, Index, Offset>::frozen_warning(const char* operation) const{
+    if(!m_frozen)
+        return false;
+    std::cerr<<"WARNING! The pattern of the matrix is frozen: "<<operation<<" is not allowed. No changes."<<std::endl;
+    return true;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::freeze_pattern(bool frozen){
+    if(frozen && m_format!=StorageFormat::Compressed){
+        std::cerr<<"WARNING! Only the pattern of a matrix in CSR/CSC format can be frozen. No changes."<<std::endl;
+        return;
+    }
+    if(frozen && !merge_delta())
+        return;
+    m_frozen=frozen;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::size_t
+Matrix<T, Order, Map, Index, Offset>::slot(std::size_t i, std::size_t j) const{
+    if(m_format!=StorageFormat::Compressed || (m_symmetry!=Symmetry::General && i<j))
+        return no_slot;
+    return find_slot({i, j});
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+AssemblyPlan
+Matrix<T, Order, Map, Index, Offset>::assembly_plan(const std::vector<unsigned int> &rows, const std::vector<unsigned int> &cols) const{
+    AssemblyPlan plan;
+    if(!m_frozen){
+        std::cerr<<"WARNING! The assembly plan needs a frozen pattern (see freeze_pattern)"<<std::endl;
+        return plan;
+    }
+    const std::size_t n=std::min(rows.size(), cols.size());
+    plan.n_contributions=n;
+    //the searches are independent
+    std::vector<std::size_t> slots(n);
+    std::size_t n_outside{0};
+    #pragma omp parallel for num_threads(m_threads) reduction(+:n_outside)
+    for(std::size_t k=0; k<n; ++k){
+        slots[k]=slot(rows[k], cols[k]);
+        if(slots[k]==no_slot && (m_symmetry==Symmetry::General || rows[k]>=cols[k]))
+            ++n_outside;
+    }
+    if(n_outside>0)
+        std::cerr<<"WARNING! "<<n_outside<<" contributions outside the pattern are skipped"<<std::endl;
+    //counting sort of the contributions on their slot, in the order of the list
+    plan.ptr.assign(m_val.size()+1, 0);
+    for(std::size_t k=0; k<n; ++k)
+        if(slots[k]!=no_slot)
+            ++plan.ptr[slots[k]+1];
+    std::partial_sum(plan.ptr.begin(), plan.ptr.end(), plan.ptr.begin());
+    plan.order.resize(plan.ptr.back());
+    std::vector<std::size_t> next(plan.ptr.begin(), plan.ptr.end()-1);
+    for(std::size_t k=0; k<n; ++k)
+        if(slots[k]!=no_slot)
+            plan.order[next[slots[k]]++]=k;
+    return plan;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::refill(const AssemblyPlan &plan, std::span<const T> values){
+    if(!m_frozen || plan.ptr.size()!=m_val.size()+1){
+        std::cerr<<"WARNING! The refill needs a frozen pattern and a plan built on it. No changes."<<std::endl;
+        return;
+    }
+    if(values.size()<plan.n_contributions){
+        std::cerr<<"WARNING! Fewer values than contributions in the plan. No changes."<<std::endl;
+        return;
+    }
+    //each value is the sum of its group, written by one thread
+    const std::size_t n_slots=m_val.size();
+    T* val=m_val.data();
+    #pragma omp parallel for num_threads(m_threads) schedule(static)
+    for(std::size_t s=0; s<n_slots; ++s){
+        T sum{0};
+        for(std::size_t p=plan.ptr[s]; p<plan.ptr[s+1]; ++p)
+            sum+=values[plan.order[p]];
+        val[s]=sum;
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::size_t
+Matrix<T, Order, Map, Index, Offset>::branchless_lower_bound(const Index* first, std::size_t n, Index value){
+    if(n==0)
+        return 0;
+    const Index* base=first;
+    //halve the interval keeping the answer in [base, base+n]: the comparison becomes a conditional move
+    while(n>1){
+        const std::size_t half=n/2;
+        base=(base[half]<value) ? base+half : base;
+        n-=half;
+    }
+    return (base-first)+(*base<value);
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::set_row_hash_threshold(unsigned int n){
+    m_hash_threshold=n;
+    build_row_hash();
 }
-template<class T, StorageOrder Order>
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 void
-Matrix<T, Order>::update_compressed_values(std::vector<T>    &val)
+Matrix<T, Order, Map, Index, Offset>::build_row_hash()
 {
-    val=m_val;//update val after a change of m_val.
+    m_hash_ptr.clear();
+    m_hash_slots.clear();
+    if(m_hash_threshold==0 || m_format!=StorageFormat::Compressed || m_inner_index.empty())
+        return;
+    //number of slots of each table: a power of two at least twice the length of the row
+    const std::size_t n_major=m_inner_index.size()-1;
+    m_hash_ptr.assign(n_major+1, 0);
+    bool any{false};
+    for(std::size_t r=0; r<n_major; ++r){
+        const std::size_t len=m_inner_index[r+1]-m_inner_index[r];
+        const std::size_t n_slots= len>=m_hash_threshold ? std::bit_ceil(2*len) : 0;
+        any= any || n_slots>0;
+        m_hash_ptr[r+1]=m_hash_ptr[r]+n_slots;
+    }
+    if(!any){
+        m_hash_ptr.clear();
+        return;
+    }
+    m_hash_slots.assign(m_hash_ptr.back(), hash_empty);
+    //the tables are independent: fill them in parallel with linear probing
+    #pragma omp parallel for schedule(dynamic, 64) num_threads(m_threads)
+    for(std::size_t r=0; r<n_major; ++r){
+        const std::size_t n_slots=m_hash_ptr[r+1]-m_hash_ptr[r];
+        if(n_slots==0)
+            continue;
+        Offset* slots=m_hash_slots.data()+m_hash_ptr[r];
+        const unsigned int bits=std::countr_zero(n_slots);
+        for(Offset k=m_inner_index[r]; k<m_inner_index[r+1]; ++k){
+            std::size_t s=hash_slot(m_outer_index[k], bits);
+            while(slots[s]!=hash_empty)
+                s=(s+1)&(n_slots-1);
+            slots[s]=k;
+        }
+    }
+}
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::update_compressed_values(std::vector<T>    &val)
+{
+    val=m_val.to_vector();//update val after a change of m_val.
     //This chenge can happen because modification of non zero elements are allowed with operator()
 }
 //Compress the matrix 
-template <class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 void 
-Matrix<T, Order>::compress(std::vector<T>             &val,
-                    std::vector<unsigned int> &outer_index,
-                    std::vector<unsigned int> &inner_index)
+Matrix<T, Order, Map, Index, Offset>::compress()
 {
+    if(frozen_warning("compress"))
+        return;
+    //a matrix in CSR/CSC format is already compressed: only the pending insertions are merged
+    if(m_format==StorageFormat::Compressed){
+        merge_delta();
+        return;
+    }
+    //switch from SELL-C-sigma or BSR passing through the COOmap format
+    if(m_format==StorageFormat::SELL || m_format==StorageFormat::BSR)
+        uncompress();
+    std::vector<unsigned int> perm;
+    if(m_reordering!=Reordering::None)
+        perm=renumbering();
     update_properties();
 
-    // val has the dimension of the number of the elements in the map
-    val.reserve(m_nnz); 
-    //outer_index has the dimension of the number of the elements in the map
-    outer_index.reserve(m_nnz); 
-
-    // inner_index has the dimension of nrows+1 or ncols+1
-    inner_index.reserve(m_m+1);//initialize the inner_index with the number of rows+1
-    inner_index.emplace_back(0);//first element always zero
-    unsigned int temp_idx{0}, key_old{0};
     int i, j;
     //check the order of the storage
     if constexpr(Order==StorageOrder::RowWise){
@@ -144,45 +612,704 @@ Matrix<T, Order>::compress(std::vector<T>             &val,
         i=0;
         j=1;
     }
+    //the map is released by the traversal, so the indices are checked before: the keys come from
+    //unsigned int indices, only a narrower Index needs the largest one
+    std::size_t n_minor{0};
+    if constexpr(sizeof(Index)<sizeof(unsigned int)){
+        for (const auto& [key, value] : m_data)
+            n_minor=std::max<std::size_t>(n_minor, key[i]+1);
+    }
+    n_minor=std::max(n_minor, perm.size());
+    //the indices would be truncated: the matrix stays in the COOmap state
+    if(!fits_index_types(n_minor, m_nnz))
+        return;
+    if(!perm.empty()){
+        compress_renumbered(perm);
+        m_nnz=m_val.size();
+        build_row_hash();
+        cache_product_data();
+        return;
+    }
+
+    // val and outer_index have the dimension of the number of the elements in the map,
+    // inner_index the number of rows+1 or columns+1. val and outer_index grow while the map
+    // is released: reserving them up front would hold the whole map and the whole arrays at once
+    std::vector<T>      val;
+    std::vector<Index>  outer_index;
+    std::vector<Offset> inner_index;
+    inner_index.reserve(std::max<std::size_t>(m_m, m_size[j])+1);
+    inner_index.emplace_back(0);//first element always zero
+
     // traversing the map and fill the vector that represents the matrix in
-    // the compressed state
-    for (auto [key, value] : m_data)
+    // the compressed state, one row (column) at a time
+    auto it=m_data.begin();
+    while (it!=m_data.end())
     {
-        val.emplace_back(value);//fill the val vector with the values of the map
+        const auto first=it;
+        const std::size_t major=(*it).first[j];
+        //a new row/column starts: the number of elements so far is inserted in the inner_index,
+        //once for each row/column between the previous one and the current one (empty rows/columns are kept)
+        while (inner_index.size()<=major)
+            inner_index.emplace_back(val.size());
+        for (; it!=m_data.end() && (*it).first[j]==major; ++it){
+            const auto [key, value]=*it;
+            //with a symmetric storage the upper triangle is not stored
+            if(m_symmetry!=Symmetry::General && key[0]<key[1])
+                continue;
+            val.emplace_back(value);//fill the val vector with the values of the map
+            //outer index is filled with the column indeces if row-major ordering;
+            // with the row indeces if column-major ordering
+            outer_index.emplace_back(static_cast<Index>(key[i]));
+        }
+        //the elements of the row/column are released as soon as they are copied
+        it=m_data.erase(first, it);
+    }
+    //close the last row/column, and the empty ones up to the size of the matrix
+    const std::size_t n_major=std::max<std::size_t>(m_m, m_size[j]);
+    while (inner_index.size()<=n_major)
+        inner_index.emplace_back(val.size());
+
+    m_format=StorageFormat::Compressed;   //update the state of the matrix
+    //the map is empty now: the spare capacity of the growth is released
+    val.shrink_to_fit();
+    outer_index.shrink_to_fit();
+    //the arrays are moved in the private variables of the class
+    m_val=std::move(val);
+    m_outer_index=std::move(outer_index);
+    m_inner_index=std::move(inner_index);
+    //with a symmetric storage the upper triangle of the map has been dropped
+    m_nnz=m_val.size();
+    build_row_hash();
+    cache_product_data();
+}
 
-        //outer index is filled with the column indeces if row-major ordering;
-        // with the row indeces if column-major ordering
-        outer_index.emplace_back(key[i]); 
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void 
+Matrix<T, Order, Map, Index, Offset>::compress(std::vector<T>             &val,
+                    std::vector<Index>        &outer_index,
+                    std::vector<Offset>       &inner_index)
+{
+    compress();
+    if(m_format!=StorageFormat::Compressed){
+        val.clear();
+        outer_index.clear();
+        inner_index.clear();
+        return;
+    }
+    //copy of the arrays for the caller
+    val=m_val.to_vector();
+    outer_index=m_outer_index.to_vector();
+    inner_index=m_inner_index.to_vector();
+}
 
-        //fill the inner_index with the number of elements in a row/column counting until the next one
-        //if the row/column is different from the previous element the temp_idx is inserted in the inner_index and
-        // the key_old is updated
-        if (key[j]!=key_old)
-        {
-            inner_index.emplace_back(temp_idx);
-            key_old=key[j];
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool
+Matrix<T, Order, Map, Index, Offset>::set_compressed(std::vector<T> &&val, std::vector<Index> &&outer_index, std::vector<Offset> &&inner_index)
+{
+    if(frozen_warning("set_compressed"))
+        return false;
+    if(outer_index.size()!=val.size() ||
+       !valid_arrays(outer_index, inner_index, std::numeric_limits<std::size_t>::max(), m_symmetry)){
+        std::cerr<<"WARNING! The arrays are not a valid CSR/CSC matrix. No changes."<<std::endl;
+        return false;
+    }
+    //the previous content of the matrix is replaced
+    const std::size_t n_major=inner_index.size()-1;
+    clear_storage();
+    m_val=std::move(val);
+    m_outer_index=std::move(outer_index);
+    m_inner_index=std::move(inner_index);
+    constexpr std::size_t major= Order==StorageOrder::RowWise ? 0 : 1;
+    m_size[major]=std::max(m_size[major], n_major);
+    m_size[1-major]=minor_size();
+    m_nnz=m_val.size();
+    m_m=n_major;
+    m_format=StorageFormat::Compressed;
+    build_row_hash();
+    cache_product_data();
+    return true;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool
+Matrix<T, Order, Map, Index, Offset>::valid_arrays(std::span<const Index> outer_index, std::span<const Offset> inner_index,
+                                                   std::size_t n_minor, Symmetry symmetry)
+{
+    if(inner_index.empty() || inner_index.front()!=0 || inner_index.back()!=outer_index.size())
+        return false;
+    for (std::size_t m=0; m+1<inner_index.size(); ++m){
+        if(inner_index[m]>inner_index[m+1])
+            return false;
+        for (std::size_t k=inner_index[m]; k<inner_index[m+1]; ++k){
+            const std::size_t index=outer_index[k];
+            if((k>inner_index[m] && outer_index[k-1]>=outer_index[k]) || index>=n_minor)
+                return false;
+            //only the lower triangle with a symmetric storage
+            if(symmetry!=Symmetry::General && (Order==StorageOrder::RowWise ? index>m : index<m))
+                return false;
+        }
+    }
+    return true;
+}
+
+//Permutation of the rows and columns of the map
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::vector<unsigned int>
+Matrix<T, Order, Map, Index, Offset>::renumbering() const
+{
+    //the size must cover all the elements of the map
+    std::array<std::size_t,2> size=m_size;
+    for (const auto& [key, value] : m_data){
+        size[0]=std::max<std::size_t>(size[0], key[0]+1);
+        size[1]=std::max<std::size_t>(size[1], key[1]+1);
+    }
+    if(size[0]!=size[1]){
+        std::cerr<<"WARNING! Only square matrices can be renumbered: the numbering is kept"<<std::endl;
+        return {};
+    }
+    return rcm_permutation(size[0]);
+}
+
+//Compress the map with rows and columns renumbered
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::compress_renumbered(const std::vector<unsigned int> &perm)
+{
+    constexpr std::size_t i= Order==StorageOrder::RowWise ? 1 : 0;
+    constexpr std::size_t j=1-i;
+    const std::size_t n=perm.size();
+    std::vector<unsigned int> inverse(n);
+    for (std::size_t k=0; k<n; ++k)
+        inverse[perm[k]]=k;
+    //new position of an element: with one triangle, the elements that move above the diagonal
+    //are replaced by their mirror
+    auto renumber=[&](const std::array<std::size_t,2> &key){
+        std::array<std::size_t,2> position{inverse[key[0]], inverse[key[1]]};
+        const bool mirrored= m_symmetry!=Symmetry::General && position[0]<position[1];
+        if(mirrored)
+            std::swap(position[0], position[1]);
+        return std::make_pair(position, mirrored);
+    };
+    //length of each new row (column)
+    std::vector<Offset> inner_index(n+1, 0);
+    for (const auto& [key, value] : m_data)
+        if(m_symmetry==Symmetry::General || key[0]>=key[1])
+            ++inner_index[renumber({key[0], key[1]}).first[j]+1];
+    std::partial_sum(inner_index.begin(), inner_index.end(), inner_index.begin());
+    std::vector<T>      val(inner_index[n]);
+    std::vector<Index>  outer_index(inner_index[n]);
+    std::vector<Offset> next(inner_index.begin(), inner_index.end()-1);
+    //the elements of a row (column) of the map are scattered, then the row (column) is released
+    auto it=m_data.begin();
+    while (it!=m_data.end()){
+        const auto first=it;
+        const std::size_t major=(*it).first[j];
+        for (; it!=m_data.end() && (*it).first[j]==major; ++it){
+            const auto [key, value]=*it;
+            if(m_symmetry!=Symmetry::General && key[0]<key[1])
+                continue;
+            const auto [position, mirrored]=renumber({key[0], key[1]});
+            const Offset p=next[position[j]]++;
+            val[p]= mirrored && m_symmetry==Symmetry::Hermitian ? conj_if_complex(value) : value;
+            outer_index[p]=static_cast<Index>(position[i]);
+        }
+        it=m_data.erase(first, it);
+    }
+    //the elements of a new row (column) come from different rows of the map: sort them
+    std::vector<std::pair<Index, T>> row;
+    for (std::size_t m=0; m<n; ++m){
+        row.clear();
+        for (Offset p=inner_index[m]; p<inner_index[m+1]; ++p)
+            row.emplace_back(outer_index[p], val[p]);
+        std::sort(row.begin(), row.end(), [](const auto &a, const auto &b){ return a.first<b.first; });
+        for (Offset p=inner_index[m]; p<inner_index[m+1]; ++p)
+            std::tie(outer_index[p], val[p])=row[p-inner_index[m]];
+    }
+    m_format=StorageFormat::Compressed;
+    m_val=std::move(val);
+    m_outer_index=std::move(outer_index);
+    m_inner_index=std::move(inner_index);
+    //compose with a previous renumbering, so that the permutation refers to the original numbering
+    if(m_permutation.size()==n){
+        for (std::size_t k=0; k<n; ++k)
+            inverse[k]=m_permutation[perm[k]];
+        m_permutation.swap(inverse);
+    }else
+        m_permutation=perm;
+}
+
+//Reverse Cuthill-McKee ordering
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::vector<unsigned int>
+Matrix<T, Order, Map, Index, Offset>::rcm_permutation(std::size_t n) const
+{
+    //adjacency lists of the graph of A+A^T, without the diagonal: they hold every off-diagonal
+    //element twice, so the pointers are wider than the Offset type of the matrix
+    std::vector<std::size_t> ptr(n+1, 0);
+    for (const auto& [key, value] : m_data){
+        if(key[0]!=key[1]){
+            ++ptr[key[0]+1];
+            ++ptr[key[1]+1];
+        }
+    }
+    for (std::size_t i=0; i<n; ++i)
+        ptr[i+1]+=ptr[i];
+    std::vector<unsigned int> adj(ptr[n]);
+    std::vector<std::size_t>  next(ptr.begin(), ptr.end()-1);
+    for (const auto& [key, value] : m_data){
+        if(key[0]!=key[1]){
+            adj[next[key[0]]++]=key[1];
+            adj[next[key[1]]++]=key[0];
+        }
+    }
+    //the symmetric elements appear twice: sort and remove the duplicates of each list
+    std::vector<unsigned int> degree(n);
+    for (std::size_t i=0; i<n; ++i){
+        std::sort(adj.begin()+ptr[i], adj.begin()+ptr[i+1]);
+        degree[i]=std::unique(adj.begin()+ptr[i], adj.begin()+ptr[i+1])-(adj.begin()+ptr[i]);
+    }
+
+    //breadth first search from root, on the nodes not yet numbered: the visited nodes are appended
+    //to order (by increasing degree among the neighbours of a node), the number of levels is returned
+    //and last_level is the position in order of the first node of the last level
+    std::vector<bool>         numbered(n, false);
+    std::vector<unsigned int> stamp(n, 0);
+    unsigned int              search=0;
+    auto bfs=[&](unsigned int root, std::vector<unsigned int>& order, std::size_t& last_level){
+        ++search;
+        const std::size_t first=order.size();
+        order.push_back(root);
+        stamp[root]=search;
+        unsigned int n_levels=0;
+        for (std::size_t level_begin=first, level_end=order.size(); level_begin<level_end;
+             level_begin=level_end, level_end=order.size()){
+            ++n_levels;
+            last_level=level_begin;
+            for (std::size_t q=level_begin; q<level_end; ++q){
+                const std::size_t neighbours_begin=order.size();
+                const unsigned int node=order[q];
+                for (std::size_t p=ptr[node]; p<ptr[node]+degree[node]; ++p){
+                    if(!numbered[adj[p]] && stamp[adj[p]]!=search){
+                        stamp[adj[p]]=search;
+                        order.push_back(adj[p]);
+                    }
+                }
+                std::stable_sort(order.begin()+neighbours_begin, order.end(),
+                                 [&degree](unsigned int a, unsigned int b){ return degree[a]<degree[b]; });
+            }
+        }
+        return n_levels;
+    };
+
+    std::vector<unsigned int> perm, component;
+    perm.reserve(n);
+    for (std::size_t start=0; start<n; ++start){
+        if(numbered[start])
+            continue;
+        //pseudo-peripheral node (George and Liu): move the root to a node of minimum degree in the
+        //last level until the number of levels stops growing
+        std::size_t last_level=0;
+        component.clear();
+        unsigned int root=start, n_levels=bfs(root, component, last_level);
+        while(true){
+            unsigned int candidate=component[last_level];
+            for (std::size_t q=last_level; q<component.size(); ++q)
+                if(degree[component[q]]<degree[candidate])
+                    candidate=component[q];
+            component.clear();
+            const unsigned int candidate_levels=bfs(candidate, component, last_level);
+            if(candidate_levels<=n_levels)
+                break;
+            root=candidate;
+            n_levels=candidate_levels;
+        }
+        //Cuthill-McKee numbering of the component
+        const std::size_t first=perm.size();
+        bfs(root, perm, last_level);
+        for (std::size_t q=first; q<perm.size(); ++q)
+            numbered[perm[q]]=true;
+    }
+    std::reverse(perm.begin(), perm.end());
+    return perm;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::permute(std::span<const T> x, std::span<T> x_new) const
+{
+    if(m_permutation.empty()){
+        std::copy(x.begin(), x.end(), x_new.begin());
+        return;
+    }
+    #pragma omp parallel for num_threads(m_threads)
+    for (std::size_t k=0; k<m_permutation.size(); ++k)
+        x_new[k]=x[m_permutation[k]];
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::unpermute(std::span<const T> y_new, std::span<T> y) const
+{
+    if(m_permutation.empty()){
+        std::copy(y_new.begin(), y_new.end(), y.begin());
+        return;
+    }
+    #pragma omp parallel for num_threads(m_threads)
+    for (std::size_t k=0; k<m_permutation.size(); ++k)
+        y[m_permutation[k]]=y_new[k];
+}
+
+//Compress the matrix in SELL-C-sigma format
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::compress_sell(unsigned int chunk, unsigned int sigma)
+{
+    if(frozen_warning("compress_sell"))
+        return;
+    if(m_symmetry!=Symmetry::General){
+        std::cerr<<"WARNING! The SELL-C-sigma format needs the general storage: no changes"<<std::endl;
+        return;
+    }
+    //switch from another compressed format passing through the COOmap format
+    if(is_compressed())
+        uncompress();
+    if(chunk>simd::max_sell_chunk)
+        std::cerr<<"WARNING! A slice has at most "<<simd::max_sell_chunk<<" rows: the chunk is reduced to "<<simd::max_sell_chunk<<std::endl;
+    chunk=std::clamp(chunk, 1u, simd::max_sell_chunk);
+    //the window is a multiple of the chunk, so that a slice never takes rows of two windows
+    sigma=std::max(1u, (sigma+chunk-1)/chunk)*chunk;
+
+    //number of rows: the size of the matrix, or the last row present in the map
+    std::size_t n_rows=m_size[0];
+    for (const auto& [key, value] : m_data)
+        n_rows=std::max<std::size_t>(n_rows, key[0]+1);
+    //number of non-zero elements of each row
+    std::vector<unsigned int> row_len(n_rows, 0);
+    std::size_t n_cols=0;
+    for (const auto& [key, value] : m_data){
+        ++row_len[key[0]];
+        n_cols=std::max<std::size_t>(n_cols, key[1]+1);
+    }
+
+    //sort the rows by decreasing length inside each window of sigma rows
+    m_sell_perm.resize(n_rows);
+    std::iota(m_sell_perm.begin(), m_sell_perm.end(), 0u);
+    for (std::size_t w=0; w<n_rows; w+=sigma){
+        std::stable_sort(m_sell_perm.begin()+w, m_sell_perm.begin()+std::min<std::size_t>(w+sigma, n_rows),
+                         [&row_len](unsigned int a, unsigned int b){ return row_len[a]>row_len[b]; });
+    }
+    m_sell_row_pos.resize(n_rows);
+    m_sell_row_len.resize(n_rows);
+    for (std::size_t p=0; p<n_rows; ++p){
+        m_sell_row_pos[m_sell_perm[p]]=p;
+        m_sell_row_len[p]=row_len[m_sell_perm[p]];
+    }
+
+    //each slice is as wide as its longest row
+    const std::size_t n_slices=(n_rows+chunk-1)/chunk;
+    std::size_t n_stored=0; //elements with the padding
+    m_sell_slice_ptr.assign(n_slices+1, 0);
+    for (std::size_t s=0; s<n_slices; ++s){
+        unsigned int width=0;
+        for (std::size_t p=s*chunk; p<std::min<std::size_t>((s+1)*chunk, n_rows); ++p)
+            width=std::max(width, m_sell_row_len[p]);
+        n_stored+=std::size_t(width)*chunk;
+        m_sell_slice_ptr[s+1]=static_cast<Offset>(n_stored);
+    }
+    if(!fits_index_types(n_cols, n_stored)){
+        m_sell_slice_ptr.clear();
+        m_sell_perm.clear();
+        m_sell_row_pos.clear();
+        m_sell_row_len.clear();
+        return;
+    }
+
+    //fill the slices: the k-th element of the sorted position p goes in slice_ptr[s]+k*chunk+r
+    m_val.assign(m_sell_slice_ptr.back(), get_zero());
+    m_outer_index.assign(m_sell_slice_ptr.back(), 0);
+    std::vector<unsigned int> filled(n_rows, 0);
+    for (const auto& [key, value] : m_data){
+        const std::size_t p=m_sell_row_pos[key[0]];
+        const std::size_t idx=m_sell_slice_ptr[p/chunk]+filled[p]*chunk+p%chunk;
+        m_val[idx]=value;
+        m_outer_index[idx]=key[1];
+        ++filled[p];
+    }
+    //the padding repeats the last column of the row, so that the product reads valid (and cached) entries
+    for (std::size_t p=0; p<n_rows; ++p){
+        const std::size_t s=p/chunk, r=p%chunk;
+        const unsigned int width=(m_sell_slice_ptr[s+1]-m_sell_slice_ptr[s])/chunk;
+        for (unsigned int k=m_sell_row_len[p]; k<width && k>0; ++k)
+            m_outer_index[m_sell_slice_ptr[s]+k*chunk+r]=m_outer_index[m_sell_slice_ptr[s]+(k-1)*chunk+r];
+    }
+
+    m_data.clear(); // clear the map after the compress to avoid waste of memory
+    m_inner_index.clear();
+    m_sell_chunk=chunk;
+    m_format=StorageFormat::SELL; //update the state of the matrix
+    cache_product_data();
+}
+
+//Compress the matrix in BSR format
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <unsigned int B>
+void
+Matrix<T, Order, Map, Index, Offset>::compress_bsr()
+{
+    static_assert(B>0, "The size of the blocks must be positive");
+    if(frozen_warning("compress_bsr"))
+        return;
+    if(m_symmetry!=Symmetry::General){
+        std::cerr<<"WARNING! The BSR format needs the general storage: no changes"<<std::endl;
+        return;
+    }
+    //switch from another compressed format passing through the COOmap format
+    if(is_compressed())
+        uncompress();
+
+    //the size of the matrix must cover all the elements of the map
+    for (const auto& [key, value] : m_data){
+        m_size[0]=std::max<std::size_t>(m_size[0], key[0]+1);
+        m_size[1]=std::max<std::size_t>(m_size[1], key[1]+1);
+    }
+    const std::size_t n_block_rows=(m_size[0]+B-1)/B;
+
+    //pattern of the blocks: the (block row, block column) pairs that contain at least one element
+    std::vector<std::array<unsigned int, 2>> blocks;
+    blocks.reserve(m_data.size());
+    for (const auto& [key, value] : m_data)
+        blocks.push_back({static_cast<unsigned int>(key[0]/B), static_cast<unsigned int>(key[1]/B)});
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    if(!fits_index_types((m_size[1]+B-1)/B, blocks.size()))
+        return;
+
+    //block row pointers and block column indices
+    m_inner_index.assign(n_block_rows+1, 0);
+    m_outer_index.resize(blocks.size());
+    for (std::size_t k=0; k<blocks.size(); ++k){
+        ++m_inner_index[blocks[k][0]+1];
+        m_outer_index[k]=blocks[k][1];
+    }
+    std::partial_sum(m_inner_index.begin(), m_inner_index.end(), m_inner_index.begin());
+
+    //copy each element in its block
+    m_val.assign(blocks.size()*B*B, get_zero());
+    for (const auto& [key, value] : m_data){
+        const std::size_t br=key[0]/B;
+        auto it=std::lower_bound(m_outer_index.begin()+m_inner_index[br],
+                                 m_outer_index.begin()+m_inner_index[br+1], key[1]/B);
+        const std::size_t k=it-m_outer_index.begin();
+        m_val[k*B*B+(key[0]%B)*B+key[1]%B]=value;
+    }
+
+    m_data.clear(); // clear the map after the compress to avoid waste of memory
+    m_block_size=B;
+    m_bsr_kernel=&simd::bsr_spmv<T, B, Index, Offset>;
+    m_format=StorageFormat::BSR; //update the state of the matrix
+    cache_product_data();
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::clear_storage()
+{
+    m_data.clear();
+    m_val.clear();
+    m_outer_index.clear();
+    m_inner_index.clear();
+    m_sell_slice_ptr.clear();
+    m_sell_perm.clear();
+    m_sell_row_pos.clear();
+    m_sell_row_len.clear();
+    m_hash_ptr.clear();
+    m_hash_slots.clear();
+    m_permutation.clear();
+    m_delta.clear();
+}
+
+//Build the compressed state from lists of entries
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class Combine>
+void
+Matrix<T, Order, Map, Index, Offset>::set_from_triplets(const std::vector<unsigned int> &rows, const std::vector<unsigned int> &cols,
+                                    const std::vector<T> &values, Combine combine)
+{
+    if(frozen_warning("set_from_triplets"))
+        return;
+    const std::size_t n=std::min({rows.size(), cols.size(), values.size()});
+    if(rows.size()!=n || cols.size()!=n || values.size()!=n)
+        std::cerr<<"WARNING! The lists of entries have different lengths, the extra entries are ignored"<<std::endl;
+
+    //the size of the matrix must cover all the indices
+    std::size_t max_row=0, max_col=0;
+    #pragma omp parallel for num_threads(m_threads) reduction(max:max_row, max_col)
+    for(std::size_t k=0; k<n; ++k){
+        max_row=std::max<std::size_t>(max_row, rows[k]+1);
+        max_col=std::max<std::size_t>(max_col, cols[k]+1);
+    }
+    //the entries are counted before the duplicates are combined: all of them must fit the pointers
+    if(!fits_index_types(Order==StorageOrder::RowWise ? max_col : max_row, n))
+        return;
+    m_size[0]=std::max(m_size[0], max_row);
+    m_size[1]=std::max(m_size[1], max_col);
+
+    //one contiguous chunk of the lists for each thread: the major index is the row (column)
+    //for row-major (column-major) ordering
+    const unsigned int n_chunks=std::max(1u, m_threads);
+    const unsigned int* major= Order==StorageOrder::RowWise ? rows.data() : cols.data();
+    const unsigned int* minor= Order==StorageOrder::RowWise ? cols.data() : rows.data();
+    std::vector<TripletChunk> chunks;
+    for(unsigned int c=0; c<n_chunks; ++c){
+        const std::size_t first=n*c/n_chunks, last=n*(c+1)/n_chunks;
+        chunks.push_back({major+first, minor+first, values.data()+first, last-first});
+    }
+
+    //the previous content of the matrix is replaced
+    clear_storage();
+    assemble_compressed(chunks, Order==StorageOrder::RowWise ? m_size[0] : m_size[1], combine);
+    m_format=StorageFormat::Compressed;
+    build_row_hash();
+    cache_product_data();
+}
+
+//Fill the compressed vectors from lists of entries
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class Combine>
+void
+Matrix<T, Order, Map, Index, Offset>::assemble_compressed(const std::vector<TripletChunk> &chunks, std::size_t n_major, Combine combine)
+{
+    const std::size_t n_chunks=chunks.size();
+    const unsigned int n_threads=std::max(1u, m_threads);
+
+    //with a symmetric storage only the lower triangle is stored (minor <= major in CSR,
+    //minor >= major in CSC): an entry of the other triangle is stored as its mirror,
+    //conjugated if hermitian, as the reader of a Matrix Market file does
+    const Symmetry symmetry=m_symmetry;
+    auto mirrored=[symmetry](const TripletChunk& chunk, std::size_t e){
+        if(symmetry==Symmetry::General)
+            return false;
+        return Order==StorageOrder::RowWise ? chunk.minor[e]>chunk.major[e] : chunk.minor[e]<chunk.major[e];
+    };
+    auto major_of=[&mirrored](const TripletChunk& chunk, std::size_t e)->std::size_t{
+        return mirrored(chunk, e) ? chunk.minor[e] : chunk.major[e];
+    };
+
+    //interval of the rows/columns touched by each chunk: lists built element by element (or
+    //row by row) give short intervals, so the counters of all the chunks are about n_major
+    std::vector<std::size_t> lo(n_chunks, n_major), hi(n_chunks, 0);
+    #pragma omp parallel for num_threads(n_threads)
+    for (std::size_t c=0; c<n_chunks; ++c)
+        for (std::size_t e=0; e<chunks[c].size; ++e){
+            lo[c]=std::min(lo[c], major_of(chunks[c], e));
+            hi[c]=std::max(hi[c], major_of(chunks[c], e)+1);
+        }
+    //count the entries of each row/column in each chunk: the counter of the row r of the chunk c
+    //is offsets[start[c]+r-lo[c]]
+    std::vector<std::size_t> start(n_chunks+1, 0);
+    for (std::size_t c=0; c<n_chunks; ++c)
+        start[c+1]=start[c]+(lo[c]<hi[c] ? hi[c]-lo[c] : 0);
+    std::vector<Offset> offsets(start[n_chunks], 0);
+    #pragma omp parallel for num_threads(n_threads)
+    for (std::size_t c=0; c<n_chunks; ++c)
+        for (std::size_t e=0; e<chunks[c].size; ++e)
+            ++offsets[start[c]+major_of(chunks[c], e)-lo[c]];
+
+    //position of each chunk inside the row/column, and number of entries of the row/column
+    m_inner_index.assign(n_major+1, 0);
+    #pragma omp parallel for num_threads(n_threads)
+    for (std::size_t r=0; r<n_major; ++r){
+        Offset running=0;
+        for (std::size_t c=0; c<n_chunks; ++c){
+            if (r<lo[c] || r>=hi[c])
+                continue;
+            const Offset count=offsets[start[c]+r-lo[c]];
+            offsets[start[c]+r-lo[c]]=running;
+            running+=count;
+        }
+        m_inner_index[r+1]=running;
+    }
+    std::partial_sum(m_inner_index.begin(), m_inner_index.end(), m_inner_index.begin());
+
+    //scatter the entries: each chunk writes in its own positions, in its own order
+    const std::size_t nnz=m_inner_index.back();
+    m_val.resize(nnz);
+    m_outer_index.resize(nnz);
+    #pragma omp parallel for num_threads(n_threads)
+    for (std::size_t c=0; c<n_chunks; ++c){
+        for (std::size_t e=0; e<chunks[c].size; ++e){
+            const bool mirror=mirrored(chunks[c], e);
+            const std::size_t r=major_of(chunks[c], e);
+            const std::size_t pos=m_inner_index[r]+offsets[start[c]+r-lo[c]]++;
+            m_outer_index[pos]= mirror ? chunks[c].major[e] : chunks[c].minor[e];
+            m_val[pos]= mirror && symmetry==Symmetry::Hermitian ? conj_if_complex(chunks[c].val[e]) : chunks[c].val[e];
+        }
+    }
+    offsets.clear();
+    offsets.shrink_to_fit();
+
+    //sort each row/column (stable, so duplicates stay in order) and combine the duplicates
+    std::vector<unsigned int> count(n_major);
+    #pragma omp parallel num_threads(n_threads)
+    {
+        std::vector<std::pair<Index, T>> entries;
+        #pragma omp for schedule(dynamic, 256)
+        for (std::size_t r=0; r<n_major; ++r){
+            const std::size_t first=m_inner_index[r], last=m_inner_index[r+1];
+            //nothing to do if the indices are already strictly increasing
+            if (std::adjacent_find(m_outer_index.begin()+first, m_outer_index.begin()+last,
+                                   std::greater_equal<Index>())==m_outer_index.begin()+last){
+                count[r]=last-first;
+                continue;
+            }
+            entries.clear();
+            for (std::size_t k=first; k<last; ++k)
+                entries.emplace_back(m_outer_index[k], m_val[k]);
+            std::stable_sort(entries.begin(), entries.end(),
+                             [](const auto& a, const auto& b){ return a.first<b.first; });
+            std::size_t k=first;
+            for (const auto& [index, value] : entries){
+                if (k>first && m_outer_index[k-1]==index){
+                    m_val[k-1]=combine(m_val[k-1], value);
+                }else{
+                    m_outer_index[k]=index;
+                    m_val[k]=value;
+                    ++k;
+                }
+            }
+            count[r]=k-first;
         }
-        //if the row/column is the same of the previous element the counter is incremented
-        temp_idx++;
     }
-inner_index.emplace_back(temp_idx);
-   
-m_data.clear(); // clear the map after the compress to avoid waste of memory 
-m_state=true;   //update the state of the matrix
 
-//update the private variables of the class
-m_val=val;
-m_inner_index=inner_index;
-m_outer_index=outer_index;
+    //remove the holes left by the duplicates
+    if (std::accumulate(count.begin(), count.end(), std::size_t(0))!=nnz){
+        std::size_t pos=0;
+        for (std::size_t r=0; r<n_major; ++r){
+            const std::size_t first=m_inner_index[r];
+            m_inner_index[r]=pos;
+            for (std::size_t k=first; k<first+count[r]; ++k, ++pos){
+                m_outer_index[pos]=m_outer_index[k];
+                m_val[pos]=m_val[k];
+            }
+        }
+        m_inner_index[n_major]=pos;
+        m_outer_index.resize(pos);
+        m_val.resize(pos);
+    }
 }
 
 
-template<class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 T
-Matrix<T, Order>::at(unsigned int i, unsigned int j) {
+Matrix<T, Order, Map, Index, Offset>::at(unsigned int i, unsigned int j) {
     Indices key={i,j};  
     //check the state of the matrix
-    if (!m_state){
+    if (!is_compressed()){
+        if(m_symmetry!=Symmetry::General && i<j){
+            //only the lower triangle is read: the element is the mirror of (j,i)
+            const T value=at(j, i);
+            return m_symmetry==Symmetry::Hermitian ? conj_if_complex(value) : value;
+        }
         //if the matrix is in the uncompressed state
         //I can use the find method of the map to search the element with key
         auto it=m_data.find(key);
@@ -203,12 +1330,12 @@ Matrix<T, Order>::at(unsigned int i, unsigned int j) {
     }
 }
 
-template<class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 void
-Matrix<T,Order>::erase(unsigned int i, unsigned int j){
+Matrix<T, Order, Map, Index, Offset>::erase(unsigned int i, unsigned int j){
     Indices key={i,j};  
     //check the state of the matrix
-    if(!m_state){
+    if(!is_compressed()){
         //if the matrix is in the uncompressed state
         //I can use the erase method of the map to delete the element with key
         m_data.erase(key);
@@ -220,8 +1347,10 @@ Matrix<T,Order>::erase(unsigned int i, unsigned int j){
         }
 }
 
-template<class T, StorageOrder Order>
-bool Matrix<T, Order>::read_market_matrix(const std::string& filename){
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool Matrix<T, Order, Map, Index, Offset>::read_market_matrix(const std::string& filename){
+    if(frozen_warning("read_market_matrix"))
+        return false;
     std::ifstream file(filename);//open the file
     if(!file.is_open()){
         //if the file is not open print a warning message
@@ -235,6 +1364,16 @@ bool Matrix<T, Order>::read_market_matrix(const std::string& filename){
         std::cerr<<"The file is not in Matrix Market format"<<std::endl;
         return false;
     }
+    //symmetric and hermitian files list only the lower triangle
+    const bool symmetric=line.find("symmetric")!=std::string::npos || line.find("hermitian")!=std::string::npos;
+    const bool hermitian=line.find("hermitian")!=std::string::npos;
+    const bool complex=line.find("complex")!=std::string::npos;
+    if(line.find("skew-symmetric")!=std::string::npos){
+        std::cerr<<"WARNING! Skew-symmetric files are not supported"<<std::endl;
+        return false;
+    }
+    //the symmetry of the storage is the one of the file
+    set_symmetry(!symmetric ? Symmetry::General : hermitian ? Symmetry::Hermitian : Symmetry::Symmetric);
     //read the size of the matrix
     while(std::getline(file, line) and line[0]=='%');
     std::istringstream iss(line);
@@ -244,37 +1383,372 @@ bool Matrix<T, Order>::read_market_matrix(const std::string& filename){
     //and fill the map with the elements
     unsigned int row, col;
     T value;
-    while(file>>row>>col>>value){
+    while(file>>row>>col){
+        //the real and the imaginary parts of a complex value are two numbers
+        if constexpr(is_complex<T>::value){
+            typename T::value_type re{0}, im{0};
+            file>>re;
+            if(complex)
+                file>>im;
+            value=T(re, im);
+        }else
+            file>>value;
+        if(!file)
+            break;
         Indices key{row-1, col-1};
-        m_data.insert({{key, value}});
+        if(symmetric && row<col){
+            //an element above the diagonal is mirrored in the lower triangle
+            key={col-1, row-1};
+            if(hermitian)
+                value=conj_if_complex(value);
+        }
+        m_data.insert({key, value});
 
     }
     file.close();//close the file
     return true;
 }
-template<class T, StorageOrder Order>
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool Matrix<T, Order, Map, Index, Offset>::read_market_matrix_compressed(const std::string& filename){
+    if(frozen_warning("read_market_matrix_compressed"))
+        return false;
+    MappedFile file(filename);//map the file in memory
+    if(!file.is_open()){
+        //if the file is not open print a warning message
+        std::cerr << "WARNING! Error while opening the file in Matrix Market format!"<<std::endl;
+        return false;
+    }
+    const char* begin=file.data();
+    const char* end=begin+file.size();
+    const market::Header header=market::parse_header(begin, end);
+    if(!header.valid){
+        //if the file is not in Matrix Market format print a warning message
+        std::cerr<<"The file is not in Matrix Market format"<<std::endl;
+        return false;
+    }
+    if(header.complex && !is_complex<T>::value){
+        std::cerr<<"WARNING! A complex matrix cannot be read in a matrix of real numbers"<<std::endl;
+        return false;
+    }
+    if(header.skew){
+        std::cerr<<"WARNING! Skew-symmetric files are not supported"<<std::endl;
+        return false;
+    }
+
+    //split the entries in chunks of whole lines, one for each thread
+    const unsigned int n_chunks=std::max(1u, m_threads);
+    const std::size_t body_size=end-header.body;
+    std::vector<const char*> cuts(n_chunks+1, end);
+    for(unsigned int c=0; c<n_chunks; ++c)
+        cuts[c]=market::align_to_line(header.body+body_size*c/n_chunks, header.body, end);
+
+    //each thread parses its chunk in its own vectors, preallocated from the number of non-zeros of the header
+    struct Buffer{
+        std::vector<unsigned int> major, minor;
+        std::vector<T>            val;
+        bool                      ok{true};
+    };
+    std::vector<Buffer> buffers(n_chunks);
+    #pragma omp parallel for num_threads(n_chunks) schedule(static,1)
+    for(unsigned int c=0; c<n_chunks; ++c){
+        Buffer& buffer=buffers[c];
+        const std::size_t expected=body_size ? header.nnz*(cuts[c+1]-cuts[c])/body_size+16 : 0;
+        buffer.major.reserve(expected);
+        buffer.minor.reserve(expected);
+        buffer.val.reserve(expected);
+        const char* p=cuts[c];
+        while(p<cuts[c+1]){
+            p=market::skip_blanks(p, end);
+            //skip empty lines and comments
+            if(p==end || *p=='\n' || *p=='\r' || *p=='%'){
+                p=market::next_line(p, end);
+                continue;
+            }
+            std::size_t row, col;
+            T value;
+            if(!market::parse_index(p, end, row) || !market::parse_index(p, end, col) ||
+               !market::parse_value(p, end, header, value) ||
+               row==0 || col==0 || row>header.rows || col>header.cols){
+                buffer.ok=false;
+                break;
+            }
+            //a symmetric file should list the lower triangle: an element above the diagonal is mirrored
+            if(header.symmetric && row<col){
+                std::swap(row, col);
+                if(header.hermitian)
+                    value=conj_if_complex(value);
+            }
+            //the indices of the file start from 1
+            if constexpr(Order==StorageOrder::RowWise){
+                buffer.major.push_back(row-1);
+                buffer.minor.push_back(col-1);
+            }else if constexpr(Order==StorageOrder::ColWise){
+                buffer.major.push_back(col-1);
+                buffer.minor.push_back(row-1);
+            }
+            buffer.val.push_back(value);
+            p=market::next_line(p, end);
+        }
+    }
+
+    std::vector<TripletChunk> chunks;
+    std::size_t n_entries=0;
+    for(const auto& buffer : buffers){
+        if(!buffer.ok){
+            std::cerr<<"ERROR while parsing the entries of the file in Matrix Market format"<<std::endl;
+            return false;
+        }
+        chunks.push_back({buffer.major.data(), buffer.minor.data(), buffer.val.data(), buffer.val.size()});
+        n_entries+=buffer.val.size();
+    }
+    if(n_entries!=header.nnz)
+        std::cerr<<"WARNING! The file contains "<<n_entries<<" entries, the header declares "<<header.nnz<<std::endl;
+    if(!fits_index_types(Order==StorageOrder::RowWise ? header.cols : header.rows, n_entries))
+        return false;
+
+    //the previous content of the matrix is replaced
+    clear_storage();
+    m_size={header.rows, header.cols};
+    //the symmetry of the storage is the one of the file (a real hermitian matrix is symmetric)
+    m_symmetry= !header.symmetric ? Symmetry::General
+               : header.hermitian && is_complex<T>::value ? Symmetry::Hermitian : Symmetry::Symmetric;
+    const std::size_t n_major= Order==StorageOrder::RowWise ? header.rows : header.cols;
+    //duplicated entries keep the first value
+    assemble_compressed(chunks, n_major, [](const T& first, const T&){ return first; });
+    m_format=StorageFormat::Compressed;
+    build_row_hash();
+    cache_product_data();
+    return true;
+}
+// header of the binary snapshot of a compressed matrix. The arrays follow, aligned to 64 bytes
+struct SnapshotHeader{
+    char          magic[8];     // "ALGSNAP"
+    std::uint32_t version;      // version of the format
+    std::uint32_t byte_order;   // 0x01020304 as written by the machine that saved the file
+    std::uint32_t order;        // 0 row-major (CSR), 1 column-major (CSC)
+    std::uint32_t value_code;   // type of the values (see snapshot_value_code)
+    std::uint32_t value_size;   // sizeof of the values
+    std::uint32_t index_size;   // sizeof of the column (CSR) or row (CSC) indices
+    std::uint32_t offset_size;  // sizeof of the row (CSR) or column (CSC) pointers
+    std::uint32_t symmetry;     // 0 general, 1 symmetric, 2 hermitian (lower triangle)
+    std::uint32_t reserved;     // keeps the 64-bit fields aligned
+    std::uint64_t rows;
+    std::uint64_t cols;
+    std::uint64_t nnz;          // size of m_val and m_outer_index
+    std::uint64_t n_ptr;        // size of m_inner_index
+    std::uint64_t val_offset;   // position of the arrays in the file (bytes)
+    std::uint64_t outer_offset;
+    std::uint64_t inner_offset;
+    std::uint64_t n_perm;       // size of the renumbering of rows and columns (0 if not renumbered)
+    std::uint64_t perm_offset;  // position of the renumbering (unsigned int) in the file
+};
+inline constexpr char          snapshot_magic[8]{'A','L','G','S','N','A','P','\0'};
+inline constexpr std::uint32_t snapshot_version=4;
+inline constexpr std::uint64_t snapshot_alignment=64;
+
+// code of the type of the values stored in a snapshot (0 for any other type)
+template<class T>
+constexpr std::uint32_t
+snapshot_value_code(){
+    if constexpr(std::is_same_v<T, float>)                          return 1;
+    else if constexpr(std::is_same_v<T, double>)                    return 2;
+    else if constexpr(std::is_same_v<T, long double>)               return 3;
+    else if constexpr(std::is_same_v<T, std::complex<float>>)       return 4;
+    else if constexpr(std::is_same_v<T, std::complex<double>>)      return 5;
+    else if constexpr(std::is_same_v<T, std::complex<long double>>) return 6;
+    else if constexpr(std::is_same_v<T, int>)                       return 7;
+    else                                                            return 0;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool Matrix<T, Order, Map, Index, Offset>::save_snapshot(const std::string& filename) const{
+    static_assert(std::is_trivially_copyable_v<T>, "The values must be trivially copyable to be saved in binary format");
+    if(m_format!=StorageFormat::Compressed){
+        std::cerr<<"WARNING! Only a matrix in CSR/CSC format can be saved. Compress it before."<<std::endl;
+        return false;
+    }
+    if(!m_delta.empty()){
+        //the snapshot stores the arrays: the pending insertions are merged in a copy
+        Matrix merged(*this);
+        return merged.merge_delta() && merged.save_snapshot(filename);
+    }
+    std::ofstream file(filename, std::ios::binary);
+    if(!file.is_open()){
+        std::cerr << "WARNING! Error while opening the file "<<filename<<std::endl;
+        return false;
+    }
+    auto align=[](std::uint64_t pos){ return (pos+snapshot_alignment-1)/snapshot_alignment*snapshot_alignment; };
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version=snapshot_version;
+    header.byte_order=0x01020304;
+    header.order= Order==StorageOrder::RowWise ? 0 : 1;
+    header.value_code=snapshot_value_code<T>();
+    header.value_size=sizeof(T);
+    header.index_size=sizeof(Index);
+    header.offset_size=sizeof(Offset);
+    header.symmetry=static_cast<std::uint32_t>(m_symmetry);
+    //the rows (columns) are those of the pointers, the columns (rows) cover every index
+    const std::size_t n_major=m_inner_index.size()-1;
+    header.rows= Order==StorageOrder::RowWise ? n_major : minor_size();
+    header.cols= Order==StorageOrder::RowWise ? minor_size() : n_major;
+    if(m_symmetry!=Symmetry::General)
+        header.rows=header.cols=std::max(header.rows, header.cols);
+    header.nnz=m_val.size();
+    header.n_ptr=m_inner_index.size();
+    header.n_perm=m_permutation.size();
+    header.val_offset=align(sizeof(SnapshotHeader));
+    header.outer_offset=align(header.val_offset+header.nnz*sizeof(T));
+    header.inner_offset=align(header.outer_offset+header.nnz*sizeof(Index));
+    header.perm_offset=align(header.inner_offset+header.n_ptr*sizeof(Offset));
+
+    //write a block of bytes at the given position, padding with zeros
+    auto write_at=[&file](std::uint64_t pos, const void* data, std::size_t bytes){
+        static const char zeros[snapshot_alignment]{};
+        const std::uint64_t current=file.tellp();
+        file.write(zeros, pos-current);
+        file.write(static_cast<const char*>(data), bytes);
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_at(header.val_offset, m_val.data(), header.nnz*sizeof(T));
+    write_at(header.outer_offset, m_outer_index.data(), header.nnz*sizeof(Index));
+    write_at(header.inner_offset, m_inner_index.data(), header.n_ptr*sizeof(Offset));
+    write_at(header.perm_offset, m_permutation.data(), header.n_perm*sizeof(unsigned int));
+    return file.good();
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool Matrix<T, Order, Map, Index, Offset>::load_snapshot(const std::string& filename){
+    static_assert(std::is_trivially_copyable_v<T>, "The values must be trivially copyable to be loaded from binary format");
+    if(frozen_warning("load_snapshot"))
+        return false;
+    //the mapping is shared by the three vectors and released with the last of them
+    auto file=std::make_shared<MappedFile>(filename, false);
+    if(!file->is_open()){
+        std::cerr << "WARNING! Error while opening the file "<<filename<<std::endl;
+        return false;
+    }
+    SnapshotHeader header;
+    if(file->size()<sizeof(header)){
+        std::cerr<<"The file is not a snapshot of a matrix"<<std::endl;
+        return false;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if(std::memcmp(header.magic, snapshot_magic, sizeof(header.magic))!=0 || header.version!=snapshot_version){
+        std::cerr<<"The file is not a snapshot of a matrix, or its version is not supported"<<std::endl;
+        return false;
+    }
+    if(header.byte_order!=0x01020304 || header.order!=(Order==StorageOrder::RowWise ? 0u : 1u) ||
+       header.value_code!=snapshot_value_code<T>() || header.value_size!=sizeof(T) ||
+       header.index_size!=sizeof(Index) || header.offset_size!=sizeof(Offset)){
+        std::cerr<<"WARNING! The snapshot has a different storage order, type of values, index types or byte order"<<std::endl;
+        return false;
+    }
+    //each array must lie inside the file (without overflows in the sizes) and be aligned to its type
+    auto inside=[size=file->size()](std::uint64_t offset, std::uint64_t count, std::size_t bytes, std::size_t alignment){
+        return offset<=size && count<=(size-offset)/bytes && offset%alignment==0;
+    };
+    const std::uint64_t n_major= Order==StorageOrder::RowWise ? header.rows : header.cols;
+    const std::uint64_t n_minor= Order==StorageOrder::RowWise ? header.cols : header.rows;
+    if(!inside(header.val_offset, header.nnz, sizeof(T), alignof(T)) ||
+       !inside(header.outer_offset, header.nnz, sizeof(Index), alignof(Index)) ||
+       !inside(header.inner_offset, header.n_ptr, sizeof(Offset), alignof(Offset)) ||
+       !inside(header.perm_offset, header.n_perm, sizeof(unsigned int), alignof(unsigned int)) ||
+       n_major==std::numeric_limits<std::uint64_t>::max() || header.n_ptr!=n_major+1 || header.symmetry>2 ||
+       (header.symmetry!=0 && header.rows!=header.cols) ||
+       (header.n_perm!=0 && (header.n_perm!=header.rows || header.rows!=header.cols))){
+        std::cerr<<"WARNING! The snapshot is truncated or corrupted"<<std::endl;
+        return false;
+    }
+    //the pointers and the indices are checked before they are used: the matrix is not changed
+    //if they are not valid (one pass over the arrays)
+    const auto* inner=reinterpret_cast<const Offset*>(file->data()+header.inner_offset);
+    const auto* outer=reinterpret_cast<const Index*>(file->data()+header.outer_offset);
+    const auto* perm=reinterpret_cast<const unsigned int*>(file->data()+header.perm_offset);
+    bool valid=valid_arrays({outer, header.nnz}, {inner, header.n_ptr}, n_minor, static_cast<Symmetry>(header.symmetry));
+    std::vector<bool> seen(header.n_perm, false);
+    for(std::uint64_t k=0; valid && k<header.n_perm; ++k){
+        valid= perm[k]<header.n_perm && !seen[perm[k]];
+        if(valid)
+            seen[perm[k]]=true;
+    }
+    if(!valid){
+        std::cerr<<"WARNING! The snapshot is corrupted: the pointers, the indices or the renumbering are not valid"<<std::endl;
+        return false;
+    }
+
+    //the previous content of the matrix is replaced
+    clear_storage();
+    m_size={header.rows, header.cols};
+    m_symmetry=static_cast<Symmetry>(header.symmetry);
+    m_val.view(file, reinterpret_cast<T*>(file->data()+header.val_offset), header.nnz);
+    m_outer_index.view(file, reinterpret_cast<Index*>(file->data()+header.outer_offset), header.nnz);
+    m_inner_index.view(file, reinterpret_cast<Offset*>(file->data()+header.inner_offset), header.n_ptr);
+    m_permutation.assign(perm, perm+header.n_perm);
+    m_nnz=header.nnz;
+    m_m=n_major;
+    m_format=StorageFormat::Compressed;
+    build_row_hash();
+    cache_product_data();
+    return true;
+}
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+T
+Matrix<T, Order, Map, Index, Offset>::element_value(unsigned int i, unsigned int j){
+    if(is_compressed())
+        return read_compressed_matrix({i, j});
+    if(m_symmetry!=Symmetry::General && i<j){
+        //only the lower triangle is stored: the element is the mirror of (j,i)
+        const T value=element_value(j, i);
+        return m_symmetry==Symmetry::Hermitian ? conj_if_complex(value) : value;
+    }
+    auto it=m_data.find({i, j});
+    return it!=m_data.end() ? it->second : get_zero();
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
 T&
-Matrix<T, Order>::operator()(const unsigned int k, const unsigned int z){
+Matrix<T, Order, Map, Index, Offset>::element_reference(unsigned int k, unsigned int z){
      Indices key={k,z};  
     //check the state of the matrix
-            if(!m_state){
+            if(!is_compressed()){
                 //if the matrix is in the uncompressed state
                 //I add the element in the map representing the
                 //matrix in the uncompressed state
                 return m_data[key];
-            }else{
-                //if the matrix is in the compressed state
-                //I can use the read_compressed_matrix method to search the element with key
-                return read_compressed_matrix(key);
             }
+            //if the matrix is in the compressed state
+            //I can use the read_compressed_matrix method to search the element with key
+            T& value=read_compressed_matrix(key);
+            if(&value!=&m_dummy_value || m_format!=StorageFormat::Compressed)
+                return value;
+            //a new element in CSR/CSC format goes in the buffer of the insertions
+            if(frozen_warning("the insertion of an element"))
+                return value;
+            const bool inside= key[0]<m_rows && key[1]<m_cols;
+            T& inserted=m_delta[key];
+            if(inside && m_delta.size()<=m_delta_threshold)
+                return inserted;
+            //the buffer is full, or the element changes the size of the matrix
+            if(!merge_delta()){
+                m_delta.erase(key);
+                return value;
+            }
+            return read_compressed_matrix(key);
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+T
+Matrix<T, Order, Map, Index, Offset>::Reference::stored_value(const T& value) const{
+    return mirrored() && m_matrix.m_symmetry==Symmetry::Hermitian ? conj_if_complex(value) : value;
 }
 
 //Overloading streaming operator
-template <class T, StorageOrder Order>
-std::ostream& operator<<(std::ostream& out, const Matrix<T, Order>& A)
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::ostream& operator<<(std::ostream& out, const Matrix<T, Order, Map, Index, Offset>& A)
 {
     //check the state of the matrix
-    if(!A.m_state){
+    if(!A.is_compressed()){
         //if the matrix is in the uncompressed state
         //I can print the elements of the map
         std::cout << "Printing a non compressed matrix" << std::endl;
@@ -282,19 +1756,42 @@ std::ostream& operator<<(std::ostream& out, const Matrix<T, Order>& A)
             out << "[" << pair.first[0] << ", " << pair.first[1] << "]: " << pair.second << "\n";
         }
     }
+    else if(A.m_format==StorageFormat::SELL){
+        //if the matrix is in SELL-C-sigma format
+        //I print the rows in their original order skipping the padding
+        std::cout << "Printing a SELL-C-sigma matrix" << std::endl;
+        for (std::size_t i = 0; i < A.m_sell_row_pos.size(); ++i){
+            const std::size_t p = A.m_sell_row_pos[i];
+            const std::size_t s = p / A.m_sell_chunk, r = p % A.m_sell_chunk;
+            for (unsigned int k = 0; k < A.m_sell_row_len[p]; ++k){
+                const std::size_t idx = A.m_sell_slice_ptr[s] + k * A.m_sell_chunk + r;
+                out << "[" << i << ", " << A.m_outer_index[idx] << "] = " << A.m_val[idx] << "\n";
+            }
+        }
+    }
+    else if(A.m_format==StorageFormat::BSR){
+        //if the matrix is in BSR format I print all the elements of the stored blocks
+        std::cout << "Printing a BSR matrix with blocks " << A.m_block_size << "x" << A.m_block_size << std::endl;
+        const std::size_t B = A.m_block_size;
+        for (std::size_t br = 0; br < A.m_inner_index.size()-1; ++br)
+            for (std::size_t k = A.m_inner_index[br]; k < A.m_inner_index[br + 1]; ++k)
+                for (std::size_t r = 0; r < B; ++r)
+                    for (std::size_t c = 0; c < B; ++c)
+                        out << "[" << br*B+r << ", " << A.m_outer_index[k]*B+c << "] = " << A.m_val[k*B*B+r*B+c] << "\n";
+    }
     else{
         //if the matrix is in the compressed state
         //I can print the elements of the vectors
         if constexpr(Order==StorageOrder::RowWise){
             std::cout << "Printing a CSR matrix" << std::endl;
             for (unsigned int i = 0; i < A.m_inner_index.size()-1; ++i)
-                for (unsigned int k = A.m_inner_index[i]; k < A.m_inner_index[i + 1]; ++k)
+                for (std::size_t k = A.m_inner_index[i]; k < A.m_inner_index[i + 1]; ++k)
                     out << "[" << i << ", " << A.m_outer_index[k] << "] = " << A.m_val[k] << "\n";
         }
         else if constexpr(Order==StorageOrder::ColWise){
             std::cout << "Printing a CSC matrix" << std::endl;
             for (unsigned int i = 0; i < A.m_inner_index.size()-1; ++i)
-                for (unsigned int k = A.m_inner_index[i]; k < A.m_inner_index[i + 1]; ++k)
+                for (std::size_t k = A.m_inner_index[i]; k < A.m_inner_index[i + 1]; ++k)
                     out << "[" << A.m_outer_index[k] << ", " << i << "] = " << A.m_val[k] << "\n";
         }
     }
@@ -302,61 +1799,731 @@ std::ostream& operator<<(std::ostream& out, const Matrix<T, Order>& A)
 }
 
 //Overload operator* for Matrix-vector multiplication
-template<class T, StorageOrder Order>
-std::vector<T> operator*(const Matrix<T, Order> &A, const std::vector<T> &b){
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::vector<T> operator*(const Matrix<T, Order, Map, Index, Offset> &A, const std::vector<T> &b){
+    if(!A.is_compressed() && A.m_size[0]==0){
+        //if the matrix is in the uncompressed state and the number of rows is 0
+        //I print an error message
+        std::cerr<<"ERROR: Resize is compulsory if the matrix is uncompressed"<<std::endl;
+        return {};
+    }
+    //the product is written directly in the output vector, with the size of the number of rows
+    std::vector<T> output(A.rows());
+    A.multiply(b, output);
+    return output;
+}
 
-    std::vector<T> output;
-    //check the state of the matrix
-    if(A.m_state){
-        //if the matrix is in the compressed state
-        //I apply the matrix-vector multiplication using the compressed representation
-        //differentiating the implementation for row-wise and column-wise storage.
+template <class T, class V, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+requires (!std::is_same_v<T, V>)
+std::vector<V> operator*(const Matrix<T, Order, Map, Index, Offset> &A, const std::vector<V> &b){
+    if(!A.is_compressed() && A.m_size[0]==0){
+        std::cerr<<"ERROR: Resize is compulsory if the matrix is uncompressed"<<std::endl;
+        return {};
+    }
+    std::vector<V> output(A.rows());
+    A.multiply(std::span<const V>(b), std::span<V>(output));
+    return output;
+}
 
-        //If the storage is row-wise I loop over the rows of the matrix
-        if constexpr(Order==StorageOrder::RowWise){
-            T temp;
-            output.reserve(A.m_inner_index.size()-1);//reserve the space for the output vector
-            for(unsigned int i = 0; i < A.m_inner_index.size()-1; ++i){
-                temp = 0.0;
-                //loop over the elements of the row
-                for(unsigned int j = A.m_inner_index[i]; j<A.m_inner_index[i+1]; ++j){
-                    //multiply the element of the matrix by the corresponding element of the vector
-                    temp += A.m_val[j] * b[A.m_outer_index[j]];
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::cache_product_data()
+{
+    const std::size_t n_major=m_inner_index.empty() ? 0 : m_inner_index.size()-1;
+    if(m_format==StorageFormat::SELL){
+        m_rows=m_sell_perm.size();
+        m_cols=std::max<std::size_t>(m_size[1], m_outer_index.empty() ? 0 :
+                                     *std::max_element(m_outer_index.begin(), m_outer_index.end())+1);
+    }else if(m_format==StorageFormat::BSR){
+        m_rows=m_size[0];
+        m_cols=m_size[1];
+    }else if(m_symmetry!=Symmetry::General){
+        //the matrix is square
+        m_rows=m_cols=std::max({n_major, minor_size(), m_size[0], m_size[1]});
+    }else if constexpr(Order==StorageOrder::RowWise){
+        m_rows=n_major;
+        m_cols=minor_size();
+    }else{
+        m_rows=minor_size();
+        m_cols=n_major;
+    }
+    //the rows (CSR), the columns (CSC), the block rows (BSR) or the slices (SELL) are split
+    //in blocks with the same number of non-zero elements, one for each thread
+    m_product_threads=std::max<std::size_t>(1, std::min<std::size_t>(m_threads, m_val.size()));
+    m_simd_level=simd::gather_level(std::max(m_rows, m_cols), m_val.size());
+    if(m_format==StorageFormat::SELL)
+        m_bounds=nnz_balanced_partition(m_sell_slice_ptr, m_product_threads);
+    else if(n_major>0)
+        m_bounds=nnz_balanced_partition(m_inner_index, m_product_threads);
+    else
+        m_bounds.assign(m_product_threads+1, 0);
+
+    m_sym_lo.clear();
+    m_sym_hi.clear();
+    m_sym_offset.clear();
+    if(m_format!=StorageFormat::Compressed || m_symmetry==Symmetry::General)
+        return;
+    //interval of the rows (columns) scattered by each thread outside its own block
+    const unsigned int n_threads=m_product_threads;
+    m_sym_lo.assign(n_threads, 0);
+    m_sym_hi.assign(n_threads, 0);
+    m_sym_offset.assign(n_threads+1, 0);
+    for(unsigned int t = 0; t < n_threads; ++t){
+        const std::size_t own_begin=m_bounds[t], own_end= t+1==n_threads ? m_rows : m_bounds[t+1];
+        std::size_t lo=m_rows, hi=0;
+        for(std::size_t j = m_inner_index[m_bounds[t]]; j < m_inner_index[m_bounds[t+1]]; ++j){
+            const std::size_t k=m_outer_index[j];
+            if(k<own_begin || k>=own_end){
+                lo=std::min(lo, k);
+                hi=std::max(hi, k+1);
+            }
+        }
+        if(lo<hi){
+            m_sym_lo[t]=lo;
+            m_sym_hi[t]=hi;
+        }
+        m_sym_offset[t+1]=m_sym_offset[t]+(m_sym_hi[t]-m_sym_lo[t]);
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class U>
+U*
+Matrix<T, Order, Map, Index, Offset>::workspace(std::size_t n)
+{
+    thread_local std::vector<U> work;
+    if(work.size()<n)
+        work.resize(n);
+    return work.data();
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool
+Matrix<T, Order, Map, Index, Offset>::valid_product_sizes(std::size_t x_size, std::size_t y_size, bool transpose) const
+{
+    if(m_format==StorageFormat::COOmap && m_size[0]==0){
+        std::cerr<<"ERROR: Resize is compulsory if the matrix is uncompressed"<<std::endl;
+        return false;
+    }
+    const std::size_t n_rows=product_rows(), n_cols= m_format==StorageFormat::COOmap && m_symmetry!=Symmetry::General ? n_rows : cols();
+    const std::size_t n_x= transpose ? n_rows : n_cols, n_y= transpose ? n_cols : n_rows;
+    if(x_size<n_x || y_size<n_y){
+        std::cerr<<"ERROR: the product needs vectors of "<<n_x<<" and "<<n_y<<" elements, not "
+                 <<x_size<<" and "<<y_size<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::multiply(std::span<const T> x, std::span<T> y, T alpha, T beta) const
+{
+    if(!valid_product_sizes(x.size(), y.size(), false))
+        return;
+    const unsigned int n_threads=m_product_threads;
+    if(m_format==StorageFormat::SELL){
+        //each thread takes a block of slices
+        const auto kernel=simd::sell_kernel<T, Index, Offset>(m_sell_chunk, m_simd_level);
+        #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+        for(unsigned int t = 0; t < n_threads; ++t){
+            kernel(m_val.data(), m_outer_index.data(), m_sell_slice_ptr.data(), m_sell_chunk,
+                   m_bounds[t], m_bounds[t+1], m_sell_perm.data(), m_rows, x.data(), y.data(), alpha, beta);
+        }
+    }else if(m_format==StorageFormat::BSR){
+        //each thread takes a block of block rows. The last block row/column can exceed the size
+        //of the matrix: in that case x is padded and the last block row is computed in the
+        //scratch buffer
+        const std::size_t B=m_block_size;
+        const std::size_t n_block_rows=m_inner_index.size()-1;
+        const std::size_t n_block_cols=(m_cols+B-1)/B;
+        const std::size_t n_full=m_rows/B; //block rows entirely inside the matrix
+        const bool pad_x= x.size()<n_block_cols*B, pad_y= n_full<n_block_rows;
+        T* work= pad_x || pad_y ? workspace((pad_x ? n_block_cols*B : 0)+(pad_y ? B : 0)) : nullptr;
+        const T* xp=x.data();
+        if(pad_x){
+            std::copy(x.begin(), x.end(), work);
+            std::fill(work+x.size(), work+n_block_cols*B, T(0));
+            xp=work;
+        }
+        #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+        for(unsigned int t = 0; t < n_threads; ++t){
+            m_bsr_kernel(m_val.data(), m_outer_index.data(), m_inner_index.data(),
+                         m_bounds[t], std::min(m_bounds[t+1], n_full), xp, y.data(), alpha, beta);
+        }
+        if(pad_y){
+            //last block row: only its first rows are inside the matrix
+            T* acc=work+(pad_x ? n_block_cols*B : 0);
+            const std::size_t n_tail=m_rows-n_full*B;
+            std::fill(acc, acc+n_tail, T(0));
+            for(std::size_t k = m_inner_index[n_full]; k < m_inner_index[n_full+1]; ++k){
+                const T* block=m_val.data()+std::size_t(k)*B*B;
+                const T* xb=xp+std::size_t(m_outer_index[k])*B;
+                for(std::size_t r = 0; r < n_tail; ++r)
+                    for(std::size_t c = 0; c < B; ++c)
+                        acc[r]+=block[r*B+c]*xb[c];
+            }
+            for(std::size_t r = 0; r < n_tail; ++r)
+                simd::store(y[n_full*B+r], acc[r], alpha, beta);
+        }
+    }else if(m_format==StorageFormat::Compressed){
+        //If the storage is row-wise I loop over the rows of the matrix (gather),
+        //if it is column-wise over the columns (scatter)
+        if(m_symmetry!=Symmetry::General)
+            symmetric_product(x.data(), y.data(), alpha, beta, false);
+        else if constexpr(Order==StorageOrder::RowWise)
+            gather_product(x.data(), y.data(), alpha, beta);
+        else
+            scatter_product(x.data(), y.data(), m_rows, alpha, beta);
+        //the elements inserted after the compression
+        if(!m_delta.empty())
+            add_map_product(m_delta, x.data(), y.data(), alpha, false);
+    }else{
+        //loop over the elements of the matrix and multiply the element of the matrix by the corresponding element of the vector
+        map_product(x.data(), y.data(), alpha, beta, false);
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class U>
+requires (!std::is_same_v<U, T>)
+void
+Matrix<T, Order, Map, Index, Offset>::multiply(std::span<const U> x, std::span<U> y, U alpha, U beta) const
+{
+    if(!valid_product_sizes(x.size(), y.size(), false))
+        return;
+    const unsigned int n_threads=m_product_threads;
+    if(m_format==StorageFormat::SELL){
+        //the kernels read the values of type T and accumulate in U
+        const auto kernel=simd::sell_kernel<U, Index, Offset, T>(m_sell_chunk, m_simd_level);
+        #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+        for(unsigned int t = 0; t < n_threads; ++t){
+            kernel(m_val.data(), m_outer_index.data(), m_sell_slice_ptr.data(), m_sell_chunk,
+                   m_bounds[t], m_bounds[t+1], m_sell_perm.data(), m_rows, x.data(), y.data(), alpha, beta);
+        }
+    }else if(m_format==StorageFormat::BSR){
+        throw std::logic_error("The mixed-precision product is not available in BSR format");
+    }else if(m_format==StorageFormat::Compressed){
+        if(m_symmetry!=Symmetry::General){
+            symmetric_product(x.data(), y.data(), alpha, beta, false);
+        }else if constexpr(Order==StorageOrder::RowWise){
+            const auto kernel=simd::csr_kernel<U, Index, Offset, T>(m_simd_level);
+            #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+            for(unsigned int t = 0; t < n_threads; ++t){
+                kernel(m_val.data(), m_outer_index.data(), m_inner_index.data(),
+                       m_bounds[t], m_bounds[t+1], x.data(), y.data(), alpha, beta);
+            }
+        }else{
+            scatter_product(x.data(), y.data(), m_rows, alpha, beta);
+        }
+        if(!m_delta.empty())
+            add_map_product(m_delta, x.data(), y.data(), alpha, false);
+    }else{
+        map_product(x.data(), y.data(), alpha, beta, false);
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::gather_product(const T* x, T* y, T alpha, T beta) const
+{
+    //each row is written by exactly one thread.
+    //vectorized kernel for double and std::complex<double> (if the CPU supports it),
+    //scalar loop otherwise
+    const unsigned int n_threads=m_product_threads;
+    const auto kernel=simd::csr_kernel<T, Index, Offset>(m_simd_level);
+    #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+    for(unsigned int t = 0; t < n_threads; ++t){
+        kernel(m_val.data(), m_outer_index.data(), m_inner_index.data(),
+               m_bounds[t], m_bounds[t+1], x, y, alpha, beta);
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class U>
+void
+Matrix<T, Order, Map, Index, Offset>::scatter_product(const U* x, U* y, std::size_t n_out, U alpha, U beta) const
+{
+    const unsigned int n_threads=m_product_threads;
+    if(n_threads==1){
+        //serial product: the rows (columns) are scattered directly in y
+        for(std::size_t r = 0; r < n_out; ++r)
+            y[r]= beta==U(0) ? U(0) : beta*y[r];
+        for(std::size_t i = 0; i < m_inner_index.size()-1; ++i){
+            const U xi= alpha==U(1) ? x[i] : alpha*x[i];
+            for(std::size_t j = m_inner_index[i]; j<m_inner_index[i+1]; ++j)
+                y[m_outer_index[j]]+= U(m_val[j]) * xi;
+        }
+        return;
+    }
+    //every thread scatters its rows (columns) in its own part of the scratch buffer, with the
+    //size of the output, so that two threads never write the same entry
+    U* work=workspace<U>(n_threads*n_out);
+    #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+    for(unsigned int t = 0; t < n_threads; ++t){
+        U* temp=work+t*n_out;
+        std::fill(temp, temp+n_out, U(0));
+        for(std::size_t i = m_bounds[t]; i < m_bounds[t+1]; ++i){
+            for(std::size_t j = m_inner_index[i]; j<m_inner_index[i+1]; ++j){
+                temp[m_outer_index[j]]+= U(m_val[j]) * x[i];
+            }
+        }
+    }
+    //reduction of the partial results
+    #pragma omp parallel for num_threads(n_threads)
+    for(std::size_t r = 0; r < n_out; ++r){
+        U sum=work[r];
+        for(unsigned int t = 1; t < n_threads; ++t)
+            sum+=work[t*n_out+r];
+        simd::store(y[r], sum, alpha, beta);
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class U>
+void
+Matrix<T, Order, Map, Index, Offset>::symmetric_product(const U* x, U* y, U alpha, U beta, bool transpose) const
+{
+    //the stored element v of the row (column) m and index k is the element (m,k) of A in CSR and
+    //(k,m) in CSC. With a hermitian storage the mirrored element is its conjugate, so that the
+    //gather in y[m] or the scatter in y[k] uses conj(v), depending on the order and on the transpose
+    const bool hermitian= m_symmetry==Symmetry::Hermitian;
+    const bool conj_gather= hermitian && ((Order==StorageOrder::ColWise)!=transpose);
+    const bool conj_scatter= hermitian && !conj_gather;
+    auto value=[](const T& v, bool conj){ return conj ? U(conj_if_complex(v)) : U(v); };
+    auto init=[y, beta](std::size_t begin, std::size_t end){
+        for(std::size_t r = begin; r < end; ++r)
+            y[r]= beta==U(0) ? U(0) : beta*y[r];
+    };
+    //product of the rows (columns) begin<=m<end: the scatter outside [own_begin, own_end)
+    //goes in buf, that starts at the row lo
+    auto rows=[&](std::size_t begin, std::size_t end, std::size_t own_begin, std::size_t own_end,
+                  U* buf, std::size_t lo){
+        for(std::size_t m = begin; m < end; ++m){
+            const U xm= alpha==U(1) ? x[m] : alpha*x[m];
+            U sum{0};
+            for(std::size_t j = m_inner_index[m]; j < m_inner_index[m+1]; ++j){
+                const std::size_t k=m_outer_index[j];
+                if(k==m){
+                    sum+=U(m_val[j])*x[k];
+                    continue;
+                }
+                sum+=value(m_val[j], conj_gather)*x[k];
+                const U contribution=value(m_val[j], conj_scatter)*xm;
+                if(k>=own_begin && k<own_end)
+                    y[k]+=contribution;
+                else
+                    buf[k-lo]+=contribution;
+            }
+            y[m]+= alpha==U(1) ? sum : alpha*sum;
+        }
+    };
+    const std::size_t n_major=m_inner_index.size()-1;
+    const unsigned int n_threads=m_product_threads;
+    if(n_threads==1){
+        //serial product: the scatter goes directly in y
+        init(0, m_rows);
+        rows(0, n_major, 0, m_rows, nullptr, 0);
+        return;
+    }
+    //each thread owns the rows (columns) of its block of y: it initializes them, gathers its
+    //rows and scatters in them directly, the other rows go in its part of the scratch buffer
+    U* work=workspace<U>(m_sym_offset[n_threads]);
+    std::fill(work, work+m_sym_offset[n_threads], U(0));
+    #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+    for(unsigned int t = 0; t < n_threads; ++t){
+        const std::size_t own_end= t+1==n_threads ? m_rows : m_bounds[t+1];
+        init(m_bounds[t], own_end);
+        rows(m_bounds[t], m_bounds[t+1], m_bounds[t], own_end, work+m_sym_offset[t], m_sym_lo[t]);
+    }
+    //reduction of the scattered parts
+    #pragma omp parallel for num_threads(n_threads)
+    for(std::size_t r = 0; r < m_rows; ++r){
+        for(unsigned int t = 0; t < n_threads; ++t)
+            if(r>=m_sym_lo[t] && r<m_sym_hi[t])
+                y[r]+=work[m_sym_offset[t]+r-m_sym_lo[t]];
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class U>
+void
+Matrix<T, Order, Map, Index, Offset>::map_product(const U* x, U* y, U alpha, U beta, bool transpose) const
+{
+    //a symmetric matrix is square
+    const std::size_t n_out= m_symmetry!=Symmetry::General ? std::max(m_size[0], m_size[1]) :
+                             transpose ? m_size[1] : m_size[0];
+    for(std::size_t r = 0; r < n_out; ++r)
+        y[r]= beta==U(0) ? U(0) : beta*y[r];
+    add_map_product(m_data, x, y, alpha, transpose);
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+template <class U>
+void
+Matrix<T, Order, Map, Index, Offset>::add_map_product(const Map<T, Order>& data, const U* x, U* y, U alpha, bool transpose) const
+{
+    for (const auto& [key, value] : data){
+        const std::size_t i= transpose ? key[1] : key[0], j= transpose ? key[0] : key[1];
+        if(m_symmetry==Symmetry::General){
+            y[i]+= alpha==U(1) ? U(value)*x[j] : alpha*U(value)*x[j];
+            continue;
+        }
+        //only the lower triangle is read, the mirrored element is added too
+        if(key[0]<key[1])
+            continue;
+        const U v(value);
+        y[i]+=alpha*v*x[j];
+        if(i!=j){
+            const U w= m_symmetry==Symmetry::Hermitian ? U(conj_if_complex(value)) : v;
+            y[j]+=alpha*w*x[i];
+        }
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+void
+Matrix<T, Order, Map, Index, Offset>::multiply_transpose(std::span<const T> x, std::span<T> y, T alpha, T beta) const
+{
+    if(!valid_product_sizes(x.size(), y.size(), true))
+        return;
+    if(m_format==StorageFormat::Compressed){
+        //the CSR arrays of A are the CSC arrays of A^T and vice versa: the transpose product
+        //scatters the rows of a CSR matrix and gathers the columns of a CSC matrix
+        if(m_symmetry!=Symmetry::General)
+            symmetric_product(x.data(), y.data(), alpha, beta, true);
+        else if constexpr(Order==StorageOrder::RowWise)
+            scatter_product(x.data(), y.data(), m_cols, alpha, beta);
+        else
+            gather_product(x.data(), y.data(), alpha, beta);
+        if(!m_delta.empty())
+            add_map_product(m_delta, x.data(), y.data(), alpha, true);
+    }else if(m_format==StorageFormat::COOmap){
+        map_product(x.data(), y.data(), alpha, beta, true);
+    }else{
+        std::cerr<<"WARNING! The transpose product needs the CSR/CSC format or the uncompressed state. No changes."<<std::endl;
+    }
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+T
+Matrix<T, Order, Map, Index, Offset>::dot(const T* x, const T* y, std::size_t n) const
+{
+    //each thread sums a contiguous block, the partial sums are added in order
+    const unsigned int n_threads=std::max<std::size_t>(1, std::min<std::size_t>(m_threads, n/fused_tile+1));
+    T* work=workspace(n_threads);
+    #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+    for(unsigned int t = 0; t < n_threads; ++t){
+        T sum{0};
+        for(std::size_t i = n*t/n_threads; i < n*(t+1)/n_threads; ++i)
+            sum+=conj_if_complex(x[i])*y[i];
+        work[t]=sum;
+    }
+    return std::accumulate(work, work+n_threads, T(0));
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+FusedDot<T>
+Matrix<T, Order, Map, Index, Offset>::multiply_dot(std::span<const T> x, std::span<T> y, bool with_norm) const
+{
+    FusedDot<T> result;
+    if(!valid_product_sizes(x.size(), y.size(), false))
+        return result;
+    //x^H y needs x as long as y: the operator is square
+    const std::size_t n=product_rows();
+    if(x.size()<n){
+        std::cerr<<"ERROR: the dot product x^H y needs x of "<<n<<" elements, not "<<x.size()<<std::endl;
+        return result;
+    }
+    if constexpr(Order==StorageOrder::RowWise){
+        if(m_format==StorageFormat::Compressed && m_symmetry==Symmetry::General && m_delta.empty()){
+            //each thread computes its rows in tiles: the kernel writes the tile of y, then the
+            //dot products read it back from the cache
+            const unsigned int n_threads=m_product_threads;
+            const auto kernel=simd::csr_kernel<T, Index, Offset>(m_simd_level);
+            T* work=workspace(2*n_threads);
+            #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+            for(unsigned int t = 0; t < n_threads; ++t){
+                T xy{0}, yy{0};
+                for(std::size_t begin = m_bounds[t]; begin < m_bounds[t+1]; begin+=fused_tile){
+                    const std::size_t end=std::min(begin+fused_tile, m_bounds[t+1]);
+                    kernel(m_val.data(), m_outer_index.data(), m_inner_index.data(),
+                           begin, end, x.data(), y.data(), T(1), T(0));
+                    for(std::size_t i = begin; i < end; ++i){
+                        xy+=conj_if_complex(x[i])*y[i];
+                        if(with_norm)
+                            yy+=conj_if_complex(y[i])*y[i];
+                    }
                 }
-                output.emplace_back(temp);//add the result to the output vector
+                work[2*t]=xy;
+                work[2*t+1]=yy;
             }
-        }else if constexpr(Order==StorageOrder::ColWise){
-            
-            auto max=std::max_element(A.m_outer_index.begin(), A.m_outer_index.end());
-            std::vector<T> temp(static_cast<int>(*max)+1,0);//initialize a temporary vector with the size of the number of rows
-            for(unsigned int i = 0; i < A.m_inner_index.size()-1; ++i){
-                for(unsigned int j = A.m_inner_index[i]; j<A.m_inner_index[i+1]; ++j){
-                    temp[A.m_outer_index[j]]+= A.m_val[j] * b[i];
+            for(unsigned int t = 0; t < n_threads; ++t){
+                result.x_dot_y+=work[2*t];
+                result.y_norm2+=work[2*t+1];
+            }
+            return result;
+        }
+    }
+    //CSC: y is complete only after all the columns have been scattered, so the dot products
+    //need a second pass (as for SELL, BSR, the uncompressed state, one stored triangle and
+    //the insertions pending in the buffer)
+    multiply(x, y);
+    result.x_dot_y=dot(x.data(), y.data(), n);
+    if(with_norm)
+        result.y_norm2=dot(y.data(), y.data(), n);
+    return result;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+T
+Matrix<T, Order, Map, Index, Offset>::residual(std::span<const T> b, std::span<const T> x, std::span<T> r) const
+{
+    if(!valid_product_sizes(x.size(), b.size(), false) || !valid_product_sizes(x.size(), r.size(), false))
+        return T(0);
+    if constexpr(Order==StorageOrder::RowWise){
+        if(m_format==StorageFormat::Compressed && m_symmetry==Symmetry::General && m_delta.empty()){
+            //each tile of b is copied in r, then the kernel computes r=b-A*x on the tile
+            //and the norm is accumulated while the tile is in cache
+            const unsigned int n_threads=m_product_threads;
+            const auto kernel=simd::csr_kernel<T, Index, Offset>(m_simd_level);
+            T* work=workspace(n_threads);
+            #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+            for(unsigned int t = 0; t < n_threads; ++t){
+                T rr{0};
+                for(std::size_t begin = m_bounds[t]; begin < m_bounds[t+1]; begin+=fused_tile){
+                    const std::size_t end=std::min(begin+fused_tile, m_bounds[t+1]);
+                    if(r.data()!=b.data())
+                        std::copy(b.begin()+begin, b.begin()+end, r.begin()+begin);
+                    kernel(m_val.data(), m_outer_index.data(), m_inner_index.data(),
+                           begin, end, x.data(), r.data(), T(-1), T(1));
+                    for(std::size_t i = begin; i < end; ++i)
+                        rr+=conj_if_complex(r[i])*r[i];
                 }
+                work[t]=rr;
             }
-            std::ranges::copy(temp.begin(), temp.end(), std::back_inserter(output));//copy the result in the output vector
+            return std::accumulate(work, work+n_threads, T(0));
+        }
+    }
+    //second pass in the other formats, on the rows only as the fused loop
+    const std::size_t n=product_rows();
+    if(r.data()!=b.data())
+        std::copy(b.begin(), b.begin()+n, r.begin());
+    multiply(x, r, T(-1), T(1));
+    return dot(r.data(), r.data(), n);
+}
 
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::vector<T>
+Matrix<T, Order, Map, Index, Offset>::multiply_block(const std::vector<T> &X, unsigned int k) const
+{
+    if(k==0)
+        return {};
+    //the result is allocated here, only X is checked
+    if(X.size()%k!=0){
+        std::cerr<<"ERROR: the block has "<<X.size()<<" elements, not a multiple of "<<k<<" vectors"<<std::endl;
+        return {};
+    }
+    if(!valid_product_sizes(X.size()/k, product_rows(), false))
+        return {};
+    if(m_format!=StorageFormat::Compressed || m_symmetry!=Symmetry::General || !m_delta.empty()){
+        //one matrix-vector product for each column of the block
+        const std::size_t n_cols=X.size()/k;
+        std::vector<T> x(n_cols), Y;
+        for(unsigned int c = 0; c < k; ++c){
+            for(std::size_t j = 0; j < n_cols; ++j)
+                x[j]=X[j*k+c];
+            const std::vector<T> y=(*this)*x;
+            if(Y.empty())
+                Y.assign(y.size()*k, T(0));
+            for(std::size_t i = 0; i < y.size(); ++i)
+                Y[i*k+c]=y[i];
         }
+        return Y;
+    }
+    const unsigned int n_threads=m_product_threads;
+    const auto& bounds=m_bounds;
+    const std::size_t n_major=m_inner_index.size()-1;
+    if constexpr(Order==StorageOrder::RowWise){
+        //each row of the result is written by exactly one thread
+        std::vector<T> Y(n_major*k);
+        const auto kernel=simd::spmm_kernel<T, Index, Offset>(k, false);
+        #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+        for(unsigned int t = 0; t < n_threads; ++t)
+            kernel(m_val.data(), m_outer_index.data(), m_inner_index.data(), bounds[t], bounds[t+1], X.data(), Y.data(), k);
+        return Y;
     }else{
-        if(A.m_size[0]==0){
-            //if the matrix is in the uncompressed state and the number of rows is 0
-            //I print an error message
-            std::cerr<<"ERROR: Resize is compulsory if the matrix is uncompressed"<<std::endl;
+        //every thread scatters its columns in a private block, then the blocks are summed
+        const std::size_t n_rows=m_rows;
+        const auto kernel=simd::spmm_kernel<T, Index, Offset>(k, true);
+        std::vector<std::vector<T>> partial(n_threads);
+        #pragma omp parallel for num_threads(n_threads) schedule(static,1)
+        for(unsigned int t = 0; t < n_threads; ++t){
+            partial[t].assign(n_rows*k, T(0));
+            kernel(m_val.data(), m_outer_index.data(), m_inner_index.data(), bounds[t], bounds[t+1], X.data(), partial[t].data(), k);
         }
-        std::vector<T> temp(A.m_size[0],0);//initialize a temporary vector with the size of the number of rows
-        //loop over the elements of the matrix and multiply the element of the matrix by the corresponding element of the vector
-        for (auto [key, value] : A.m_data){
-            temp[key[0]]+=value*b[key[1]];
+        std::vector<T> Y=std::move(partial[0]);
+        #pragma omp parallel for num_threads(n_threads)
+        for(std::size_t r = 0; r < n_rows*k; ++r){
+            for(unsigned int t = 1; t < n_threads; ++t)
+                Y[r]+=partial[t][r];
         }
-        std::ranges::copy(temp.begin(), temp.end(), std::back_inserter(output));//copy the result in the output vector
+        return Y;
     }
-  
+}
 
-    
-    output.shrink_to_fit();//shrink the output vector
-    
-    return output;
-    
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+std::size_t
+Matrix<T, Order, Map, Index, Offset>::minor_size() const
+{
+    std::size_t n=m_size[Order==StorageOrder::RowWise ? 1 : 0];
+    if(!m_outer_index.empty())
+        n=std::max<std::size_t>(n, *std::max_element(m_outer_index.begin(), m_outer_index.end())+1);
+    return n;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool
+Matrix<T, Order, Map, Index, Offset>::fits_index_types(std::size_t n_minor, std::size_t nnz)
+{
+    if((n_minor>0 && n_minor-1>std::numeric_limits<Index>::max()) || nnz>std::numeric_limits<Offset>::max()){
+        std::cerr<<"WARNING! The indices or the number of elements exceed the index types of the matrix: "
+                 <<"the matrix is not compressed"<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+bool
+Matrix<T, Order, Map, Index, Offset>::gustavson_product(const Offset* a_ptr, const Index* a_idx, const T* a_val, std::size_t a_major,
+                                         const Offset* b_ptr, const Index* b_idx, const T* b_val, std::size_t b_major,
+                                         std::size_t n_minor, unsigned int n_threads,
+                                         std::vector<Offset> &c_ptr, std::vector<Index> &c_idx, std::vector<T> &c_val)
+{
+    //the counts are summed in std::size_t: the elements of C can exceed the Offset type
+    std::vector<std::size_t> row_nnz(a_major+1, 0);
+    //symbolic pass: count the distinct columns of each row of C. A column is marked with
+    //the index of the last row that touched it, so the marker is never reset
+    #pragma omp parallel num_threads(n_threads)
+    {
+        std::vector<std::size_t> marker(n_minor, a_major);
+        #pragma omp for schedule(dynamic, 64)
+        for(std::size_t i = 0; i < a_major; ++i){
+            std::size_t count{0};
+            for(std::size_t k = a_ptr[i]; k < a_ptr[i+1]; ++k){
+                const std::size_t row_b=a_idx[k];
+                if(row_b>=b_major)
+                    continue;
+                for(std::size_t l = b_ptr[row_b]; l < b_ptr[row_b+1]; ++l){
+                    if(marker[b_idx[l]]!=i){
+                        marker[b_idx[l]]=i;
+                        ++count;
+                    }
+                }
+            }
+            row_nnz[i+1]=count;
+        }
+    }
+    //the row pointers are the prefix sum of the counts: the output is allocated exactly
+    std::partial_sum(row_nnz.begin(), row_nnz.end(), row_nnz.begin());
+    if(!fits_index_types(0, row_nnz.back()))
+        return false;
+    c_ptr.assign(row_nnz.begin(), row_nnz.end());
+    c_idx.resize(c_ptr.back());
+    c_val.resize(c_ptr.back());
+
+    //numeric pass: each row is accumulated in a dense vector, then its columns are sorted
+    #pragma omp parallel num_threads(n_threads)
+    {
+        std::vector<T>           accumulator(n_minor, T(0));
+        std::vector<std::size_t> marker(n_minor, a_major);
+        #pragma omp for schedule(dynamic, 64)
+        for(std::size_t i = 0; i < a_major; ++i){
+            Index*      columns=c_idx.data()+c_ptr[i];
+            std::size_t count{0};
+            for(std::size_t k = a_ptr[i]; k < a_ptr[i+1]; ++k){
+                const std::size_t row_b=a_idx[k];
+                if(row_b>=b_major)
+                    continue;
+                const T a=a_val[k];
+                for(std::size_t l = b_ptr[row_b]; l < b_ptr[row_b+1]; ++l){
+                    const Index j=b_idx[l];
+                    if(marker[j]!=i){
+                        marker[j]=i;
+                        columns[count++]=j;
+                        accumulator[j]=a*b_val[l];
+                    }else{
+                        accumulator[j]+=a*b_val[l];
+                    }
+                }
+            }
+            std::sort(columns, columns+count);
+            for(std::size_t q = 0; q < count; ++q)
+                c_val[c_ptr[i]+q]=accumulator[columns[q]];
+        }
+    }
+    return true;
+}
+
+template<class T, StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+Matrix<T, Order, Map, Index, Offset> operator*(const Matrix<T, Order, Map, Index, Offset> &A, const Matrix<T, Order, Map, Index, Offset> &B){
+    Matrix<T, Order, Map, Index, Offset> C;
+    if(A.m_format!=StorageFormat::Compressed || B.m_format!=StorageFormat::Compressed){
+        std::cerr<<"ERROR: the matrix-matrix product needs two matrices in CSR/CSC format. Compress them before."<<std::endl;
+        return C;
+    }
+    if(A.m_symmetry!=Symmetry::General || B.m_symmetry!=Symmetry::General){
+        std::cerr<<"ERROR: the matrix-matrix product needs the general storage, with both triangles"<<std::endl;
+        return C;
+    }
+    if(!A.m_delta.empty() || !B.m_delta.empty()){
+        //the product reads the arrays: the pending insertions are merged in a copy
+        Matrix<T, Order, Map, Index, Offset> A_merged(A), B_merged(B);
+        A_merged.merge_delta();
+        B_merged.merge_delta();
+        return A_merged*B_merged;
+    }
+    const std::size_t n_rows= Order==StorageOrder::RowWise ? A.m_inner_index.size()-1 : A.minor_size();
+    const std::size_t n_cols= Order==StorageOrder::RowWise ? B.minor_size() : B.m_inner_index.size()-1;
+    const std::size_t inner_a= Order==StorageOrder::RowWise ? A.minor_size() : A.m_inner_index.size()-1;
+    const std::size_t inner_b= Order==StorageOrder::RowWise ? B.m_inner_index.size()-1 : B.minor_size();
+    if(inner_a!=inner_b){
+        std::cerr<<"ERROR: the matrix-matrix product needs the columns of the left matrix ("<<inner_a
+                 <<") equal to the rows of the right one ("<<inner_b<<")"<<std::endl;
+        return C;
+    }
+
+    std::vector<Offset>       ptr;
+    std::vector<Index>        idx;
+    std::vector<T>            val;
+    const unsigned int n_threads=std::max(1u, A.m_threads);
+    bool fits;
+    if constexpr(Order==StorageOrder::RowWise){
+        fits=Matrix<T, Order, Map, Index, Offset>::gustavson_product(
+            A.m_inner_index.data(), A.m_outer_index.data(), A.m_val.data(), A.m_inner_index.size()-1,
+            B.m_inner_index.data(), B.m_outer_index.data(), B.m_val.data(), B.m_inner_index.size()-1,
+            n_cols, n_threads, ptr, idx, val);
+    }else{
+        //the CSC arrays of a matrix are the CSR arrays of its transpose: C^T=B^T*A^T
+        fits=Matrix<T, Order, Map, Index, Offset>::gustavson_product(
+            B.m_inner_index.data(), B.m_outer_index.data(), B.m_val.data(), B.m_inner_index.size()-1,
+            A.m_inner_index.data(), A.m_outer_index.data(), A.m_val.data(), A.m_inner_index.size()-1,
+            n_rows, n_threads, ptr, idx, val);
+    }
+    if(!fits)
+        return C;
+    //the product is returned directly in compressed state
+    C.m_size={n_rows, n_cols};
+    C.m_nnz=val.size();
+    C.m_m=ptr.size()-1;
+    C.m_threads=A.m_threads;
+    C.m_val=std::move(val);
+    C.m_outer_index=std::move(idx);
+    C.m_inner_index=std::move(ptr);
+    C.m_format=StorageFormat::Compressed;
+    C.cache_product_data();
+    return C;
 }
 
 #endif // HH_MATRIX_IMPL_HH
\ No newline at end of file
@@ -0,0 +1,428 @@
+#ifndef HH_PRECONDITIONERS_HH
+#define HH_PRECONDITIONERS_HH
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <span>
+#include <utility>
+#include <vector>
+#include "Matrix.hpp"
+
+namespace algebra{
+
+    /**
+     * @brief preconditioner that does nothing: z = r
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class IdentityPreconditioner{
+        public:
+        void
+        apply(std::span<const T> r, std::span<T> z) const{
+            std::copy(r.begin(), r.end(), z.begin());
+        }
+    };
+
+    /**
+     * @brief Jacobi preconditioner z = D^{-1} r, with D the diagonal of a matrix in CSR or CSC
+     *  format. A missing or zero diagonal element is replaced by 1.
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class JacobiPreconditioner{
+        private:
+        std::vector<T> m_inv_diag;
+        unsigned int   m_threads;
+
+        public:
+        /**
+         * @brief extract the inverse of the diagonal of A
+         *
+         * @param A matrix in CSR/CSC format (otherwise the preconditioner is the identity); apply
+         *  runs on the threads of its product
+         */
+        template<StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+        explicit JacobiPreconditioner(const Matrix<T, Order, Map, Index, Offset> &A):
+        m_inv_diag(A.rows(), T(1)),
+        m_threads(A.num_threads())
+        {
+            if(A.format()!=StorageFormat::Compressed){
+                std::cerr<<"WARNING! The Jacobi preconditioner needs a matrix in CSR/CSC format: it will be the identity"<<std::endl;
+                return;
+            }
+            //the diagonal element of the row (column) i is found with a binary search
+            const auto idx=A.outer_indices();
+            const auto ptr=A.inner_indices();
+            const auto val=A.values();
+            const std::size_t n=std::min(m_inv_diag.size(), ptr.size()-1);
+            for(std::size_t i = 0; i < n; ++i){
+                auto first=idx.begin()+ptr[i], last=idx.begin()+ptr[i+1];
+                auto it=std::lower_bound(first, last, i);
+                if(it!=last && *it==i && val[it-idx.begin()]!=T(0))
+                    m_inv_diag[i]=T(1)/val[it-idx.begin()];
+            }
+        }
+
+        void
+        apply(std::span<const T> r, std::span<T> z) const{
+            #pragma omp parallel for num_threads(m_threads) schedule(static)
+            for(std::size_t i = 0; i < m_inv_diag.size(); ++i)
+                z[i]=m_inv_diag[i]*r[i];
+        }
+    };
+
+    /**
+     * @brief level scheduling of a sparse triangular solve on CSR arrays. Row i depends on the
+     *  rows given by the columns of its off-diagonal elements; the level of a row is one more than
+     *  the highest level of its dependencies, so all the rows of a level can be solved in parallel.
+     *  The levels depend only on the pattern and are computed once, when the factor is built.
+     *
+     */
+    class LevelSchedule{
+        private:
+        std::vector<unsigned int> m_level_ptr;  // rows of level l are m_rows[m_level_ptr[l]...m_level_ptr[l+1]]
+        std::vector<unsigned int> m_rows;
+        bool                      m_forward{true};
+
+        // minimum average number of rows per level to run the solve in parallel
+        static constexpr std::size_t parallel_rows_per_level=64;
+
+        public:
+        /**
+         * @brief compute the levels of a triangular factor
+         *
+         * @param first first off-diagonal element of each row
+         * @param last one past the last off-diagonal element of each row
+         * @param col column indices
+         * @param forward true for a lower triangular factor (rows solved in increasing order),
+         *  false for an upper triangular one
+         */
+        void
+        build(std::span<const unsigned int> first, std::span<const unsigned int> last,
+              std::span<const unsigned int> col, bool forward){
+            const std::size_t n=first.size();
+            m_forward=forward;
+            std::vector<unsigned int> level(n, 0);
+            unsigned int n_levels=0;
+            for(std::size_t k = 0; k < n; ++k){
+                const std::size_t i= forward ? k : n-1-k;
+                unsigned int l=0;
+                for(unsigned int p = first[i]; p < last[i]; ++p)
+                    l=std::max(l, level[col[p]]+1);
+                level[i]=l;
+                n_levels=std::max(n_levels, l+1);
+            }
+            //counting sort of the rows by level
+            m_level_ptr.assign(n_levels+1, 0);
+            for(auto l : level)
+                ++m_level_ptr[l+1];
+            for(unsigned int l = 0; l < n_levels; ++l)
+                m_level_ptr[l+1]+=m_level_ptr[l];
+            m_rows.resize(n);
+            std::vector<unsigned int> next(m_level_ptr.begin(), m_level_ptr.end()-1);
+            for(std::size_t i = 0; i < n; ++i)
+                m_rows[next[level[i]]++]=i;
+        }
+
+        //! number of levels, that is the number of sequential steps of the solve
+        inline std::size_t levels() const{ return m_level_ptr.empty() ? 0 : m_level_ptr.size()-1; }
+
+        /**
+         * @brief solve the triangular system: x_i = (b_i - sum_p val_p x_{col_p}) * inv_diag_i.
+         *  b and x can be the same vector.
+         *
+         * @param first first off-diagonal element of each row
+         * @param last one past the last off-diagonal element of each row
+         * @param col column indices
+         * @param val values
+         * @param inv_diag inverse of the diagonal, empty for a unit diagonal
+         * @param b right-hand side
+         * @param x solution
+         * @param n_threads number of threads of the levels
+         */
+        template<class T>
+        void
+        solve(std::span<const unsigned int> first, std::span<const unsigned int> last,
+              std::span<const unsigned int> col, std::span<const T> val, std::span<const T> inv_diag,
+              std::span<const T> b, std::span<T> x, unsigned int n_threads) const{
+            auto solve_row=[&](std::size_t i){
+                T sum=b[i];
+                for(unsigned int p = first[i]; p < last[i]; ++p)
+                    sum-=val[p]*x[col[p]];
+                x[i]= inv_diag.empty() ? sum : sum*inv_diag[i];
+            };
+            const std::size_t n=m_rows.size(), n_levels=levels();
+            if(n_threads<=1 || n<parallel_rows_per_level*n_levels){
+                //the natural order of the rows respects the dependencies and reads the factor contiguously
+                for(std::size_t k = 0; k < n; ++k)
+                    solve_row(m_forward ? k : n-1-k);
+                return;
+            }
+            #pragma omp parallel num_threads(n_threads)
+            for(std::size_t l = 0; l < n_levels; ++l){
+                //the implicit barrier at the end of the loop separates the levels
+                #pragma omp for schedule(static)
+                for(unsigned int k = m_level_ptr[l]; k < m_level_ptr[l+1]; ++k)
+                    solve_row(m_rows[k]);
+            }
+        }
+    };
+
+    /**
+     * @brief incomplete LU factorization with zero fill-in, ILU(0): L and U have the pattern of
+     *  the lower and upper part of A, stored in a copy of the CSR arrays (L has a unit diagonal
+     *  that is not stored). A missing or zero pivot is replaced by 1. It needs a matrix in CSR
+     *  format (row-major ordering). The triangular solves are level scheduled (see LevelSchedule).
+     *  The factors use unsigned int indices, whatever the index types of A.
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class ILU0Preconditioner{
+        private:
+        std::vector<T>            m_val;         // L (strictly lower part) and U, in place
+        std::vector<unsigned int> m_col;
+        std::vector<unsigned int> m_ptr;
+        std::vector<unsigned int> m_lower_end;   // first element of each row with column >= row
+        std::vector<unsigned int> m_upper_begin; // first element of each row with column > row
+        std::vector<T>            m_inv_pivot;   // inverse of the diagonal of U
+        LevelSchedule             m_lower_levels, m_upper_levels;
+        unsigned int              m_threads;
+
+        public:
+        /**
+         * @brief compute the factorization on a copy of the CSR arrays of A
+         *
+         * @param A matrix in CSR format with both triangles stored (otherwise the preconditioner is the identity);
+         *  the solves run on the threads of its product
+         */
+        template<StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+        explicit ILU0Preconditioner(const Matrix<T, Order, Map, Index, Offset> &A):
+        m_threads(A.num_threads())
+        {
+            if(Order!=StorageOrder::RowWise || A.format()!=StorageFormat::Compressed || A.symmetry()!=Symmetry::General){
+                std::cerr<<"WARNING! The ILU(0) preconditioner needs a matrix in CSR format with both triangles: it will be the identity"<<std::endl;
+                return;
+            }
+            m_val.assign(A.values().begin(), A.values().end());
+            m_col.assign(A.outer_indices().begin(), A.outer_indices().end());
+            m_ptr.assign(A.inner_indices().begin(), A.inner_indices().end());
+            factorize(std::max(A.rows(), A.cols()));
+        }
+
+        /**
+         * @brief solve L U z = r: forward substitution with L, then backward substitution with U.
+         *  Both are level scheduled.
+         *
+         * @param r right-hand side
+         * @param z solution
+         */
+        void
+        apply(std::span<const T> r, std::span<T> z) const{
+            if(m_ptr.empty()){
+                std::copy(r.begin(), r.end(), z.begin());
+                return;
+            }
+            const std::size_t n=m_ptr.size()-1;
+            const std::span<const unsigned int> row_begin(m_ptr.data(), n), row_end(m_ptr.data()+1, n);
+            m_lower_levels.solve<T>(row_begin, m_lower_end, m_col, m_val, {}, r, z, m_threads);
+            m_upper_levels.solve<T>(m_upper_begin, row_end, m_col, m_val, m_inv_pivot, z, z, m_threads);
+        }
+
+        //! number of sequential steps of the forward and backward substitutions
+        inline std::pair<std::size_t, std::size_t> levels() const{
+            return {m_lower_levels.levels(), m_upper_levels.levels()};
+        }
+
+        private:
+        // IKJ variant of the Gaussian elimination restricted to the pattern of A
+        void
+        factorize(std::size_t n_cols){
+            const std::size_t n=m_ptr.size()-1;
+            m_lower_end.resize(n);
+            m_upper_begin.resize(n);
+            m_inv_pivot.assign(n, T(1));
+            constexpr unsigned int none=~0u;
+            std::vector<unsigned int> position(std::max(n_cols, n), none);
+            for(std::size_t i = 0; i < n; ++i){
+                const unsigned int begin=m_ptr[i], end=m_ptr[i+1];
+                m_lower_end[i]=std::lower_bound(m_col.begin()+begin, m_col.begin()+end, i)-m_col.begin();
+                m_upper_begin[i]=std::upper_bound(m_col.begin()+begin, m_col.begin()+end, i)-m_col.begin();
+                for(unsigned int p = begin; p < end; ++p)
+                    position[m_col[p]]=p;
+                //eliminate the elements of the lower part with the rows above
+                for(unsigned int p = begin; p < end && m_col[p] < i; ++p){
+                    const unsigned int k=m_col[p];
+                    m_val[p]*=m_inv_pivot[k];
+                    const T l=m_val[p];
+                    for(unsigned int q = m_upper_begin[k]; q < m_ptr[k+1]; ++q){
+                        if(position[m_col[q]]!=none)
+                            m_val[position[m_col[q]]]-=l*m_val[q];
+                    }
+                }
+                //pivot: the diagonal element, if present
+                const unsigned int d=m_upper_begin[i];
+                if(d>begin && m_col[d-1]==i && m_val[d-1]!=T(0))
+                    m_inv_pivot[i]=T(1)/m_val[d-1];
+                for(unsigned int p = begin; p < end; ++p)
+                    position[m_col[p]]=none;
+            }
+            const std::span<const unsigned int> row_begin(m_ptr.data(), n), row_end(m_ptr.data()+1, n);
+            m_lower_levels.build(row_begin, m_lower_end, m_col, true);
+            m_upper_levels.build(m_upper_begin, row_end, m_col, false);
+        }
+    };
+
+    /**
+     * @brief incomplete Cholesky factorization with zero fill-in, IC(0): A ~ L L^H, with L that
+     *  has the pattern of the lower part of A (diagonal included). It needs a symmetric (hermitian)
+     *  matrix in CSR format; only its lower part is read. A missing diagonal element is added, and a
+     *  non-positive pivot is replaced by 1. L is stored in CSR format, and L^H too, so that both the
+     *  triangular solves read their factor by rows and are level scheduled (see LevelSchedule).
+     *  As for ILU(0), the factors use unsigned int indices.
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class IC0Preconditioner{
+        private:
+        std::vector<T>            m_val;      // L by rows, the diagonal is the last element of each row
+        std::vector<unsigned int> m_col;
+        std::vector<unsigned int> m_ptr;
+        std::vector<T>            m_t_val;    // L^H by rows, the diagonal is the first element of each row
+        std::vector<unsigned int> m_t_col;
+        std::vector<unsigned int> m_t_ptr;
+        std::vector<T>            m_inv_diag; // inverse of the diagonal of L
+        // the off-diagonal elements of a row of L end before the diagonal, those of L^H begin after it
+        std::vector<unsigned int> m_lower_end, m_upper_begin;
+        LevelSchedule             m_lower_levels, m_upper_levels;
+        unsigned int              m_threads;
+
+        public:
+        /**
+         * @brief compute the factorization on a copy of the lower part of the CSR arrays of A
+         *
+         * @param A symmetric (hermitian) positive definite matrix in CSR format, with both triangles or only the lower one (otherwise the
+         *  preconditioner is the identity); the solves run on the threads of its product
+         */
+        template<StorageOrder Order, template<class, StorageOrder> class Map, class Index, class Offset>
+        explicit IC0Preconditioner(const Matrix<T, Order, Map, Index, Offset> &A):
+        m_threads(A.num_threads())
+        {
+            if(Order!=StorageOrder::RowWise || A.format()!=StorageFormat::Compressed){
+                std::cerr<<"WARNING! The IC(0) preconditioner needs a matrix in CSR format: it will be the identity"<<std::endl;
+                return;
+            }
+            const auto idx=A.outer_indices();
+            const auto ptr=A.inner_indices();
+            const auto val=A.values();
+            const std::size_t n=ptr.size()-1;
+            m_ptr.assign(1, 0);
+            for(std::size_t i = 0; i < n; ++i){
+                T diagonal{0};
+                for(std::size_t p = ptr[i]; p < ptr[i+1] && idx[p] <= i; ++p){
+                    if(idx[p]==i)
+                        diagonal=val[p];
+                    else{
+                        m_col.push_back(idx[p]);
+                        m_val.push_back(val[p]);
+                    }
+                }
+                m_col.push_back(i);
+                m_val.push_back(diagonal);
+                m_ptr.push_back(m_col.size());
+            }
+            factorize();
+        }
+
+        /**
+         * @brief solve L L^H z = r: forward substitution with L, then backward substitution with L^H
+         *
+         * @param r right-hand side
+         * @param z solution
+         */
+        void
+        apply(std::span<const T> r, std::span<T> z) const{
+            if(m_ptr.empty()){
+                std::copy(r.begin(), r.end(), z.begin());
+                return;
+            }
+            const std::size_t n=m_ptr.size()-1;
+            const std::span<const unsigned int> lower_begin(m_ptr.data(), n), upper_end(m_t_ptr.data()+1, n);
+            m_lower_levels.solve<T>(lower_begin, m_lower_end, m_col, m_val, m_inv_diag, r, z, m_threads);
+            m_upper_levels.solve<T>(m_upper_begin, upper_end, m_t_col, m_t_val, m_inv_diag, z, z, m_threads);
+        }
+
+        //! number of sequential steps of the forward and backward substitutions
+        inline std::pair<std::size_t, std::size_t> levels() const{
+            return {m_lower_levels.levels(), m_upper_levels.levels()};
+        }
+
+        private:
+        // left-looking factorization by rows: L_ik = (A_ik - sum_{j<k} L_ij conj(L_kj)) / L_kk
+        void
+        factorize(){
+            const std::size_t n=m_ptr.size()-1;
+            m_inv_diag.assign(n, T(1));
+            unsigned int n_replaced=0;
+            for(std::size_t i = 0; i < n; ++i){
+                const unsigned int diag=m_ptr[i+1]-1;
+                for(unsigned int p = m_ptr[i]; p < diag; ++p){
+                    const unsigned int k=m_col[p];
+                    //sparse dot product of the rows i and k, on the columns before k
+                    T sum=m_val[p];
+                    unsigned int q=m_ptr[i], r=m_ptr[k];
+                    while(q < p && r < m_ptr[k+1]-1){
+                        if(m_col[q]<m_col[r])
+                            ++q;
+                        else if(m_col[r]<m_col[q])
+                            ++r;
+                        else
+                            sum-=m_val[q++]*conj_if_complex(m_val[r++]);
+                    }
+                    m_val[p]=sum*m_inv_diag[k];
+                }
+                double pivot=std::real(m_val[diag]);
+                for(unsigned int p = m_ptr[i]; p < diag; ++p)
+                    pivot-=std::norm(m_val[p]);
+                if(!(pivot>0)){
+                    pivot=1;
+                    ++n_replaced;
+                }
+                m_val[diag]=std::sqrt(pivot);
+                m_inv_diag[i]=T(1)/m_val[diag];
+            }
+            if(n_replaced>0)
+                std::cerr<<"WARNING! IC(0): "<<n_replaced<<" non-positive pivots replaced by 1"<<std::endl;
+            //L^H by rows, that is L by columns with conjugated values
+            m_t_ptr.assign(n+1, 0);
+            for(auto j : m_col)
+                ++m_t_ptr[j+1];
+            for(std::size_t j = 0; j < n; ++j)
+                m_t_ptr[j+1]+=m_t_ptr[j];
+            m_t_col.resize(m_col.size());
+            m_t_val.resize(m_val.size());
+            std::vector<unsigned int> next(m_t_ptr.begin(), m_t_ptr.end()-1);
+            for(std::size_t i = 0; i < n; ++i)
+                for(unsigned int p = m_ptr[i]; p < m_ptr[i+1]; ++p){
+                    const unsigned int q=next[m_col[p]]++;
+                    m_t_col[q]=i;
+                    m_t_val[q]=conj_if_complex(m_val[p]);
+                }
+            m_lower_end.resize(n);
+            m_upper_begin.resize(n);
+            for(std::size_t i = 0; i < n; ++i){
+                m_lower_end[i]=m_ptr[i+1]-1;
+                m_upper_begin[i]=m_t_ptr[i]+1;
+            }
+            const std::span<const unsigned int> lower_begin(m_ptr.data(), n), upper_end(m_t_ptr.data()+1, n);
+            m_lower_levels.build(lower_begin, m_lower_end, m_col, true);
+            m_upper_levels.build(m_upper_begin, upper_end, m_t_col, false);
+        }
+    };
+
+}// namespace algebra
+
+#endif// HH_PRECONDITIONERS_HH
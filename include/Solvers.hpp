@@ -0,0 +1,347 @@
+#ifndef HH_SOLVERS_HH
+#define HH_SOLVERS_HH
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <span>
+#include <vector>
+#include "Matrix.hpp"
+#include "Preconditioners.hpp"
+#include "chrono.hpp"
+
+namespace algebra{
+
+    /**
+     * @brief outcome of an iterative solver
+     *
+     */
+    struct SolverResult{
+        bool            converged{false};
+        unsigned int    iterations{0};
+        double          residual{0};  // relative residual ||b-Ax||/||b||
+        Timings::Chrono clock;        // time of the solution
+    };
+
+    inline std::ostream&
+    operator<<(std::ostream& out, const SolverResult& result){
+        out<<(result.converged ? "converged" : "NOT converged")<<" in "<<result.iterations
+           <<" iterations, relative residual "<<result.residual<<". "<<result.clock;
+        return out;
+    }
+
+    // helpers of the solvers on vectors of the same length
+    namespace solver_detail{
+
+        //! x^H y
+        template<class T>
+        T
+        dot(std::span<const T> x, std::span<const T> y){
+            T sum{0};
+            for(std::size_t i = 0; i < x.size(); ++i)
+                sum+=conj_if_complex(x[i])*y[i];
+            return sum;
+        }
+
+        //! ||x||
+        template<class T>
+        double
+        norm(std::span<const T> x){
+            return std::sqrt(std::abs(dot(x, x)));
+        }
+
+        //! y += a*x
+        template<class T>
+        void
+        axpy(T a, std::span<const T> x, std::span<T> y){
+            for(std::size_t i = 0; i < x.size(); ++i)
+                y[i]+=a*x[i];
+        }
+
+        // resize a vector of the workspace: memory is allocated only when the size grows
+        template<class T>
+        std::span<T>
+        reserve(std::vector<T>& v, std::size_t n){
+            if(v.size()<n)
+                v.resize(n);
+            return {v.data(), n};
+        }
+    }// namespace solver_detail
+
+    /**
+     * @brief preconditioned conjugate gradient, for symmetric (hermitian) positive definite
+     *  matrices. The product by the search direction and the dot product p^H A p are computed
+     *  by the fused kernel of the matrix. The workspace is allocated by the first solve and reused.
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class ConjugateGradient{
+        private:
+        double         m_tolerance;
+        unsigned int   m_max_iterations;
+        std::vector<T> m_r, m_z, m_p, m_q;
+
+        public:
+        /**
+         * @param tolerance on the relative residual ||b-Ax||/||b||
+         * @param max_iterations maximum number of iterations
+         */
+        explicit ConjugateGradient(double tolerance=1e-8, unsigned int max_iterations=1000):
+        m_tolerance{tolerance}, m_max_iterations{max_iterations}{}
+
+        /**
+         * @brief solve Ax=b
+         *
+         * @param A matrix
+         * @param b right-hand side
+         * @param x initial guess, overwritten by the solution
+         * @param M preconditioner (apply(r, z) computes z=M^{-1}r)
+         * @return SolverResult
+         */
+        template<class Mat, class Precond=IdentityPreconditioner<T>>
+        SolverResult
+        solve(const Mat &A, std::span<const T> b, std::span<T> x, const Precond &M=Precond()){
+            using namespace solver_detail;
+            SolverResult result;
+            result.clock.start();
+            const std::size_t n=A.rows();
+            auto r=reserve(m_r, n), z=reserve(m_z, n), p=reserve(m_p, n), q=reserve(m_q, n);
+            const double b_norm=norm<T>(b)>0 ? norm<T>(b) : 1.0;
+
+            result.residual=std::sqrt(std::abs(A.residual(b, x, r)))/b_norm;
+            M.apply(r, z);
+            std::copy(z.begin(), z.end(), p.begin());
+            T rz=dot<T>(r, z);
+            while(result.residual>m_tolerance && result.iterations<m_max_iterations){
+                ++result.iterations;
+                const T alpha=rz/A.multiply_dot(p, q).x_dot_y;
+                axpy<T>(alpha, p, x);
+                axpy<T>(-alpha, q, r);
+                result.residual=norm<T>(r)/b_norm;
+                M.apply(r, z);
+                const T rz_new=dot<T>(r, z);
+                const T beta=rz_new/rz;
+                for(std::size_t i = 0; i < n; ++i)
+                    p[i]=z[i]+beta*p[i];
+                rz=rz_new;
+            }
+            result.converged=result.residual<=m_tolerance;
+            result.clock.stop();
+            return result;
+        }
+    };
+
+    /**
+     * @brief BiCGStab with right preconditioning, for general square matrices. The workspace
+     *  is allocated by the first solve and reused.
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class BiCGStab{
+        private:
+        double         m_tolerance;
+        unsigned int   m_max_iterations;
+        std::vector<T> m_r, m_r0, m_p, m_v, m_s, m_t, m_p_hat, m_s_hat;
+
+        public:
+        /**
+         * @param tolerance on the relative residual ||b-Ax||/||b||
+         * @param max_iterations maximum number of iterations
+         */
+        explicit BiCGStab(double tolerance=1e-8, unsigned int max_iterations=1000):
+        m_tolerance{tolerance}, m_max_iterations{max_iterations}{}
+
+        /**
+         * @brief solve Ax=b
+         *
+         * @param A matrix
+         * @param b right-hand side
+         * @param x initial guess, overwritten by the solution
+         * @param M preconditioner (apply(r, z) computes z=M^{-1}r)
+         * @return SolverResult
+         */
+        template<class Mat, class Precond=IdentityPreconditioner<T>>
+        SolverResult
+        solve(const Mat &A, std::span<const T> b, std::span<T> x, const Precond &M=Precond()){
+            using namespace solver_detail;
+            SolverResult result;
+            result.clock.start();
+            const std::size_t n=A.rows();
+            auto r=reserve(m_r, n), r0=reserve(m_r0, n), p=reserve(m_p, n), v=reserve(m_v, n);
+            auto s=reserve(m_s, n), t=reserve(m_t, n), p_hat=reserve(m_p_hat, n), s_hat=reserve(m_s_hat, n);
+            const double b_norm=norm<T>(b)>0 ? norm<T>(b) : 1.0;
+
+            result.residual=std::sqrt(std::abs(A.residual(b, x, r)))/b_norm;
+            std::copy(r.begin(), r.end(), r0.begin());
+            std::fill(p.begin(), p.end(), T(0));
+            std::fill(v.begin(), v.end(), T(0));
+            T rho{1}, alpha{1}, omega{1};
+            while(result.residual>m_tolerance && result.iterations<m_max_iterations){
+                ++result.iterations;
+                const T rho_new=dot<T>(r0, r);
+                if(rho_new==T(0))
+                    break;//breakdown: r is orthogonal to the shadow residual
+                const T beta=(rho_new/rho)*(alpha/omega);
+                for(std::size_t i = 0; i < n; ++i)
+                    p[i]=r[i]+beta*(p[i]-omega*v[i]);
+                M.apply(p, p_hat);
+                A.multiply(p_hat, v);
+                alpha=rho_new/dot<T>(r0, v);
+                for(std::size_t i = 0; i < n; ++i)
+                    s[i]=r[i]-alpha*v[i];
+                if(norm<T>(s)/b_norm<=m_tolerance){
+                    axpy<T>(alpha, p_hat, x);
+                    result.residual=norm<T>(s)/b_norm;
+                    break;
+                }
+                M.apply(s, s_hat);
+                A.multiply(s_hat, t);
+                const T t_norm2=dot<T>(t, t);
+                omega= t_norm2==T(0) ? T(0) : dot<T>(t, s)/t_norm2;
+                axpy<T>(alpha, p_hat, x);
+                axpy<T>(omega, s_hat, x);
+                for(std::size_t i = 0; i < n; ++i)
+                    r[i]=s[i]-omega*t[i];
+                result.residual=norm<T>(r)/b_norm;
+                rho=rho_new;
+                if(omega==T(0))
+                    break;//breakdown
+            }
+            result.converged=result.residual<=m_tolerance;
+            result.clock.stop();
+            return result;
+        }
+    };
+
+    /**
+     * @brief restarted GMRES(m) with right preconditioning, for general square matrices.
+     *  The Krylov basis is orthogonalized with the modified Gram-Schmidt method and the
+     *  least-squares problem is updated with Givens rotations, so the residual is estimated at each
+     *  iteration without computing it; the true residual is checked at each restart. The workspace (m+1 vectors) is allocated by the first
+     *  solve and reused.
+     *
+     * @tparam T type of the values
+     */
+    template<class T>
+    class GMRES{
+        private:
+        unsigned int   m_restart;
+        double         m_tolerance;
+        unsigned int   m_max_iterations;
+        std::vector<T> m_basis;       // m+1 vectors of the Krylov basis, one after the other
+        std::vector<T> m_hessenberg;  // (m+1) x m, column-major
+        std::vector<T> m_cos, m_sin, m_g, m_y, m_w, m_z;
+
+        public:
+        /**
+         * @param restart dimension m of the Krylov space before a restart
+         * @param tolerance on the relative residual ||b-Ax||/||b||
+         * @param max_iterations maximum number of iterations (in total)
+         */
+        explicit GMRES(unsigned int restart=30, double tolerance=1e-8, unsigned int max_iterations=1000):
+        m_restart{std::max(restart, 1u)}, m_tolerance{tolerance}, m_max_iterations{max_iterations}{}
+
+        /**
+         * @brief solve Ax=b
+         *
+         * @param A matrix
+         * @param b right-hand side
+         * @param x initial guess, overwritten by the solution
+         * @param M preconditioner (apply(r, z) computes z=M^{-1}r)
+         * @return SolverResult
+         */
+        template<class Mat, class Precond=IdentityPreconditioner<T>>
+        SolverResult
+        solve(const Mat &A, std::span<const T> b, std::span<T> x, const Precond &M=Precond()){
+            using namespace solver_detail;
+            SolverResult result;
+            result.clock.start();
+            const std::size_t n=A.rows(), m=m_restart;
+            reserve(m_basis, (m+1)*n);
+            auto H=reserve(m_hessenberg, (m+1)*m);
+            auto cs=reserve(m_cos, m), sn=reserve(m_sin, m), g=reserve(m_g, m+1), y=reserve(m_y, m);
+            auto w=reserve(m_w, n), z=reserve(m_z, n);
+            auto V=[&](std::size_t j){ return std::span<T>(m_basis.data()+j*n, n); };
+            auto h=[&](std::size_t i, std::size_t j) -> T& { return H[j*(m+1)+i]; };
+            const double b_norm=norm<T>(b)>0 ? norm<T>(b) : 1.0;
+
+            while(true){
+                //true residual of the current solution, that is the first vector of the basis: the
+                //estimate given by the rotations can drift from it on ill-conditioned matrices
+                const double beta=std::sqrt(std::abs(A.residual(b, x, V(0))));
+                result.residual=beta/b_norm;
+                if(result.residual<=m_tolerance || beta==0 || result.iterations>=m_max_iterations)
+                    break;
+                for(auto& v : V(0))
+                    v/=beta;
+                std::fill(g.begin(), g.end(), T(0));
+                g[0]=beta;
+                std::size_t j=0;
+                for(; j < m && result.iterations<m_max_iterations; ){
+                    ++result.iterations;
+                    //new direction w = A M^{-1} v_j, orthogonalized against the basis with two
+                    //passes of modified Gram-Schmidt: one pass loses the orthogonality of the
+                    //basis on ill-conditioned matrices, and GMRES stagnates
+                    M.apply(V(j), z);
+                    A.multiply(z, w);
+                    for(std::size_t i = 0; i <= j; ++i)
+                        h(i,j)=T(0);
+                    for(unsigned int pass = 0; pass < 2; ++pass)
+                        for(std::size_t i = 0; i <= j; ++i){
+                            const T correction=dot<T>(V(i), w);
+                            h(i,j)+=correction;
+                            axpy<T>(-correction, V(i), w);
+                        }
+                    const double w_norm=norm<T>(w);
+                    h(j+1,j)=w_norm;
+                    if(w_norm>0)
+                        for(std::size_t k = 0; k < n; ++k)
+                            V(j+1)[k]=w[k]/w_norm;
+                    //apply the previous rotations to the new column, then compute the new one
+                    for(std::size_t i = 0; i < j; ++i){
+                        const T temp=cs[i]*h(i,j)+sn[i]*h(i+1,j);
+                        h(i+1,j)=-conj_if_complex(sn[i])*h(i,j)+cs[i]*h(i+1,j);
+                        h(i,j)=temp;
+                    }
+                    const double a_abs=std::abs(h(j,j));
+                    if(a_abs==0){
+                        cs[j]=0;
+                        sn[j]=1;
+                    }else{
+                        const double radius=std::hypot(a_abs, w_norm);
+                        cs[j]=a_abs/radius;
+                        sn[j]=(h(j,j)/a_abs)*conj_if_complex(h(j+1,j))/radius;
+                    }
+                    h(j,j)=cs[j]*h(j,j)+sn[j]*h(j+1,j);
+                    h(j+1,j)=0;
+                    g[j+1]=-conj_if_complex(sn[j])*g[j];
+                    g[j]=cs[j]*g[j];
+                    result.residual=std::abs(g[j+1])/b_norm;
+                    ++j;
+                    if(result.residual<=m_tolerance || w_norm==0)
+                        break;
+                }
+                //solution of the least-squares problem: back substitution with the triangular H
+                for(std::size_t i = j; i-- > 0;){
+                    T sum=g[i];
+                    for(std::size_t k = i+1; k < j; ++k)
+                        sum-=h(i,k)*y[k];
+                    y[i]=sum/h(i,i);
+                }
+                //x += M^{-1} V y
+                std::fill(w.begin(), w.end(), T(0));
+                for(std::size_t i = 0; i < j; ++i)
+                    axpy<T>(y[i], V(i), w);
+                M.apply(w, z);
+                axpy<T>(T(1), z, x);
+            }
+            result.converged=result.residual<=m_tolerance;
+            result.clock.stop();
+            return result;
+        }
+    };
+
+}// namespace algebra
+
+#endif// HH_SOLVERS_HH
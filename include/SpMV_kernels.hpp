@@ -0,0 +1,625 @@
+#ifndef HH_SPMV_KERNELS_HH
+#define HH_SPMV_KERNELS_HH
+#include <algorithm>
+#include <cstddef>
+#include <complex>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include "BFloat16.hpp"
+
+// The hand-vectorized kernels need the GCC/Clang target attributes and the x86 intrinsics
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ALGEBRA_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace algebra{
+/**
+ * @brief kernels of the CSR, SELL-C-sigma and BSR matrix-vector products, with the
+ *  hand-vectorized versions selected at runtime from the CPU features, and of the
+ *  CSR/CSC products by a multi-vector
+ *
+ */
+namespace simd{
+
+    /**
+     * @brief instruction set used by the kernels
+     *
+     */
+    enum class SimdLevel{
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    /**
+     * @brief signature of a kernel computing y[i] = alpha*sum_j val[j]*x[col[j]] + beta*y[i]
+     *  for the rows row_begin <= i < row_end of a CSR matrix (see store)
+     *
+     * @tparam T type of the vectors, in which the products are accumulated
+     * @tparam Index type of the column indices
+     * @tparam Offset type of the row pointers
+     * @tparam V type of the stored values (e.g. float values with double vectors)
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int, class V=T>
+    using CsrKernel = void (*)(const V* val, const Index* col, const Offset* ptr,
+                               std::size_t row_begin, std::size_t row_end, const T* x, T* y,
+                               T alpha, T beta);
+
+    /**
+     * @brief signature of a kernel computing the product for the slices
+     *  slice_begin <= s < slice_end of a SELL-C-sigma matrix. The result of the sorted
+     *  position p (only if p < n_rows) is written in y[perm[p]].
+     *
+     * @tparam T type of the vectors, in which the products are accumulated
+     * @tparam Index type of the column indices
+     * @tparam Offset type of the slice pointers
+     * @tparam V type of the stored values
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int, class V=T>
+    using SellKernel = void (*)(const V* val, const Index* col, const Offset* slice_ptr,
+                                unsigned int chunk, std::size_t slice_begin, std::size_t slice_end,
+                                const unsigned int* perm, std::size_t n_rows, const T* x, T* y,
+                                T alpha, T beta);
+
+    /**
+     * @brief write the result of a row in the output: y = alpha*value + beta*y. With beta=0
+     *  the previous content of y is never read (it can be uninitialized), with alpha=1 the
+     *  value is copied as it is.
+     *
+     */
+    template<class T>
+    inline void
+    store(T& y, const T& value, const T& alpha, const T& beta){
+        const T scaled = alpha==T(1) ? value : alpha*value;
+        y = beta==T(0) ? scaled : scaled + beta*y;
+    }
+
+    /**
+     * @brief generic kernel: it is the plain loop over the rows, used for every type
+     *  and as fallback when the CPU has neither AVX2 nor AVX-512. The values are converted
+     *  to T before the product.
+     *
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int, class V=T>
+    void
+    csr_spmv_scalar(const V* val, const Index* col, const Offset* ptr,
+                    std::size_t row_begin, std::size_t row_end, const T* x, T* y,
+                    T alpha, T beta){
+        for(std::size_t i = row_begin; i < row_end; ++i){
+            T temp = 0.0;
+            //loop over the elements of the row
+            for(Offset j = ptr[i]; j < ptr[i+1]; ++j){
+                //multiply the element of the matrix by the corresponding element of the vector
+                temp += T(val[j]) * x[col[j]];
+            }
+            store(y[i], temp, alpha, beta);
+        }
+    }
+
+    //! largest number of rows of a SELL-C-sigma slice (C), so that a slice fits a buffer on the stack
+    inline constexpr unsigned int max_sell_chunk=64;
+
+    /**
+     * @brief generic SELL-C-sigma kernel: the loop over the C rows of a slice is the innermost one.
+     *  The sums of a slice are kept on the stack (chunk <= max_sell_chunk), nothing is allocated.
+     *
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int, class V=T>
+    void
+    sell_spmv_scalar(const V* val, const Index* col, const Offset* slice_ptr,
+                     unsigned int chunk, std::size_t slice_begin, std::size_t slice_end,
+                     const unsigned int* perm, std::size_t n_rows, const T* x, T* y,
+                     T alpha, T beta){
+        T temp[max_sell_chunk];
+        for(std::size_t s = slice_begin; s < slice_end; ++s){
+            std::fill(temp, temp+chunk, T(0));
+            const std::size_t width = (slice_ptr[s+1]-slice_ptr[s])/chunk;
+            for(std::size_t k = 0; k < width; ++k){
+                const std::size_t base = slice_ptr[s] + k*chunk;
+                for(unsigned int r = 0; r < chunk; ++r)
+                    temp[r] += T(val[base+r]) * x[col[base+r]];
+            }
+            for(unsigned int r = 0; r < chunk && s*chunk+r < n_rows; ++r)
+                store(y[perm[s*chunk+r]], temp[r], alpha, beta);
+        }
+    }
+
+    // call f(0), f(1), ..., f(N-1) with compile-time indices: the loop is always fully unrolled
+    template<class F, std::size_t... I>
+    inline void
+    unrolled_for(F&& f, std::index_sequence<I...>){
+        (f(std::integral_constant<std::size_t, I>{}), ...);
+    }
+
+    /**
+     * @brief BSR kernel with blocks of size B x B (stored row-major). It has the same signature
+     *  as the CSR kernels, with block rows in place of rows: col and ptr are the block column
+     *  indices and the block row pointers. The products of the blocks are fully unrolled.
+     *
+     * @tparam T type of the values
+     * @tparam B size of the blocks
+     * @tparam Index type of the block column indices
+     * @tparam Offset type of the block row pointers
+     */
+    template<class T, unsigned int B, class Index=unsigned int, class Offset=unsigned int>
+    void
+    bsr_spmv(const T* val, const Index* col, const Offset* ptr,
+             std::size_t row_begin, std::size_t row_end, const T* x, T* y,
+             T alpha, T beta){
+        for(std::size_t i = row_begin; i < row_end; ++i){
+            T acc[B]{};
+            for(Offset k = ptr[i]; k < ptr[i+1]; ++k){
+                const T* block = val + std::size_t(k)*B*B;
+                const T* xb    = x + std::size_t(col[k])*B;
+                unrolled_for([&](auto r){
+                    unrolled_for([&](auto c){
+                        acc[r] += block[r*B+c] * xb[c];
+                    }, std::make_index_sequence<B>{});
+                }, std::make_index_sequence<B>{});
+            }
+            unrolled_for([&](auto r){ store(y[i*B+r], acc[r], alpha, beta); }, std::make_index_sequence<B>{});
+        }
+    }
+
+    /**
+     * @brief signature of a kernel multiplying the rows (CSR) or the columns (CSC)
+     *  begin <= i < end of a compressed matrix by a row-major multi-vector x with k columns.
+     *  The result y is row-major with k columns too.
+     *
+     * @tparam T type of the values
+     * @tparam Index type of the column (row) indices
+     * @tparam Offset type of the row (column) pointers
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int>
+    using SpmmKernel = void (*)(const T* val, const Index* idx, const Offset* ptr,
+                                std::size_t begin, std::size_t end, const T* x, T* y, unsigned int k);
+
+    /**
+     * @brief CSR kernel of the product by a multi-vector: each element of the matrix is loaded
+     *  once and applied to the k columns, y[i,:] = sum_j val[j]*x[col[j],:]. With K>0 the number
+     *  of columns is a compile-time constant and the loop over them is fully unrolled (and
+     *  vectorized by the compiler), with K=0 it is the runtime value k.
+     *
+     * @tparam T type of the values
+     * @tparam K number of columns (0 if known only at runtime)
+     */
+    template<class T, unsigned int K, class Index=unsigned int, class Offset=unsigned int>
+    void
+    csr_spmm(const T* val, const Index* col, const Offset* ptr,
+             std::size_t row_begin, std::size_t row_end, const T* x, T* y, unsigned int k){
+        if constexpr(K>0){
+            for(std::size_t i = row_begin; i < row_end; ++i){
+                T acc[K]{};
+                for(Offset j = ptr[i]; j < ptr[i+1]; ++j){
+                    const T  a  = val[j];
+                    const T* xr = x + std::size_t(col[j])*K;
+                    unrolled_for([&](auto c){ acc[c] += a * xr[c]; }, std::make_index_sequence<K>{});
+                }
+                unrolled_for([&](auto c){ y[i*K+c]=acc[c]; }, std::make_index_sequence<K>{});
+            }
+        }else{
+            for(std::size_t i = row_begin; i < row_end; ++i){
+                T* yr = y + i*k;
+                std::fill(yr, yr+k, T(0));
+                for(Offset j = ptr[i]; j < ptr[i+1]; ++j){
+                    const T  a  = val[j];
+                    const T* xr = x + std::size_t(col[j])*k;
+                    for(unsigned int c = 0; c < k; ++c)
+                        yr[c] += a * xr[c];
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief CSC kernel of the product by a multi-vector: the columns of the matrix are
+     *  scattered, y[row[j],:] += val[j]*x[i,:]. y is accumulated, not overwritten.
+     *
+     * @tparam T type of the values
+     * @tparam K number of columns of the multi-vector (0 if known only at runtime)
+     */
+    template<class T, unsigned int K, class Index=unsigned int, class Offset=unsigned int>
+    void
+    csc_spmm(const T* val, const Index* row, const Offset* ptr,
+             std::size_t col_begin, std::size_t col_end, const T* x, T* y, unsigned int k){
+        const unsigned int n = K>0 ? K : k;
+        for(std::size_t i = col_begin; i < col_end; ++i){
+            const T* xr = x + i*n;
+            for(Offset j = ptr[i]; j < ptr[i+1]; ++j){
+                const T a  = val[j];
+                T*      yr = y + std::size_t(row[j])*n;
+                if constexpr(K>0)
+                    unrolled_for([&](auto c){ yr[c] += a * xr[c]; }, std::make_index_sequence<K>{});
+                else
+                    for(unsigned int c = 0; c < k; ++c)
+                        yr[c] += a * xr[c];
+            }
+        }
+    }
+
+    /**
+     * @brief select the kernel of the product by a multi-vector with k columns: the
+     *  specializations for k = 1, 2, 4, 8, 16 are unrolled, any other k uses the runtime loop
+     *
+     * @tparam T type of the values
+     * @tparam Index type of the column (row) indices
+     * @tparam Offset type of the row (column) pointers
+     * @param k number of columns of the multi-vector
+     * @param column_wise true for the CSC kernel
+     * @return SpmmKernel<T, Index, Offset>
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int>
+    SpmmKernel<T, Index, Offset>
+    spmm_kernel(unsigned int k, bool column_wise){
+        switch(k){
+            case 1:  return column_wise ? &csc_spmm<T, 1, Index, Offset>  : &csr_spmm<T, 1, Index, Offset>;
+            case 2:  return column_wise ? &csc_spmm<T, 2, Index, Offset>  : &csr_spmm<T, 2, Index, Offset>;
+            case 4:  return column_wise ? &csc_spmm<T, 4, Index, Offset>  : &csr_spmm<T, 4, Index, Offset>;
+            case 8:  return column_wise ? &csc_spmm<T, 8, Index, Offset>  : &csr_spmm<T, 8, Index, Offset>;
+            case 16: return column_wise ? &csc_spmm<T, 16, Index, Offset> : &csr_spmm<T, 16, Index, Offset>;
+            default: return column_wise ? &csc_spmm<T, 0, Index, Offset>  : &csr_spmm<T, 0, Index, Offset>;
+        }
+    }
+
+#ifdef ALGEBRA_X86_SIMD
+// GCC 12 gives false positives on the _mm*_undefined_* values used inside the intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    // NOTE: the gathers use 32-bit signed offsets, column indices must be smaller than 2^31
+    // (see gather_level). The vectorized kernels exist for 32-bit and 16-bit column indices, the
+    // pointers can be of any type
+
+    // load 4 column indices as 32-bit integers (the 16-bit ones are zero-extended)
+    template<class Index>
+    __attribute__((target("avx2")))
+    inline __m128i
+    load_indices4(const Index* col){
+        if constexpr(sizeof(Index)==2)
+            return _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(col)));
+        else
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(col));
+    }
+
+    // load 8 column indices as 32-bit integers
+    template<class Index>
+    __attribute__((target("avx2")))
+    inline __m256i
+    load_indices8(const Index* col){
+        if constexpr(sizeof(Index)==2)
+            return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(col)));
+        else
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col));
+    }
+
+    // load 4 values as doubles: float and bfloat16 values are widened in the registers, so that
+    // the stream of the values read from memory is halved (float) or quartered (bfloat16)
+    template<class V>
+    __attribute__((target("avx2")))
+    inline __m256d
+    load_values4(const V* val){
+        if constexpr(std::is_same_v<V, float>)
+            return _mm256_cvtps_pd(_mm_loadu_ps(val));
+        else if constexpr(std::is_same_v<V, bfloat16>)
+            return _mm256_cvtps_pd(_mm_castsi128_ps(_mm_slli_epi32(
+                       _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(val))), 16)));
+        else
+            return _mm256_loadu_pd(val);
+    }
+
+    // load 8 values as doubles
+    template<class V>
+    __attribute__((target("avx512f")))
+    inline __m512d
+    load_values8(const V* val){
+        if constexpr(std::is_same_v<V, float>)
+            return _mm512_cvtps_pd(_mm256_loadu_ps(val));
+        else if constexpr(std::is_same_v<V, bfloat16>)
+            return _mm512_cvtps_pd(_mm256_castsi256_ps(_mm256_slli_epi32(
+                       _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(val))), 16)));
+        else
+            return _mm512_loadu_pd(val);
+    }
+
+    // AVX2 kernel for double vectors: 4 non-zeros at a time with a gather of x and a fused multiply-add.
+    // The values are double, float or bfloat16
+    template<class V, class Index, class Offset>
+    __attribute__((target("avx2,fma")))
+    void
+    csr_spmv_avx2(const V* val, const Index* col, const Offset* ptr,
+                  std::size_t row_begin, std::size_t row_end, const double* x, double* y,
+                  double alpha, double beta){
+        for(std::size_t i = row_begin; i < row_end; ++i){
+            std::size_t j = ptr[i];
+            const std::size_t end = ptr[i+1];
+            __m256d acc = _mm256_setzero_pd();
+            for(; j + 4 <= end; j += 4){
+                __m128i idx = load_indices4(col + j);
+                __m256d xv  = _mm256_i32gather_pd(x, idx, 8);
+                acc = _mm256_fmadd_pd(load_values4(val + j), xv, acc);
+            }
+            //horizontal sum of the four lanes
+            __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+            double temp = _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+            //remainder of the row
+            for(; j < end; ++j)
+                temp += double(val[j]) * x[col[j]];
+            store(y[i], temp, alpha, beta);
+        }
+    }
+
+    // AVX-512 kernel for double vectors: 8 non-zeros at a time, the tail of the row is handled with
+    // a mask (32-bit indices and double or float values) or with scalar operations
+    template<class V, class Index, class Offset>
+    __attribute__((target("avx512f")))
+    void
+    csr_spmv_avx512(const V* val, const Index* col, const Offset* ptr,
+                    std::size_t row_begin, std::size_t row_end, const double* x, double* y,
+                    double alpha, double beta){
+        for(std::size_t i = row_begin; i < row_end; ++i){
+            std::size_t j = ptr[i];
+            const std::size_t end = ptr[i+1];
+            __m512d acc = _mm512_setzero_pd();
+            for(; j + 8 <= end; j += 8){
+                __m256i idx = load_indices8(col + j);
+                __m512d xv  = _mm512_i32gather_pd(idx, x, 8);
+                acc = _mm512_fmadd_pd(load_values8(val + j), xv, acc);
+            }
+            if constexpr(sizeof(Index)==2 || std::is_same_v<V, bfloat16>){
+                //masked 16-bit loads need AVX-512BW: scalar remainder
+                double temp = _mm512_reduce_add_pd(acc);
+                for(; j < end; ++j)
+                    temp += double(val[j]) * x[col[j]];
+                store(y[i], temp, alpha, beta);
+                continue;
+            }
+            if(j < end){
+                const __mmask8 mask = static_cast<__mmask8>((1u << (end - j)) - 1);
+                __m256i idx = _mm512_castsi512_si256(_mm512_maskz_loadu_epi32(static_cast<__mmask16>(mask), col + j));
+                __m512d xv  = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, idx, x, 8);
+                __m512d a;
+                if constexpr(std::is_same_v<V, float>)
+                    a = _mm512_cvtps_pd(_mm512_castps512_ps256(_mm512_maskz_loadu_ps(static_cast<__mmask16>(mask), val + j)));
+                else
+                    a = _mm512_maskz_loadu_pd(mask, val + j);
+                acc = _mm512_fmadd_pd(a, xv, acc);
+            }
+            store(y[i], _mm512_reduce_add_pd(acc), alpha, beta);
+        }
+    }
+
+    // AVX2 kernel for std::complex<double>, working on the interleaved (real, imag) pairs.
+    // Two non-zeros at a time: acc_direct collects (ar*xr, ai*xi) and acc_swap (ar*xi, ai*xr),
+    // the real and the imaginary parts are recombined only at the end of the row.
+    template<class Index, class Offset>
+    __attribute__((target("avx2,fma")))
+    void
+    csr_spmv_complex_avx2(const std::complex<double>* val, const Index* col, const Offset* ptr,
+                          std::size_t row_begin, std::size_t row_end,
+                          const std::complex<double>* x, std::complex<double>* y,
+                          std::complex<double> alpha, std::complex<double> beta){
+        const double* v  = reinterpret_cast<const double*>(val);
+        const double* xd = reinterpret_cast<const double*>(x);
+        for(std::size_t i = row_begin; i < row_end; ++i){
+            std::size_t j = ptr[i];
+            const std::size_t end = ptr[i+1];
+            __m256d acc_direct = _mm256_setzero_pd();
+            __m256d acc_swap   = _mm256_setzero_pd();
+            for(; j + 2 <= end; j += 2){
+                __m256d a  = _mm256_loadu_pd(v + 2*j);
+                __m256d xv = _mm256_set_m128d(_mm_loadu_pd(xd + 2*std::size_t(col[j+1])),
+                                              _mm_loadu_pd(xd + 2*std::size_t(col[j])));
+                acc_direct = _mm256_fmadd_pd(a, xv, acc_direct);
+                acc_swap   = _mm256_fmadd_pd(a, _mm256_permute_pd(xv, 0b0101), acc_swap);
+            }
+            __m128d d = _mm_add_pd(_mm256_castpd256_pd128(acc_direct), _mm256_extractf128_pd(acc_direct, 1));
+            __m128d s = _mm_add_pd(_mm256_castpd256_pd128(acc_swap), _mm256_extractf128_pd(acc_swap, 1));
+            double re = _mm_cvtsd_f64(d) - _mm_cvtsd_f64(_mm_unpackhi_pd(d, d));
+            double im = _mm_cvtsd_f64(s) + _mm_cvtsd_f64(_mm_unpackhi_pd(s, s));
+            for(; j < end; ++j){
+                const double ar = v[2*j], ai = v[2*j+1];
+                const double xr = xd[2*std::size_t(col[j])], xi = xd[2*std::size_t(col[j])+1];
+                re += ar*xr - ai*xi;
+                im += ar*xi + ai*xr;
+            }
+            store(y[i], std::complex<double>(re, im), alpha, beta);
+        }
+    }
+
+    // AVX-512 kernel for std::complex<double>: same scheme as the AVX2 one with four non-zeros at a time
+    template<class Index, class Offset>
+    __attribute__((target("avx512f")))
+    void
+    csr_spmv_complex_avx512(const std::complex<double>* val, const Index* col, const Offset* ptr,
+                            std::size_t row_begin, std::size_t row_end,
+                            const std::complex<double>* x, std::complex<double>* y,
+                            std::complex<double> alpha, std::complex<double> beta){
+        const double* v  = reinterpret_cast<const double*>(val);
+        const double* xd = reinterpret_cast<const double*>(x);
+        for(std::size_t i = row_begin; i < row_end; ++i){
+            std::size_t j = ptr[i];
+            const std::size_t end = ptr[i+1];
+            __m512d acc_direct = _mm512_setzero_pd();
+            __m512d acc_swap   = _mm512_setzero_pd();
+            for(; j + 4 <= end; j += 4){
+                __m512d a   = _mm512_loadu_pd(v + 2*j);
+                __m256d x01 = _mm256_set_m128d(_mm_loadu_pd(xd + 2*std::size_t(col[j+1])),
+                                               _mm_loadu_pd(xd + 2*std::size_t(col[j])));
+                __m256d x23 = _mm256_set_m128d(_mm_loadu_pd(xd + 2*std::size_t(col[j+3])),
+                                               _mm_loadu_pd(xd + 2*std::size_t(col[j+2])));
+                __m512d xv  = _mm512_insertf64x4(_mm512_castpd256_pd512(x01), x23, 1);
+                acc_direct = _mm512_fmadd_pd(a, xv, acc_direct);
+                acc_swap   = _mm512_fmadd_pd(a, _mm512_permute_pd(xv, 0b01010101), acc_swap);
+            }
+            //even lanes hold the products ar*xr (direct) and ar*xi (swap), odd lanes ai*xi and ai*xr
+            const __mmask8 even = 0b01010101, odd = 0b10101010;
+            double re = _mm512_mask_reduce_add_pd(even, acc_direct) - _mm512_mask_reduce_add_pd(odd, acc_direct);
+            double im = _mm512_reduce_add_pd(acc_swap);
+            for(; j < end; ++j){
+                const double ar = v[2*j], ai = v[2*j+1];
+                const double xr = xd[2*std::size_t(col[j])], xi = xd[2*std::size_t(col[j])+1];
+                re += ar*xr - ai*xi;
+                im += ar*xi + ai*xr;
+            }
+            store(y[i], std::complex<double>(re, im), alpha, beta);
+        }
+    }
+
+    // AVX2 SELL-C-sigma kernel for double vectors (chunk multiple of 4): one lane per row, no reduction needed
+    template<class V, class Index, class Offset>
+    __attribute__((target("avx2,fma")))
+    void
+    sell_spmv_avx2(const V* val, const Index* col, const Offset* slice_ptr,
+                   unsigned int chunk, std::size_t slice_begin, std::size_t slice_end,
+                   const unsigned int* perm, std::size_t n_rows, const double* x, double* y,
+                   double alpha, double beta){
+        alignas(32) double temp[4];
+        for(std::size_t s = slice_begin; s < slice_end; ++s){
+            const std::size_t width = (slice_ptr[s+1]-slice_ptr[s])/chunk;
+            for(unsigned int r0 = 0; r0 < chunk; r0 += 4){
+                __m256d acc = _mm256_setzero_pd();
+                for(std::size_t k = 0; k < width; ++k){
+                    const std::size_t base = slice_ptr[s] + k*chunk + r0;
+                    __m128i idx = load_indices4(col + base);
+                    acc = _mm256_fmadd_pd(load_values4(val + base), _mm256_i32gather_pd(x, idx, 8), acc);
+                }
+                _mm256_store_pd(temp, acc);
+                for(unsigned int r = 0; r < 4 && s*chunk+r0+r < n_rows; ++r)
+                    store(y[perm[s*chunk+r0+r]], temp[r], alpha, beta);
+            }
+        }
+    }
+
+    // AVX-512 SELL-C-sigma kernel for double vectors (chunk multiple of 8)
+    template<class V, class Index, class Offset>
+    __attribute__((target("avx512f")))
+    void
+    sell_spmv_avx512(const V* val, const Index* col, const Offset* slice_ptr,
+                     unsigned int chunk, std::size_t slice_begin, std::size_t slice_end,
+                     const unsigned int* perm, std::size_t n_rows, const double* x, double* y,
+                     double alpha, double beta){
+        alignas(64) double temp[8];
+        for(std::size_t s = slice_begin; s < slice_end; ++s){
+            const std::size_t width = (slice_ptr[s+1]-slice_ptr[s])/chunk;
+            for(unsigned int r0 = 0; r0 < chunk; r0 += 8){
+                __m512d acc = _mm512_setzero_pd();
+                for(std::size_t k = 0; k < width; ++k){
+                    const std::size_t base = slice_ptr[s] + k*chunk + r0;
+                    __m256i idx = load_indices8(col + base);
+                    acc = _mm512_fmadd_pd(load_values8(val + base), _mm512_i32gather_pd(idx, x, 8), acc);
+                }
+                _mm512_store_pd(temp, acc);
+                for(unsigned int r = 0; r < 8 && s*chunk+r0+r < n_rows; ++r)
+                    store(y[perm[s*chunk+r0+r]], temp[r], alpha, beta);
+            }
+        }
+    }
+#pragma GCC diagnostic pop
+#endif
+
+    // column index types read by the vectorized kernels
+    template<class Index>
+    inline constexpr bool simd_indices = std::is_same_v<Index, std::uint32_t> || std::is_same_v<Index, std::uint16_t>;
+
+    // value types read by the vectorized kernels for double vectors
+    template<class V>
+    inline constexpr bool simd_values = std::is_same_v<V, double> || std::is_same_v<V, float> || std::is_same_v<V, bfloat16>;
+
+    /**
+     * @brief return the best instruction set supported by the CPU (checked once)
+     *
+     */
+    inline SimdLevel
+    detected_simd_level(){
+#ifdef ALGEBRA_X86_SIMD
+        static const SimdLevel level = [](){
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx512f"))
+                return SimdLevel::AVX512;
+            if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                return SimdLevel::AVX2;
+            return SimdLevel::Scalar;
+        }();
+        return level;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }
+
+    /**
+     * @brief instruction set usable by the kernels of a matrix: the gathers take 32-bit signed
+     *  offsets, so a matrix with 2^31 rows, columns or non-zeros falls back to the scalar loops
+     *
+     * @param n_indices largest number of rows or columns
+     * @param nnz number of stored elements
+     * @param level instruction set (by default the one detected on the CPU)
+     * @return SimdLevel level, or SimdLevel::Scalar for a too large matrix
+     */
+    inline SimdLevel
+    gather_level(std::size_t n_indices, std::size_t nnz, SimdLevel level = detected_simd_level()){
+        constexpr std::size_t limit = std::size_t(1) << 31;
+        return n_indices < limit && nnz < limit ? level : SimdLevel::Scalar;
+    }
+
+    /**
+     * @brief select the CSR kernel for the type T. Only double and std::complex<double>
+     *  have vectorized versions, with 32-bit or 16-bit column indices; double vectors can also
+     *  read float or bfloat16 values. Any other case gets the scalar loop.
+     *
+     * @tparam T type of the vectors
+     * @tparam Index type of the column indices
+     * @tparam Offset type of the row pointers
+     * @tparam V type of the values
+     * @param level instruction set (by default the one detected on the CPU)
+     * @return CsrKernel<T, Index, Offset, V>
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int, class V=T>
+    CsrKernel<T, Index, Offset, V>
+    csr_kernel(SimdLevel level = detected_simd_level()){
+#ifdef ALGEBRA_X86_SIMD
+        if constexpr(simd_indices<Index>){
+            if constexpr(std::is_same_v<T, double> && simd_values<V>){
+                if(level==SimdLevel::AVX512) return &csr_spmv_avx512<V, Index, Offset>;
+                if(level==SimdLevel::AVX2)   return &csr_spmv_avx2<V, Index, Offset>;
+            }else if constexpr(std::is_same_v<T, std::complex<double>> && std::is_same_v<V, T>){
+                if(level==SimdLevel::AVX512) return &csr_spmv_complex_avx512<Index, Offset>;
+                if(level==SimdLevel::AVX2)   return &csr_spmv_complex_avx2<Index, Offset>;
+            }
+        }
+#endif
+        (void)level;
+        return &csr_spmv_scalar<T, Index, Offset, V>;
+    }
+
+    /**
+     * @brief select the SELL-C-sigma kernel for the type T. The vectorized versions exist
+     *  for double vectors (with double, float or bfloat16 values) and 32-bit or 16-bit column
+     *  indices, when the chunk is a multiple of the SIMD width.
+     *
+     * @tparam T type of the vectors
+     * @tparam Index type of the column indices
+     * @tparam Offset type of the slice pointers
+     * @tparam V type of the values
+     * @param chunk number of rows of a slice
+     * @param level instruction set (by default the one detected on the CPU)
+     * @return SellKernel<T, Index, Offset, V>
+     */
+    template<class T, class Index=unsigned int, class Offset=unsigned int, class V=T>
+    SellKernel<T, Index, Offset, V>
+    sell_kernel(unsigned int chunk, SimdLevel level = detected_simd_level()){
+#ifdef ALGEBRA_X86_SIMD
+        if constexpr(std::is_same_v<T, double> && simd_indices<Index> && simd_values<V>){
+            if(level==SimdLevel::AVX512 && chunk%8==0) return &sell_spmv_avx512<V, Index, Offset>;
+            if(level!=SimdLevel::Scalar && chunk%4==0) return &sell_spmv_avx2<V, Index, Offset>;
+        }
+#endif
+        (void)chunk;
+        (void)level;
+        return &sell_spmv_scalar<T, Index, Offset, V>;
+    }
+
+}// namespace simd
+}// namespace algebra
+
+#endif// HH_SPMV_KERNELS_HH
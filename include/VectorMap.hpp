@@ -0,0 +1,254 @@
+#ifndef HH_VECTOR_MAP_HH
+#define HH_VECTOR_MAP_HH
+// This file is included by Matrix.hpp inside the namespace algebra, after the definition of
+// StorageOrder and Indices.
+
+    /**
+     * @brief alternative to ElemType for the COOmap format: one sorted vector of (index, value)
+     *  pairs for each row (row-major ordering) or column (column-major ordering). Compared to
+     *  the std::map it has no node overhead and a lookup is a binary search in a short contiguous
+     *  vector, while insertions in the middle of a row shift its elements.
+     *  It keeps the subset of the std::map interface used by Matrix, and the traversal follows
+     *  the same ordering as CustomCompare<Order>. Dereferencing an iterator gives a pair
+     *  (key, reference to the value) by value.
+     *
+     * @tparam T type of the values
+     * @tparam Order storage ordering
+     */
+    template <class T, StorageOrder Order>
+    class VectorMap{
+        private:
+        // position of the row/column (outer) and of the other index (inner) inside the key
+        static constexpr std::size_t outer= Order==StorageOrder::RowWise ? 0 : 1;
+        static constexpr std::size_t inner= 1-outer;
+
+        using Line=std::vector<std::pair<std::size_t, T>>;
+        std::vector<Line> m_lines;
+        std::size_t       m_size{0};
+
+        // first element of the line not smaller than index
+        static auto
+        lower_bound(Line& line, std::size_t index){
+            return std::lower_bound(line.begin(), line.end(), index,
+                                    [](const auto& a, std::size_t b){ return a.first<b; });
+        }
+
+        public:
+        /**
+         * @brief bidirectional iterator over the elements, in the order of the rows (columns)
+         *
+         * @tparam Const true for the iterator on a const map
+         */
+        template<bool Const>
+        class Iterator{
+            private:
+            using Owner=std::conditional_t<Const, const VectorMap, VectorMap>;
+            Owner*      m_map{nullptr};
+            std::size_t m_line{0};
+            std::size_t m_pos{0};
+
+            // move forward to the first non-empty line if the current one is over
+            void
+            skip_empty(){
+                while(m_line<m_map->m_lines.size() && m_pos>=m_map->m_lines[m_line].size()){
+                    ++m_line;
+                    m_pos=0;
+                }
+            }
+
+            friend class VectorMap;
+
+            public:
+            using value_type=std::pair<Indices, std::conditional_t<Const, const T&, T&>>;
+            using reference=value_type;
+            using difference_type=std::ptrdiff_t;
+            using iterator_category=std::bidirectional_iterator_tag;
+
+            // operator-> needs a pointer to an object that lives as long as the expression
+            struct Arrow{
+                value_type m_value;
+                value_type* operator->(){ return &m_value; }
+            };
+
+            Iterator()=default;
+            Iterator(Owner* map, std::size_t line, std::size_t pos): m_map{map}, m_line{line}, m_pos{pos}{
+                skip_empty();
+            }
+            // conversion from iterator to const_iterator
+            template<bool C=Const, class=std::enable_if_t<C>>
+            Iterator(const Iterator<false>& other): Iterator(other.m_map, other.m_line, other.m_pos){}
+
+            reference
+            operator*() const{
+                auto& element=m_map->m_lines[m_line][m_pos];
+                Indices key;
+                key[outer]=m_line;
+                key[inner]=element.first;
+                return {key, element.second};
+            }
+            Arrow
+            operator->() const{
+                return Arrow{**this};
+            }
+            Iterator&
+            operator++(){
+                ++m_pos;
+                skip_empty();
+                return *this;
+            }
+            Iterator
+            operator++(int){
+                Iterator old=*this;
+                ++*this;
+                return old;
+            }
+            Iterator&
+            operator--(){
+                while(m_pos==0){
+                    --m_line;
+                    m_pos=m_map->m_lines[m_line].size();
+                }
+                --m_pos;
+                return *this;
+            }
+            Iterator
+            operator--(int){
+                Iterator old=*this;
+                --*this;
+                return old;
+            }
+            bool
+            operator==(const Iterator& other) const{
+                return m_line==other.m_line && m_pos==other.m_pos;
+            }
+        };
+
+        using key_type=Indices;
+        using mapped_type=T;
+        using iterator=Iterator<false>;
+        using const_iterator=Iterator<true>;
+
+        iterator begin(){ return iterator(this, 0, 0); }
+        iterator end(){ return iterator(this, m_lines.size(), 0); }
+        const_iterator begin() const{ return const_iterator(this, 0, 0); }
+        const_iterator end() const{ return const_iterator(this, m_lines.size(), 0); }
+
+        inline std::size_t size() const{ return m_size; }
+        inline bool empty() const{ return m_size==0; }
+
+        void
+        clear(){
+            m_lines.clear();
+            m_size=0;
+        }
+
+        //! return the value with the given key, inserting a zero if it is not present
+        T&
+        operator[](const Indices& key){
+            if(key[outer]>=m_lines.size())
+                m_lines.resize(key[outer]+1);
+            Line& line=m_lines[key[outer]];
+            auto it=lower_bound(line, key[inner]);
+            if(it==line.end() || it->first!=key[inner]){
+                it=line.insert(it, {key[inner], T()});
+                ++m_size;
+            }
+            return it->second;
+        }
+
+        //! insert the element if the key is not present (as std::map::insert)
+        std::pair<iterator, bool>
+        insert(const std::pair<Indices, T>& element){
+            const Indices& key=element.first;
+            if(key[outer]>=m_lines.size())
+                m_lines.resize(key[outer]+1);
+            Line& line=m_lines[key[outer]];
+            auto it=lower_bound(line, key[inner]);
+            const std::size_t pos=it-line.begin();
+            if(it!=line.end() && it->first==key[inner])
+                return {iterator(this, key[outer], pos), false};
+            line.insert(it, {key[inner], element.second});
+            ++m_size;
+            return {iterator(this, key[outer], pos), true};
+        }
+
+        //! insert with a position hint, as std::map::insert (the lines need no hint)
+        iterator
+        insert(const_iterator, const std::pair<Indices, T>& element){
+            return insert(element).first;
+        }
+
+        iterator
+        find(const Indices& key){
+            if(key[outer]<m_lines.size()){
+                Line& line=m_lines[key[outer]];
+                auto it=lower_bound(line, key[inner]);
+                if(it!=line.end() && it->first==key[inner])
+                    return iterator(this, key[outer], it-line.begin());
+            }
+            return end();
+        }
+
+        const_iterator
+        find(const Indices& key) const{
+            return const_cast<VectorMap*>(this)->find(key);
+        }
+
+        T&
+        at(const Indices& key){
+            auto it=find(key);
+            if(it==end())
+                throw std::out_of_range("VectorMap::at: key not present");
+            return it->second;
+        }
+
+        const T&
+        at(const Indices& key) const{
+            return const_cast<VectorMap*>(this)->at(key);
+        }
+
+        //! remove the element with the given key, return the number of removed elements
+        std::size_t
+        erase(const Indices& key){
+            auto it=find(key);
+            if(it==end())
+                return 0;
+            erase(it);
+            return 1;
+        }
+
+        //! remove the elements in [first, last), return the iterator to the next one. The
+        //! lines removed completely release their memory
+        iterator
+        erase(iterator first, iterator last){
+            std::size_t line=first.m_line, pos=first.m_pos;
+            for (; line<last.m_line; ++line, pos=0){
+                Line& current=m_lines[line];
+                m_size-=current.size()-pos;
+                if(pos==0)
+                    Line().swap(current);
+                else
+                    current.erase(current.begin()+pos, current.end());
+            }
+            if(line<m_lines.size() && pos<last.m_pos){
+                Line& current=m_lines[line];
+                current.erase(current.begin()+pos, current.begin()+last.m_pos);
+                m_size-=last.m_pos-pos;
+            }
+            return iterator(this, line, pos);
+        }
+
+        //! remove the element pointed by the iterator, return the iterator to the next one
+        iterator
+        erase(iterator it){
+            Line& line=m_lines[it.m_line];
+            line.erase(line.begin()+it.m_pos);
+            --m_size;
+            //release the memory of the line when it becomes empty
+            if(line.empty())
+                Line().swap(line);
+            return iterator(this, it.m_line, it.m_pos);
+        }
+    };
+
+#endif// HH_VECTOR_MAP_HH
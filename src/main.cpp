@@ -10,11 +10,52 @@
  */
 #include <iostream>
 #include "Matrix.hpp"
+#include "Solvers.hpp"
+#include "Expressions.hpp"
+#include "Laplacian.hpp"
 #include "chrono.hpp"
 #include <map>
 #include <array>
 #include <vector>
 #include <utility>
+
+namespace{
+// number of failed checks: the program returns 1 if any of them fails
+unsigned int n_failed{0};
+
+// print the outcome of a check of the results, and count it if it fails
+bool
+check(const std::string& what, bool passed){
+  std::cout<<what<<": "<<std::boolalpha<<passed<<std::endl;
+  if (!passed)
+    ++n_failed;
+  return passed;
+}
+
+// maximum difference between two vectors, relative to the largest element of the second one
+template<class T>
+double
+relative_difference(const std::vector<T>& a, const std::vector<T>& b){
+  if (a.size()!=b.size())
+    return std::numeric_limits<double>::infinity();
+  double max_diff{0}, max_value{0};
+  for (std::size_t i = 0; i < a.size(); ++i){
+    max_diff=std::max<double>(max_diff, std::abs(a[i]-b[i]));
+    max_value=std::max<double>(max_value, std::abs(b[i]));
+  }
+  return max_value>0 ? max_diff/max_value : max_diff;
+}
+
+// check that two ways of computing the same result agree, then print their times
+void
+compare(const std::string& what, bool same, const std::string& first, const Timings::Chrono& clock_first,
+        const std::string& second, const Timings::Chrono& clock_second){
+  check(what+", same result", same);
+  std::cout<<first<<". "<<clock_first;
+  std::cout<<second<<". "<<clock_second;
+}
+}
+
 int main()
 {
     using namespace algebra;
@@ -49,13 +90,12 @@ int main()
     A(0,0)=12;
     double valore1=A(0,0);
     double valore=A.at(0,0);
-    //It is possible to read the matrix with the call operator but it is UNSAFE
+    //It is possible to read the matrix with the call operator, as with at()
     std::cout<<"Value in (0,0): "<<valore1<<std::endl;
     std::cout<<"Value in (0,0): "<<valore<<std::endl;
-    //indeed if the element is not present, a 0 will be added to the map.
-    // to read the matrix, if you are not sure if the key is present or not
-    // prefer the at() method.
-    std::cout<<"Value in (1,3): "<<A(1,3)<<std::endl; // a zero will be added in the map and stored (undesired)
+    //a read of a missing element gives 0 and does not add it to the map:
+    //only an assignment inserts
+    std::cout<<"Value in (1,3): "<<A(1,3)<<std::endl; // nothing is stored
     A.erase(1,3); // I can remove an element if the matrix is uncompressed
     //If compressed erase will have no effect and a warning will be printed
     
@@ -78,10 +118,9 @@ int main()
     
   A.compress(val, col_ind, row_ptr);
   // If the matrix is compressed I can read it with the at method
-  // I can try to read also with the call operato but it is unsafe.
-  // If the key is present all works fine, if not the call will cause an abort
-  //to avoid a modification of the map in compressed state. 
-  //In this state only non-zero entries can be modified
+  // or with the call operator: a missing element is read as 0.
+  // An assignment modifies an existing element in place, a new one
+  // goes in the buffer of the insertions, merged later in the compressed arrays
 
   
 
@@ -90,9 +129,8 @@ int main()
   //greater than the matrix will cause a segmentation fault. Be careful.
   std::cout<<"Reading with call operator: A(1,3):" <<A(1,3)<<std::endl;
   std::cout<<"Reading with at method: A(1,3): " <<A.at(1,3)<<std::endl;//prefer at()
-  A(1,3)=5;//This call will have no effect
-  //indeed E(1,3) will be 0+i0;
-  std::cout<<"A(1,3) is still: "<<A(1,3)<<std::endl;
+  A(1,3)=5;//the new element is buffered, the matrix stays compressed
+  std::cout<<"A(1,3) inserted in the compressed matrix: "<<A(1,3)<<std::endl;
   A(0,0)=5; //OK, the element will be modified
   std::cout<<"New value of A(0,0): "<<A(0,0)<<std::endl;
    std::cout<<"New value of A(0,0): "<<A.at(0,0)<<std::endl;
@@ -199,6 +237,57 @@ int main()
     std::cout<<*ite<<std::endl;
   }
   
+  /////////////////////////////////////////////
+  //************Construction from triplets*****//
+  /////////////////////////////////////////////
+  // The compressed matrix can be built directly from unsorted lists of entries,
+  // without the map. Duplicated entries are summed (or use LastWins to keep the last one)
+  {
+  std::vector<unsigned int> rows, cols;
+  std::vector<double>       values;
+  for (unsigned int i = 0; i < n; ++i)
+    {
+      rows.push_back(i); cols.push_back(i); values.push_back(2);
+      rows.push_back(i); cols.push_back(i); values.push_back(2); // duplicate: A(i,i)=4
+      if (i > 0){
+        rows.push_back(i); cols.push_back(i-1); values.push_back(-1);
+      }
+      if (i < n - 1){
+        rows.push_back(i); cols.push_back(i+1); values.push_back(-1);
+      }
+    }
+  Matrix<double, Order> T(n, n, rows, cols, values);
+  std::vector<double> prod_triplets=T*b;
+  std::cout<<"The result of the product with the CSR matrix built from triplets is: "<<std::endl;
+  for (auto it=prod_triplets.begin();it!=prod_triplets.end();++it){
+    std::cout<<*it<<std::endl;
+  }
+  // the duplicates are combined in the order of the lists, also when the lists are split among
+  // the threads: compare with the map, where += sums them and = keeps the last one
+  const unsigned int n_grid{50}, n_entries{5000};
+  rows.clear(); cols.clear(); values.clear();
+  for (unsigned int k = 0; k < n_entries; ++k){
+    rows.push_back(k*37%n_grid); cols.push_back(k*91%n_grid/2); values.push_back(1.0/(k+1));
+  }
+  Matrix<double, Order> Summed, Last, Map_summed, Map_last;
+  Summed.set_num_threads(4);
+  Last.set_num_threads(4);
+  Summed.set_from_triplets(rows, cols, values);
+  Last.set_from_triplets(rows, cols, values, LastWins());
+  for (unsigned int k = 0; k < n_entries; ++k){
+    Map_summed(rows[k], cols[k])+=values[k];
+    Map_last(rows[k], cols[k])=values[k];
+  }
+  Map_summed.compress();
+  Map_last.compress();
+  auto same_arrays=[](const auto& X, const auto& Y){
+    return std::ranges::equal(X.values(), Y.values()) && std::ranges::equal(X.outer_indices(), Y.outer_indices()) &&
+           std::ranges::equal(X.inner_indices(), Y.inner_indices());
+  };
+  check("Triplets split among 4 threads, duplicates summed as in the map", same_arrays(Summed, Map_summed));
+  check("Triplets split among 4 threads, last duplicate kept as in the map", same_arrays(Last, Map_last));
+  }
+
   ///////////////////////////////////////////////////////////////
   /***************Read from a file in a Market Matrix Format*/
   Matrix<double> C;
@@ -237,6 +326,892 @@ int main()
   clock_compressed_csc.stop();
   std::cout << "Compressed case(CSC). "<<clock_compressed_csc;
 
+  // The same matrix can be compressed in SELL-C-sigma format: rows sorted by length
+  // in windows of sigma rows and packed in slices of C rows (here C=8, sigma=64)
+  Matrix<double> G;
+  G.read_market_matrix(filename);
+  G.compress_sell(8, 64);
+  std::vector<double> prod_mark_sell;
+  Timings::Chrono clock_sell;
+  clock_sell.start();
+  prod_mark_sell=G*c;
+  clock_sell.stop();
+  std::cout << "Compressed case(SELL-C-sigma). "<<clock_sell;
+  // the rows are summed in another order than in CSR format: the results agree up to rounding.
+  // A vector with different entries checks the column indices too
+  std::vector<double> x_file(131);
+  for (unsigned int i = 0; i < 131; ++i)
+    x_file[i]=1.0+i%7;
+  check("SELL-C-sigma product, same result as CSR", relative_difference(prod_mark_sell, prod_mark_compressed)<=1e-14 &&
+                                                    relative_difference(G*x_file, C*x_file)<=1e-14);
+  // a chunk that is not a multiple of the SIMD width runs the generic kernel, which keeps the
+  // sums of a slice on the stack: C is at most simd::max_sell_chunk
+  Matrix<double> G_generic;
+  G_generic.read_market_matrix(filename);
+  G_generic.compress_sell(6, 64);
+  check("SELL-C-sigma product with the generic kernel (C=6), same result as CSR",
+        relative_difference(G_generic*x_file, C*x_file)<=1e-14);
+
+  // or in BSR format with dense 2x2 blocks (the block size is a template parameter)
+  Matrix<double> H;
+  H.read_market_matrix(filename);
+  H.compress_bsr<2>();
+  std::vector<double> prod_mark_bsr;
+  Timings::Chrono clock_bsr;
+  clock_bsr.start();
+  prod_mark_bsr=H*c;
+  clock_bsr.stop();
+  std::cout << "Compressed case(BSR 2x2). "<<clock_bsr;
+  check("BSR product, same result as CSR", relative_difference(prod_mark_bsr, prod_mark_compressed)<=1e-14 &&
+                                           relative_difference(H*x_file, C*x_file)<=1e-14);
+
+  // The file can also be read directly in the compressed state: it is mapped in memory
+  // and parsed in parallel, the map is never filled
+  Matrix<double> K, L;
+  Timings::Chrono clock_read_map, clock_read_compressed;
+  clock_read_map.start();
+  K.read_market_matrix(filename);
+  clock_read_map.stop();
+  std::cout << "Reading in COOmap format. "<<clock_read_map;
+  clock_read_compressed.start();
+  L.read_market_matrix_compressed(filename);
+  clock_read_compressed.stop();
+  std::cout << "Reading in compressed format (CSR). "<<clock_read_compressed;
+  // both readers keep the first of the duplicated entries: the arrays are the same
+  const auto values_read=L.values(), values_map=C.values();
+  const auto indices_read=L.outer_indices(), indices_map=C.outer_indices();
+  const auto ptr_read=L.inner_indices(), ptr_map=C.inner_indices();
+  check("Compressed reader, same CSR arrays as the map",
+        std::ranges::equal(values_read, values_map) && std::ranges::equal(indices_read, indices_map) &&
+        std::ranges::equal(ptr_read, ptr_map) && L*c==prod_mark_compressed);
+
+  // The compressed state can be saved in a binary snapshot, and loaded back without parsing:
+  // the file is mapped in memory and the product runs directly on its pages
+  L.save_snapshot("./matrix.snap");
+  Matrix<double> M;
+  Timings::Chrono clock_snapshot;
+  clock_snapshot.start();
+  M.load_snapshot("./matrix.snap");
+  clock_snapshot.stop();
+  std::cout << "Loading the binary snapshot. "<<clock_snapshot;
+  std::vector<double> prod_snapshot=M*c;
+  check("Product with the loaded snapshot, same result", prod_snapshot==prod_mark_compressed);
+  // the renumbering of a matrix compressed with RCM is saved with the arrays
+  {
+  Matrix<double> Reordered, Loaded;
+  Reordered.read_market_matrix(filename);
+  Reordered.set_reordering(Reordering::RCM);
+  Reordered.compress();
+  Reordered.save_snapshot("./reordered.snap");
+  Loaded.load_snapshot("./reordered.snap");
+  std::vector<double> c_new(131), y_new(131), y_back(131);
+  Loaded.permute(c, c_new);
+  Loaded.multiply(c_new, y_new);
+  Loaded.unpermute(y_new, y_back);
+  check("Snapshot of a renumbered matrix, same permutation and product",
+        Loaded.permutation()==Reordered.permutation() && relative_difference(y_back, prod_mark_compressed)<=1e-14);
+  }
+  // a damaged file is refused and the matrix is not changed: an index outside the matrix,
+  // and a truncated file
+  {
+  std::ifstream in("./matrix.snap", std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  SnapshotHeader header;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  std::string damaged=bytes;
+  const unsigned int outside{1000};
+  std::memcpy(damaged.data()+header.outer_offset, &outside, sizeof(outside));
+  std::ofstream("./damaged.snap", std::ios::binary)<<damaged;
+  std::ofstream("./truncated.snap", std::ios::binary)<<bytes.substr(0, header.inner_offset);
+  Matrix<double> Damaged, Truncated;
+  check("Damaged and truncated snapshots are refused",
+        !Damaged.load_snapshot("./damaged.snap") && !Truncated.load_snapshot("./truncated.snap") &&
+        !Damaged.is_compressed() && !Truncated.is_compressed());
+  }
+
+  // The container of the COOmap format is a template parameter: VectorMap keeps a sorted
+  // vector for each row instead of the nodes of the std::map. Compare them on a FEM-like
+  // assembly (linear triangles on a structured grid, every local entry added with +=)
+  {
+  const unsigned int nx{200};
+  auto node=[nx](unsigned int i, unsigned int j){ return i*(nx+1)+j; };
+  auto assemble=[&](auto& S){
+    for (unsigned int i = 0; i < nx; ++i)
+      for (unsigned int j = 0; j < nx; ++j){
+        const std::array<std::array<unsigned int, 3>, 2> triangles{{
+          {node(i,j), node(i+1,j), node(i,j+1)},
+          {node(i+1,j+1), node(i,j+1), node(i+1,j)}}};
+        for (const auto& t : triangles)
+          for (unsigned int a = 0; a < 3; ++a)
+            for (unsigned int b = 0; b < 3; ++b)
+              S(t[a],t[b])+= (a==b) ? 1.0 : -0.5;
+      }
+  };
+  Matrix<double> S_map;
+  Matrix<double, StorageOrder::RowWise, VectorMap> S_vector;
+  Timings::Chrono clock_std_map, clock_vector_map;
+  clock_std_map.start();
+  assemble(S_map);
+  clock_std_map.stop();
+  std::cout << "FEM assembly with std::map. "<<clock_std_map;
+  clock_vector_map.start();
+  assemble(S_vector);
+  clock_vector_map.stop();
+  std::cout << "FEM assembly with VectorMap. "<<clock_vector_map;
+  std::vector<double>       val_fem, val_fem2;
+  std::vector<unsigned int> outer_fem, inner_fem, outer_fem2, inner_fem2;
+  S_map.compress(val_fem, outer_fem, inner_fem);
+  S_vector.compress(val_fem2, outer_fem2, inner_fem2);
+  std::vector<double> x_fem((nx+1)*(nx+1), 1.0);
+  std::vector<double> y_map=S_map*x_fem, y_vector=S_vector*x_fem;
+  std::cout<<"Same product with the two containers: "<<std::boolalpha<<(y_map==y_vector)<<std::endl;
+  // arrays built elsewhere are adopted without copies: they are moved in the matrix
+  Matrix<double> S_adopted;
+  S_adopted.set_compressed(std::move(val_fem2), std::move(outer_fem2), std::move(inner_fem2));
+  std::cout<<"Arrays moved in the matrix, same product: "<<(S_adopted*x_fem==y_map)
+           <<", elements: "<<S_adopted.values().size()<<std::endl;
+
+  // Newton-like iterations: the pattern does not change, the values do. With the frozen pattern
+  // the slots of the local entries are found once, then every assembly sums the contributions
+  // directly in the values of the CSR format
+  std::vector<unsigned int> local_rows, local_cols;
+  std::vector<double>       local_values;
+  for (unsigned int i = 0; i < nx; ++i)
+    for (unsigned int j = 0; j < nx; ++j){
+      const std::array<std::array<unsigned int, 3>, 2> triangles{{
+        {node(i,j), node(i+1,j), node(i,j+1)},
+        {node(i+1,j+1), node(i,j+1), node(i+1,j)}}};
+      for (const auto& t : triangles)
+        for (unsigned int a = 0; a < 3; ++a)
+          for (unsigned int b = 0; b < 3; ++b){
+            local_rows.push_back(t[a]);
+            local_cols.push_back(t[b]);
+            local_values.push_back((a==b) ? 1.0 : -0.5);
+          }
+    }
+  S_map.freeze_pattern();
+  const AssemblyPlan plan=S_map.assembly_plan(local_rows, local_cols);
+  const unsigned int n_newton{5};
+  // the coefficient changes at each iteration
+  std::vector<double> scaled(local_values.size());
+  auto scale=[&](unsigned int it){
+    for (std::size_t k = 0; k < local_values.size(); ++k)
+      scaled[k]=local_values[k]*(1.0+0.25*it);
+  };
+  Timings::Chrono clock_refill, clock_reassembly;
+  clock_refill.start();
+  for (unsigned int it = 0; it < n_newton; ++it){
+    scale(it);
+    S_map.refill(plan, scaled);
+  }
+  clock_refill.stop();
+  Matrix<double> S_rebuilt;
+  clock_reassembly.start();
+  for (unsigned int it = 0; it < n_newton; ++it){
+    scale(it);
+    S_rebuilt=Matrix<double>();
+    for (std::size_t k = 0; k < scaled.size(); ++k)
+      S_rebuilt(local_rows[k], local_cols[k])+=scaled[k];
+    S_rebuilt.compress();
+  }
+  clock_reassembly.stop();
+  const auto refilled=S_map.values(), rebuilt=S_rebuilt.values();
+  std::cout<<"Refill on the frozen pattern, same values: "
+           <<std::equal(refilled.begin(), refilled.end(), rebuilt.begin(), rebuilt.end())<<std::endl;
+  std::cout<<n_newton<<" assemblies on the frozen pattern. "<<clock_refill;
+  std::cout<<n_newton<<" assemblies with the map and compress. "<<clock_reassembly;
+  }
+
+  // In compressed state at() scans the short rows and searches the sorted column indices of the
+  // longer ones with a binary search; the rows longer than a threshold can also get a hash table
+  // (set_row_hash_threshold). Compare the three searches on the same CSR matrix, with rows of
+  // increasing length
+  for (unsigned int row_length : {4u, 32u, 256u, 2048u})
+  {
+  const unsigned int n_rows{(1u<<18)/row_length}, n_cols{4*row_length}, n_lookups{1u<<20};
+  std::vector<unsigned int> rows, cols;
+  std::vector<double>       values;
+  for (unsigned int i = 0; i < n_rows; ++i)
+    for (unsigned int k = 0; k < row_length; ++k){
+      rows.push_back(i); cols.push_back(4*k+i%4); values.push_back(i+k);
+    }
+  Matrix<double> R(n_rows, n_cols, rows, cols, values);
+  // the same pseudo-random keys for every search, half of them present in the matrix:
+  // the element (i,j) is present if j%4==i%4 and it is i+j/4
+  std::vector<std::array<unsigned int, 2>> keys(n_lookups);
+  unsigned int seed{12345};
+  double sum_exact{0};
+  for (auto& key : keys){
+    seed=seed*1664525u+1013904223u;
+    key={(seed>>8)%n_rows, (seed>>4)%n_cols};
+    sum_exact+= key[1]%4==key[0]%4 ? key[0]+key[1]/4 : 0.0;
+  }
+  auto lookups=[&](Timings::Chrono& clock){
+    double sum{0};
+    clock.start();
+    for (const auto& key : keys)
+      sum+=R.at(key[0], key[1]);
+    clock.stop();
+    return sum;
+  };
+  Timings::Chrono clock_linear, clock_binary, clock_hash;
+  R.set_linear_search_threshold(row_length);
+  const double sum_linear=lookups(clock_linear);
+  R.set_linear_search_threshold(0);
+  const double sum_binary=lookups(clock_binary);
+  R.set_row_hash_threshold(1);
+  const double sum_hash=lookups(clock_hash);
+  check("Element access, rows of length "+std::to_string(row_length)+", same result",
+        sum_linear==sum_exact && sum_binary==sum_exact && sum_hash==sum_exact);
+  std::cout<<"Linear search. "<<clock_linear;
+  std::cout<<"Binary search. "<<clock_binary;
+  std::cout<<"Hash tables. "<<clock_hash;
+  }
+
+  // Two compressed matrices can be multiplied, the result is compressed too.
+  // Galerkin coarse operator R*A*P of the Matrix Market matrix, with P aggregating pairs of nodes
+  // and R its transpose
+  {
+  const unsigned int n_fine{131}, n_coarse{(n_fine+1)/2};
+  std::vector<unsigned int> fine(n_fine), coarse(n_fine);
+  std::vector<double>       ones(n_fine, 1.0);
+  for (unsigned int i = 0; i < n_fine; ++i){
+    fine[i]=i; coarse[i]=i/2;
+  }
+  Matrix<double> P(n_fine, n_coarse, fine, coarse, ones), R(n_coarse, n_fine, coarse, fine, ones);
+  Timings::Chrono clock_galerkin;
+  clock_galerkin.start();
+  Matrix<double> A_coarse=R*(L*P);
+  clock_galerkin.stop();
+  std::cout << "Galerkin product R*A*P. "<<clock_galerkin;
+  // check against three matrix-vector products
+  std::vector<double> x_coarse(n_coarse);
+  for (unsigned int i = 0; i < n_coarse; ++i)
+    x_coarse[i]=1.0+i%7;
+  std::vector<double> y_galerkin=A_coarse*x_coarse, y_check=R*(L*(P*x_coarse));
+  double max_diff{0}, max_value{0};
+  for (unsigned int i = 0; i < n_coarse; ++i){
+    max_diff=std::max(max_diff, std::abs(y_galerkin[i]-y_check[i]));
+    max_value=std::max(max_value, std::abs(y_check[i]));
+  }
+  std::cout<<"Coarse operator with "<<n_coarse<<" rows, same product: "<<std::boolalpha<<(max_diff<=1e-12*max_value)<<std::endl;
+  // the columns of the left matrix must be the rows of the right one: P*A is refused
+  check("Matrix-matrix product with incompatible sizes refused", (P*L).values().empty());
+  }
+
+  // A compressed matrix can multiply a block of k vectors at once (row-major n x k multi-vector):
+  // the matrix is read once instead of k times. 5-point Laplacian on a 300x300 grid, k=16
+  {
+  const unsigned int nx{300}, n_nodes{nx*nx}, k{16};
+  const Triplets<double> laplacian=make_laplacian(nx);
+  Matrix<double> Lap(n_nodes, n_nodes, laplacian.rows, laplacian.cols, laplacian.values);
+  std::vector<double> X(n_nodes*k);
+  for (std::size_t i = 0; i < X.size(); ++i)
+    X[i]=1.0+i%11;
+  Timings::Chrono clock_vectors, clock_block;
+  std::vector<std::vector<double>> Y_vectors(k);
+  clock_vectors.start();
+  for (unsigned int c = 0; c < k; ++c){
+    std::vector<double> x(n_nodes);
+    for (unsigned int i = 0; i < n_nodes; ++i)
+      x[i]=X[i*k+c];
+    Y_vectors[c]=Lap*x;
+  }
+  clock_vectors.stop();
+  clock_block.start();
+  std::vector<double> Y_block=Lap.multiply_block(X, k);
+  clock_block.stop();
+  auto same_block=[&](const std::vector<double>& Y, unsigned int k){
+    bool same{true};
+    for (unsigned int c = 0; c < k; ++c)
+      for (unsigned int i = 0; i < n_nodes; ++i)
+        same= same && std::abs(Y_vectors[c][i]-Y[i*k+c])<=1e-14*std::abs(Y_vectors[c][i]);
+    return same;
+  };
+  compare("Product by a block of "+std::to_string(k)+" vectors", same_block(Y_block, k),
+          "One vector at a time", clock_vectors, "Whole block", clock_block);
+  // in CSC format each thread scatters its columns in its own block, then the blocks are summed.
+  // The first 5 vectors use the kernel for any k
+  Matrix<double, StorageOrder::ColWise> Lap_csc(n_nodes, n_nodes, laplacian.rows, laplacian.cols, laplacian.values);
+  Lap_csc.set_num_threads(4);
+  std::vector<double> X_5(n_nodes*5);
+  for (unsigned int i = 0; i < n_nodes; ++i)
+    for (unsigned int c = 0; c < 5; ++c)
+      X_5[i*5+c]=X[i*k+c];
+  check("Product by a block of vectors in CSC format on 4 threads, same result",
+        same_block(Lap_csc.multiply_block(X, k), k) && same_block(Lap_csc.multiply_block(X_5, 5), 5));
+  check("Product by a block too short refused",
+        Lap.multiply_block(std::vector<double>(X.begin(), X.end()-k), k).empty() &&
+        Lap_csc.multiply_block(std::vector<double>(X.begin(), X.end()-k), k).empty());
+
+  // Fused kernels for the Krylov solvers: y=A*x with x.y and ||y||^2 in the same pass
+  // (multiply_dot), and the residual r=b-A*x with ||r||^2 (residual)
+  std::vector<double> p(n_nodes), Ap(n_nodes), rhs(n_nodes, 1.0), res(n_nodes);
+  for (unsigned int i = 0; i < n_nodes; ++i)
+    p[i]=1.0+i%3;
+  Timings::Chrono clock_separate, clock_fused;
+  clock_separate.start();
+  Lap.multiply(p, Ap);
+  const double pAp=std::inner_product(p.begin(), p.end(), Ap.begin(), 0.0);
+  const double ApAp=std::inner_product(Ap.begin(), Ap.end(), Ap.begin(), 0.0);
+  clock_separate.stop();
+  clock_fused.start();
+  const FusedDot<double> fused=Lap.multiply_dot(p, Ap, true);
+  clock_fused.stop();
+  compare("Fused product and dot products",
+          std::abs(fused.x_dot_y-pAp)<=1e-12*pAp && std::abs(fused.y_norm2-ApAp)<=1e-12*ApAp,
+          "Product, then dot products", clock_separate, "Fused kernel", clock_fused);
+  const double res_norm2=Lap.residual(rhs, p, res);
+  std::cout<<"Squared norm of the residual b-A*p: "<<res_norm2<<std::endl;
+  // the same residual computed in two passes, on the CSR and on the CSC matrix (second pass)
+  std::vector<double> res_separate(n_nodes), res_csc(n_nodes);
+  Lap.multiply(p, res_separate);
+  double res_separate_norm2{0};
+  for (unsigned int i = 0; i < n_nodes; ++i){
+    res_separate[i]=rhs[i]-res_separate[i];
+    res_separate_norm2+=res_separate[i]*res_separate[i];
+  }
+  const double res_csc_norm2=Lap_csc.residual(rhs, p, res_csc);
+  check("Fused residual equal to b-A*p",
+        relative_difference(res, res_separate)<=1e-14 && relative_difference(res_csc, res_separate)<=1e-14
+        && std::abs(res_norm2-res_separate_norm2)<=1e-12*res_separate_norm2
+        && std::abs(res_csc_norm2-res_separate_norm2)<=1e-12*res_separate_norm2);
+  // only the rows of the matrix are read from b and written in r, even if b is longer; the dot
+  // product x.y is refused on a matrix with more rows than columns, where x is too short
+  {
+  std::vector<double> rhs_long(n_nodes+10, 1.0), res_rows(n_nodes);
+  const double res_rows_norm2=Lap_csc.residual(rhs_long, p, res_rows);
+  std::vector<unsigned int> rows_tall, cols_tall;
+  std::vector<double>       values_tall;
+  for (std::size_t k = 0; k < laplacian.rows.size(); ++k)
+    if (laplacian.cols[k]<n_nodes/2){
+      rows_tall.push_back(laplacian.rows[k]); cols_tall.push_back(laplacian.cols[k]); values_tall.push_back(laplacian.values[k]);
+    }
+  const Matrix<double> Tall(n_nodes, n_nodes/2, rows_tall, cols_tall, values_tall);
+  std::vector<double> y_tall(n_nodes, 7.0);
+  const FusedDot<double> refused=Tall.multiply_dot(std::span<const double>(p.data(), n_nodes/2), y_tall);
+  check("Residual with a longer b, dot product with a short x refused",
+        relative_difference(res_rows, res_separate)<=1e-14 && std::abs(res_rows_norm2-res_separate_norm2)<=1e-12*res_separate_norm2
+        && refused.x_dot_y==0.0 && std::ranges::all_of(y_tall, [](double v){return v==7.0;}));
+  }
+
+  // Preconditioned conjugate gradient on the Laplacian: A*x=b with the solution x=1
+  std::vector<double> x_exact(n_nodes, 1.0), b_lap(n_nodes);
+  Lap.multiply(x_exact, b_lap);
+  ConjugateGradient<double> cg(1e-8, 2000);
+  // the triangular solves of ILU(0) and IC(0) are level scheduled: the rows of a level are solved
+  // in parallel, and the levels are computed once with the factorization
+  ILU0Preconditioner<double> ilu(Lap);
+  IC0Preconditioner<double>  ic(Lap);
+  std::cout<<"Triangular solves of ILU(0) on "<<n_nodes<<" rows in "<<ilu.levels().first<<" levels"<<std::endl;
+  for (const std::string name : {"no", "Jacobi", "ILU(0)", "IC(0)"}){
+    std::vector<double> x_cg(n_nodes, 0.0);
+    SolverResult result;
+    if (name=="Jacobi")
+      result=cg.solve(Lap, b_lap, x_cg, JacobiPreconditioner<double>(Lap));
+    else if (name=="ILU(0)")
+      result=cg.solve(Lap, b_lap, x_cg, ilu);
+    else if (name=="IC(0)")
+      result=cg.solve(Lap, b_lap, x_cg, ic);
+    else
+      result=cg.solve(Lap, std::span<const double>(b_lap), x_cg);
+    double max_error{0};
+    for (unsigned int i = 0; i < n_nodes; ++i)
+      max_error=std::max(max_error, std::abs(x_cg[i]-1.0));
+    std::cout<<"CG with "<<name<<" preconditioner: "<<result;
+    std::cout<<"Maximum error on the solution: "<<max_error<<std::endl;
+  }
+  // the solves run on the threads of the factored matrix: on one thread the rows are solved in
+  // their natural order, with the same result
+  {
+  Matrix<double> Lap_serial(n_nodes, n_nodes, laplacian.rows, laplacian.cols, laplacian.values), Lap_parallel(Lap_serial);
+  Lap_serial.set_num_threads(1);
+  Lap_parallel.set_num_threads(4);
+  std::vector<double> z_parallel(n_nodes), z_serial(n_nodes), z_ic_parallel(n_nodes), z_ic_serial(n_nodes);
+  ILU0Preconditioner<double>(Lap_parallel).apply(b_lap, z_parallel);
+  ILU0Preconditioner<double>(Lap_serial).apply(b_lap, z_serial);
+  IC0Preconditioner<double>(Lap_parallel).apply(b_lap, z_ic_parallel);
+  IC0Preconditioner<double>(Lap_serial).apply(b_lap, z_ic_serial);
+  check("ILU(0) and IC(0) solves on the threads of the matrix, same result on 1 and 4 threads",
+        z_parallel==z_serial && z_ic_parallel==z_ic_serial);
+  }
+  // the diagonal of the Laplacian is constant, so Jacobi only scales it: on D*A*D, with a
+  // diagonal D that varies from node to node, Jacobi gives back the conditioning of A
+  {
+  std::vector<double> scaled_values(laplacian.values.size()), b_scaled(n_nodes);
+  auto d=[](unsigned int i){ return 1.0+(i%10); };
+  for (std::size_t k = 0; k < scaled_values.size(); ++k)
+    scaled_values[k]=d(laplacian.rows[k])*laplacian.values[k]*d(laplacian.cols[k]);
+  Matrix<double> Scaled(n_nodes, n_nodes, laplacian.rows, laplacian.cols, scaled_values);
+  Scaled.multiply(x_exact, b_scaled);
+  std::vector<double> x_plain(n_nodes, 0.0), x_jacobi(n_nodes, 0.0);
+  const SolverResult plain=cg.solve(Scaled, std::span<const double>(b_scaled), x_plain);
+  const SolverResult jacobi=cg.solve(Scaled, b_scaled, x_jacobi, JacobiPreconditioner<double>(Scaled));
+  std::cout<<"CG on the scaled Laplacian D*A*D: "<<plain;
+  std::cout<<"CG with Jacobi on the scaled Laplacian D*A*D: "<<jacobi;
+  check("Jacobi reduces the iterations on the scaled Laplacian",
+        plain.converged && jacobi.converged && 2*jacobi.iterations<plain.iterations);
+  }
+
+  // The shifted operator A+sigma*M (M a diagonal mass matrix) is applied without building it:
+  // the expression reads the two CSR matrices in the same loop on the rows, where operator*
+  // needs a temporary vector for each term
+  std::vector<unsigned int> diagonal(n_nodes);
+  std::iota(diagonal.begin(), diagonal.end(), 0u);
+  Matrix<double> Mass(n_nodes, n_nodes, diagonal, diagonal, std::vector<double>(n_nodes, 1.0));
+  const double sigma{0.5};
+  const auto shifted=lazy(Lap)+sigma*lazy(Mass);
+  const unsigned int n_shifted{1000};
+  std::vector<double> y_temporaries, y_lazy(n_nodes);
+  Timings::Chrono clock_temporaries, clock_lazy;
+  clock_temporaries.start();
+  for (unsigned int it = 0; it < n_shifted; ++it){
+    y_temporaries=Lap*x_exact;
+    const std::vector<double> y_mass=Mass*x_exact;
+    for (unsigned int i = 0; i < n_nodes; ++i)
+      y_temporaries[i]+=sigma*y_mass[i];
+  }
+  clock_temporaries.stop();
+  clock_lazy.start();
+  for (unsigned int it = 0; it < n_shifted; ++it)
+    shifted.apply(x_exact, y_lazy);
+  clock_lazy.stop();
+  double max_difference{0};
+  for (unsigned int i = 0; i < n_nodes; ++i)
+    max_difference=std::max(max_difference, std::abs(y_lazy[i]-y_temporaries[i]));
+  compare(std::to_string(n_shifted)+" lazy products A+sigma*M", max_difference<=1e-14,
+          "With temporaries", clock_temporaries, "Lazy", clock_lazy);
+  // every kind of expression against the matrix assembled explicitly, on a matrix that is not
+  // symmetric (the rows of the Laplacian scaled by 1+i%5) and a vector that is not constant
+  {
+  std::vector<double> scaled_values(laplacian.values.size()), x_vary(n_nodes);
+  for (std::size_t k = 0; k < scaled_values.size(); ++k)
+    scaled_values[k]=(1.0+laplacian.rows[k]%5)*laplacian.values[k];
+  for (unsigned int i = 0; i < n_nodes; ++i)
+    x_vary[i]=1.0+i%7;
+  Matrix<double> N(n_nodes, n_nodes, laplacian.rows, laplacian.cols, scaled_values);
+  auto assembled=[&](double coefficient){
+    std::vector<unsigned int> rows_sum(laplacian.rows), cols_sum(laplacian.cols);
+    std::vector<double>       values_sum(scaled_values);
+    rows_sum.insert(rows_sum.end(), diagonal.begin(), diagonal.end());
+    cols_sum.insert(cols_sum.end(), diagonal.begin(), diagonal.end());
+    values_sum.insert(values_sum.end(), n_nodes, coefficient);
+    return Matrix<double>(n_nodes, n_nodes, rows_sum, cols_sum, values_sum);
+  };
+  const Matrix<double> N_plus=assembled(sigma), N_minus=assembled(-1.0), N_mass=N*Mass;
+  std::vector<double> y_expression(n_nodes), y_explicit(n_nodes);
+  auto same=[&](const auto& expression, const Matrix<double>& A, bool transposed){
+    expression.apply(x_vary, y_expression);
+    if (transposed)
+      A.multiply_transpose(x_vary, y_explicit);
+    else
+      A.multiply(x_vary, y_explicit);
+    return relative_difference(y_expression, y_explicit)<=1e-14;
+  };
+  check("Lazy sum, difference, product and transposes against the assembled matrices",
+        same(lazy(N)+sigma*lazy(Mass), N_plus, false) && same(lazy(N)-lazy(Mass), N_minus, false)
+        && same(lazy(N)*lazy(Mass), N_mass, false) && same(transpose(lazy(N)+sigma*lazy(Mass)), N_plus, true)
+        && same(transpose(lazy(N)*lazy(Mass)), N_mass, true));
+  bool thrown{false};
+  try{
+    static_cast<void>(lazy(N)+lazy(L));
+  }catch(const std::invalid_argument&){
+    thrown=true;
+  }
+  check("Lazy sum of matrices with different sizes refused", thrown);
+  // the fused sum checks the vectors as the product of a matrix does
+  std::vector<double> y_short(n_nodes, 7.0), r_short(n_nodes/2);
+  (lazy(N)+sigma*lazy(Mass)).apply(std::span<const double>(x_vary.data(), n_nodes/2), y_short);
+  const double refused=(lazy(N)+sigma*lazy(Mass)).residual(x_vary, x_vary, r_short);
+  check("Lazy sum and residual with vectors too short refused",
+        std::ranges::all_of(y_short, [](double v){return v==7.0;}) && refused==0.0);
+  }
+  // the expression is accepted by the solvers in place of a matrix
+  std::vector<double> x_shifted(n_nodes, 0.0);
+  std::cout<<"CG on the lazy A+sigma*M: "<<cg.solve(shifted, std::span<const double>(y_lazy), x_shifted);
+  }
+
+  // multiply() writes y=alpha*A*x+beta*y in a vector owned by the caller, without allocations:
+  // compare it with operator* in a loop of repeated products, as in an iterative solver
+  {
+  const unsigned int n_iterations{100000};
+  std::vector<double> y_operator, y_multiply(L.rows());
+  Timings::Chrono clock_operator, clock_multiply;
+  clock_operator.start();
+  for (unsigned int it = 0; it < n_iterations; ++it)
+    y_operator=L*c;
+  clock_operator.stop();
+  clock_multiply.start();
+  for (unsigned int it = 0; it < n_iterations; ++it)
+    L.multiply(c, y_multiply);
+  clock_multiply.stop();
+  compare(std::to_string(n_iterations)+" products", y_operator==y_multiply,
+          "With operator*", clock_operator, "With multiply", clock_multiply);
+  // y=2*A*x-y
+  L.multiply(c, y_multiply, 2.0, -1.0);
+  std::cout<<"2*A*x-A*x equal to A*x: "<<std::boolalpha<<(y_operator==y_multiply)<<std::endl;
+  // the scratch buffer of the product belongs to the calling thread: two threads can multiply
+  // by the same CSC matrix on 4 threads at the same time
+  Matrix<double, StorageOrder::ColWise> D_shared(D);
+  D_shared.set_num_threads(4);
+  std::vector<double> y_first(D_shared.rows()), y_second(D_shared.rows());
+  #pragma omp parallel sections num_threads(2)
+  {
+    #pragma omp section
+    for (unsigned int it = 0; it < 1000; ++it)
+      D_shared.multiply(c, y_first);
+    #pragma omp section
+    for (unsigned int it = 0; it < 1000; ++it)
+      D_shared.multiply(x_file, y_second);
+  }
+  check("Concurrent products by the same matrix, same result",
+        relative_difference(y_first, D*c)<=1e-14 && relative_difference(y_second, D*x_file)<=1e-14);
+  // vectors too short are refused, y is not changed
+  std::vector<double> y_short(D_shared.rows(), 7.0);
+  D_shared.multiply(std::span<const double>(c.data(), 100), y_short);
+  check("Product with a vector too short refused", std::ranges::all_of(y_short, [](double v){return v==7.0;}));
+  }
+
+  // The transpose product A^T*x works on the same storage: CSR rows are scattered,
+  // CSC columns are gathered. Compare with the uncompressed matrix K
+  {
+  std::vector<double> x_t(131), y_csr(131), y_csc(131), y_map(131);
+  for (unsigned int i = 0; i < 131; ++i)
+    x_t[i]=1.0+i%5;
+  K.resize(131,131);
+  L.multiply_transpose(x_t, y_csr);
+  D.multiply_transpose(x_t, y_csc);
+  K.multiply_transpose(x_t, y_map);
+  double max_diff{0}, max_value{0};
+  for (unsigned int i = 0; i < 131; ++i){
+    max_diff=std::max({max_diff, std::abs(y_csr[i]-y_map[i]), std::abs(y_csc[i]-y_map[i])});
+    max_value=std::max(max_value, std::abs(y_map[i]));
+  }
+  std::cout<<"Transpose product with CSR and CSC, same result: "<<std::boolalpha<<(max_diff<=1e-12*max_value)<<std::endl;
+  }
+
+  // The kernel of the product is chosen at runtime from the CPU: every instruction set
+  // available is checked against the scalar loop (they sum the rows in another order)
+  {
+  std::vector<double> y_scalar(L.rows());
+  const auto ptr=L.inner_indices();
+  simd::csr_kernel<double>(simd::SimdLevel::Scalar)(L.values().data(), L.outer_indices().data(), ptr.data(),
+                                                   0, ptr.size()-1, c.data(), y_scalar.data(), 1.0, 0.0);
+  for (const auto level : {simd::SimdLevel::AVX2, simd::SimdLevel::AVX512}){
+    if (simd::detected_simd_level()<level)
+      continue;
+    std::vector<double> y_level(L.rows());
+    simd::csr_kernel<double>(level)(L.values().data(), L.outer_indices().data(), ptr.data(),
+                                    0, ptr.size()-1, c.data(), y_level.data(), 1.0, 0.0);
+    check(std::string(level==simd::SimdLevel::AVX2 ? "AVX2" : "AVX-512")+" kernel, same result as the scalar one",
+          relative_difference(y_level, y_scalar)<=1e-14);
+  }
+  }
+
+  // The matrix of the file is not symmetric and almost singular (condition number ~3e15: a
+  // direct solver reaches a relative residual ~1e-6), and 19 rows have no diagonal element, so
+  // Jacobi and ILU(0) have nothing to work with. GMRES needs the whole Krylov space
+  // (restart=131), with the basis orthogonalized twice: a restart every 30 iterations and
+  // BiCGStab stagnate on it, and they are run on a well-posed problem below
+  {
+  std::vector<double> b_file(131, 1.0), r_file(131);
+  GMRES<double> gmres_full(131, 1e-7, 2000);
+  std::vector<double> x_gmres(131, 0.0);
+  const SolverResult full=gmres_full.solve(L, std::span<const double>(b_file), x_gmres);
+  std::cout<<"GMRES(131) on the matrix of the file: "<<full;
+  check("GMRES(131) converges on the matrix of the file",
+        full.converged && std::sqrt(L.residual(b_file, x_gmres, r_file)/131.0)<=1e-7);
+  }
+  // Convection-diffusion on a 100x100 grid: the Laplacian plus an upwind convection term
+  // (not symmetric, diagonally dominant), where GMRES(30) and BiCGStab are expected to converge
+  {
+  const unsigned int nx{100}, n_nodes{nx*nx};
+  Triplets<double> convection=make_laplacian(nx);
+  for (unsigned int k = 0; k < n_nodes; ++k){
+    convection.rows.push_back(k); convection.cols.push_back(k); convection.values.push_back(0.5);
+    if (k%nx > 0){
+      convection.rows.push_back(k); convection.cols.push_back(k-1); convection.values.push_back(-0.5);
+    }
+  }
+  Matrix<double> C(n_nodes, n_nodes, convection.rows, convection.cols, convection.values);
+  std::vector<double> x_exact(n_nodes, 1.0), b_convection(n_nodes), r_convection(n_nodes);
+  C.multiply(x_exact, b_convection);
+  std::vector<double> x_restarted(n_nodes, 0.0), x_bicgstab(n_nodes, 0.0);
+  GMRES<double> gmres(30, 1e-8, 2000);
+  BiCGStab<double> bicgstab(1e-8, 2000);
+  const SolverResult restarted=gmres.solve(C, std::span<const double>(b_convection), x_restarted);
+  const SolverResult stabilized=bicgstab.solve(C, std::span<const double>(b_convection), x_bicgstab);
+  std::cout<<"GMRES(30) on the convection-diffusion matrix: "<<restarted;
+  std::cout<<"BiCGStab on the convection-diffusion matrix: "<<stabilized;
+  const double b_norm2=std::inner_product(b_convection.begin(), b_convection.end(), b_convection.begin(), 0.0);
+  check("GMRES(30) and BiCGStab converge on the convection-diffusion matrix",
+        restarted.converged && stabilized.converged
+        && C.residual(b_convection, x_restarted, r_convection)<=1e-14*b_norm2
+        && C.residual(b_convection, x_bicgstab, r_convection)<=1e-14*b_norm2);
+  }
+
+  // Reverse Cuthill-McKee renumbering at compress time: Laplacian of a 400x400 grid with a
+  // scattered numbering of the nodes, as the ones produced by mesh generators
+  {
+  const unsigned int nx{400}, n_nodes{nx*nx}, stride{7919};
+  auto node=[&](unsigned int i){ return static_cast<unsigned int>((1ull*i*stride)%n_nodes); };
+  const Triplets<double> laplacian=make_laplacian(nx);
+  Matrix<double> Scattered, Renumbered;
+  for (std::size_t k = 0; k < laplacian.values.size(); ++k)
+    for (auto& A : {&Scattered, &Renumbered})
+      (*A)(node(laplacian.rows[k]), node(laplacian.cols[k]))=laplacian.values[k];
+  std::vector<double>       val_scattered, val_renumbered;
+  std::vector<unsigned int> outer_scattered, inner_scattered, outer_renumbered, inner_renumbered;
+  Scattered.compress(val_scattered, outer_scattered, inner_scattered);
+  Renumbered.set_reordering(Reordering::RCM);
+  Renumbered.compress(val_renumbered, outer_renumbered, inner_renumbered);
+  auto bandwidth=[](const std::vector<unsigned int>& outer, const std::vector<unsigned int>& inner){
+    std::size_t band{0};
+    for (std::size_t i = 0; i+1 < inner.size(); ++i)
+      for (unsigned int k = inner[i]; k < inner[i+1]; ++k)
+        band=std::max<std::size_t>(band, outer[k]>i ? outer[k]-i : i-outer[k]);
+    return band;
+  };
+  std::cout<<"Bandwidth with the scattered numbering: "<<bandwidth(outer_scattered, inner_scattered)
+           <<", after RCM: "<<bandwidth(outer_renumbered, inner_renumbered)<<std::endl;
+  // the vectors are permuted once, outside of the loop of the products
+  const unsigned int n_products{200};
+  std::vector<double> x(n_nodes), y(n_nodes), x_new(n_nodes), y_new(n_nodes), y_back(n_nodes);
+  for (unsigned int i = 0; i < n_nodes; ++i)
+    x[i]=1.0+i%7;
+  Timings::Chrono clock_scattered, clock_renumbered;
+  clock_scattered.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    Scattered.multiply(x, y);
+  clock_scattered.stop();
+  Renumbered.permute(x, x_new);
+  clock_renumbered.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    Renumbered.multiply(x_new, y_new);
+  clock_renumbered.stop();
+  Renumbered.unpermute(y_new, y_back);
+  compare(std::to_string(n_products)+" products with the renumbered matrix", y==y_back,
+          "With the scattered numbering", clock_scattered, "After RCM", clock_renumbered);
+  // with one stored triangle the elements that cross the diagonal are mirrored (conjugated if
+  // hermitian): the lower triangle of a hermitian matrix, renumbered, gives the same product
+  using complex=std::complex<double>;
+  Matrix<complex> Hermitian_full, Hermitian_lower;
+  Hermitian_lower.set_symmetry(Symmetry::Hermitian);
+  for (std::size_t k = 0; k < laplacian.values.size(); ++k){
+    const unsigned int r=node(laplacian.rows[k]), c=node(laplacian.cols[k]);
+    const complex value= r==c ? complex(4.0) : r>c ? complex(-1.0, 0.5) : complex(-1.0, -0.5);
+    Hermitian_full(r, c)=value;
+    if (r >= c)
+      Hermitian_lower(r, c)=value;
+  }
+  Hermitian_full.compress();
+  Hermitian_lower.set_reordering(Reordering::RCM);
+  Hermitian_lower.compress();
+  std::vector<complex> x_complex(n_nodes), y_full(n_nodes), x_lower(n_nodes), y_lower(n_nodes), y_lower_back(n_nodes);
+  for (unsigned int i = 0; i < n_nodes; ++i)
+    x_complex[i]=complex(1.0+i%7, 1.0-i%3);
+  Hermitian_full.multiply(x_complex, y_full);
+  Hermitian_lower.permute(x_complex, x_lower);
+  Hermitian_lower.multiply(x_lower, y_lower);
+  Hermitian_lower.unpermute(y_lower, y_lower_back);
+  check("Product with the renumbered lower triangle of a hermitian matrix, same result",
+        relative_difference(y_lower_back, y_full)<=1e-14);
+  }
+
+  // The types of the indices of the compressed formats are template parameters: 16-bit column
+  // indices are enough for a matrix with at most 65536 columns and halve their memory traffic.
+  // 5-point Laplacian on a 250x250 grid (62500 columns)
+  {
+  const unsigned int nx{250}, n_nodes{nx*nx}, n_products{200};
+  const Triplets<double> laplacian=make_laplacian(nx);
+  const auto& [rows, cols, values]=laplacian;
+  Matrix<double> Wide(n_nodes, n_nodes, rows, cols, values);
+  Matrix<double, StorageOrder::RowWise, ElemType, std::uint16_t> Narrow(n_nodes, n_nodes, rows, cols, values);
+  std::vector<double> x(n_nodes), y_wide(n_nodes), y_narrow(n_nodes);
+  for (unsigned int i = 0; i < n_nodes; ++i)
+    x[i]=1.0+i%7;
+  Timings::Chrono clock_wide, clock_narrow;
+  clock_wide.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    Wide.multiply(x, y_wide);
+  clock_wide.stop();
+  clock_narrow.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    Narrow.multiply(x, y_narrow);
+  clock_narrow.stop();
+  compare(std::to_string(n_products)+" products with 16-bit column indices", y_wide==y_narrow,
+          "With 32-bit indices", clock_wide, "With 16-bit indices", clock_narrow);
+  std::cout<<"Bytes of the indices: "<<Wide.outer_indices().size_bytes()<<" -> "<<Narrow.outer_indices().size_bytes()<<std::endl;
+
+  // Mixed precision: the values are stored as float (or bfloat16) and converted to double in the
+  // product, the vectors stay double. The entries of the Laplacian are exact in both types
+  Matrix<float>    Single(Wide);
+  Matrix<bfloat16> Half(Wide);
+  std::vector<double> y_single(n_nodes), y_half(n_nodes);
+  Timings::Chrono clock_single, clock_half;
+  clock_single.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    Single.multiply(std::span<const double>(x), std::span<double>(y_single));
+  clock_single.stop();
+  clock_half.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    Half.multiply(std::span<const double>(x), std::span<double>(y_half));
+  clock_half.stop();
+  std::cout<<"Product with float values and double vectors, same result: "<<(y_wide==y_single && Single*x==y_wide)
+           <<", with bfloat16 values: "<<(y_wide==y_half)<<std::endl;
+  std::cout<<n_products<<" products with float values. "<<clock_single;
+  std::cout<<n_products<<" products with bfloat16 values. "<<clock_half;
+  // values that are not exact in float nor in bfloat16: the float product is the double product
+  // of the rounded values, bfloat16 (8 bits of mantissa) stays within its rounding of it. In CSC
+  // format the columns are scattered on 4 threads
+  {
+  std::vector<double> rough(values.size()), rounded(values.size());
+  std::vector<float>  rough_float(values.size());
+  for (std::size_t k = 0; k < values.size(); ++k){
+    rough[k]=values[k]*(1.0+(k%13)/30.0);
+    rough_float[k]=static_cast<float>(rough[k]);
+    rounded[k]=rough_float[k];
+  }
+  Matrix<double> Rough(n_nodes, n_nodes, rows, cols, rough), Rounded(n_nodes, n_nodes, rows, cols, rounded);
+  Matrix<float> Rough_single(Rough);
+  Matrix<bfloat16> Rough_half(Rough);
+  Matrix<float, StorageOrder::ColWise> Rough_csc(n_nodes, n_nodes, rows, cols, rough_float);
+  Rough_csc.set_num_threads(4);
+  std::vector<double> y_rough_single(n_nodes), y_rough_half(n_nodes), y_rough_csc(n_nodes);
+  Rough_single.multiply(std::span<const double>(x), std::span<double>(y_rough_single));
+  Rough_half.multiply(std::span<const double>(x), std::span<double>(y_rough_half));
+  Rough_csc.multiply(std::span<const double>(x), std::span<double>(y_rough_csc));
+  const std::vector<double> y_rounded=Rounded*x;
+  const double half_difference=relative_difference(y_rough_half, y_rough_single);
+  std::cout<<"Relative difference of the product with bfloat16 values from the float one: "<<half_difference<<std::endl;
+  check("Product with rounded float and bfloat16 values",
+        relative_difference(y_rough_single, y_rounded)<=1e-14 && relative_difference(y_rough_csc, y_rounded)<=1e-14
+        && half_difference>0 && half_difference<=1e-2);
+  // there is no mixed-precision kernel for BSR
+  Rough_single.compress_bsr<2>();
+  bool thrown{false};
+  try{
+    Rough_single.multiply(std::span<const double>(x), std::span<double>(y_rough_single));
+  }catch(const std::logic_error&){
+    thrown=true;
+  }
+  check("Mixed-precision product in BSR format refused", thrown);
+  }
+
+  // Symmetric storage: only the lower triangle of the Laplacian is stored, the product uses
+  // every element twice
+  Matrix<double> Lower;
+  Lower.set_symmetry(Symmetry::Symmetric);
+  for (std::size_t k = 0; k < values.size(); ++k)
+    if (rows[k] >= cols[k])
+      Lower(rows[k], cols[k])=values[k];
+  std::vector<double>       lower_val;
+  std::vector<unsigned int> lower_col, lower_ptr;
+  Lower.compress(lower_val, lower_col, lower_ptr);
+  std::vector<double> y_lower(n_nodes);
+  Timings::Chrono clock_lower;
+  clock_lower.start();
+  for (unsigned int it = 0; it < n_products; ++it)
+    Lower.multiply(x, y_lower);
+  clock_lower.stop();
+  std::cout<<"Product with the lower triangle only, same result: "<<(y_wide==y_lower)
+           <<", stored elements: "<<Wide.values().size()<<" -> "<<Lower.values().size()<<std::endl;
+  std::cout<<n_products<<" products with the symmetric storage. "<<clock_lower;
+  // the elements of the upper triangle are stored as their mirror, in both states: the same
+  // matrix assigned by its upper triangle, and a hermitian element assigned above the diagonal
+  {
+  Matrix<double> Upper;
+  Upper.resize(n_nodes, n_nodes);
+  Upper.set_symmetry(Symmetry::Symmetric);
+  for (std::size_t k = 0; k < values.size(); ++k)
+    if (rows[k] <= cols[k])
+      Upper(rows[k], cols[k])=values[k];
+  std::vector<double> y_upper_map(n_nodes), y_upper(n_nodes);
+  Upper.multiply(x, y_upper_map);
+  Upper.compress();
+  Upper.multiply(x, y_upper);
+  using complex=std::complex<double>;
+  Matrix<complex> H;
+  H.resize(3, 3);
+  H.set_symmetry(Symmetry::Hermitian);
+  H(0, 1)=complex(1.0, 2.0);
+  const bool map_mirrored= H.at(1, 0)==complex(1.0, -2.0) && H.at(0, 1)==complex(1.0, 2.0);
+  H.compress();
+  H(0, 2)=complex(3.0, 1.0);
+  H(0, 1)+=complex(0.0, 1.0);
+  check("Symmetric and hermitian elements assigned above the diagonal, mirrored in both states",
+        y_upper_map==y_wide && y_upper==y_wide && Upper.values().size()==Lower.values().size() && map_mirrored
+        && H.at(2, 0)==complex(3.0, -1.0) && H.at(1, 0)==complex(1.0, -3.0) && H.at(0, 1)==complex(1.0, 3.0));
+  // the same for the lists of entries: the upper triangle is mirrored, not dropped
+  std::vector<unsigned int> upper_rows, upper_cols;
+  std::vector<double>       upper_values;
+  for (std::size_t k = 0; k < values.size(); ++k)
+    if (rows[k] <= cols[k]){
+      upper_rows.push_back(rows[k]); upper_cols.push_back(cols[k]); upper_values.push_back(values[k]);
+    }
+  Matrix<double> Upper_triplets;
+  Upper_triplets.set_symmetry(Symmetry::Symmetric);
+  Upper_triplets.set_from_triplets(upper_rows, upper_cols, upper_values);
+  std::vector<double> y_upper_triplets(n_nodes);
+  Upper_triplets.multiply(x, y_upper_triplets);
+  Matrix<complex> H_triplets;
+  H_triplets.set_symmetry(Symmetry::Hermitian);
+  H_triplets.set_from_triplets({0, 1}, {1, 1}, {complex(1.0, 2.0), complex(2.0)});
+  check("Symmetric and hermitian entries above the diagonal mirrored by set_from_triplets",
+        y_upper_triplets==y_wide && H_triplets.at(1, 0)==complex(1.0, -2.0) && H_triplets.at(0, 1)==complex(1.0, 2.0));
+  }
+
+  // Insertions in compressed state: at each step a few couplings between distant nodes are
+  // added and a product is computed. The new elements stay in a small buffer, merged in the
+  // CSR arrays when it is full, instead of uncompressing and compressing the whole matrix
+  const unsigned int n_steps{20}, n_new{4};
+  Matrix<double> Buffered(n_nodes, n_nodes, rows, cols, values);
+  Matrix<double> Rebuilt(n_nodes, n_nodes, rows, cols, values);
+  Buffered.set_delta_threshold(32);
+  std::vector<double> y_buffered(n_nodes), y_rebuilt(n_nodes);
+  Timings::Chrono clock_buffered, clock_rebuilt;
+  clock_buffered.start();
+  for (unsigned int step = 0; step < n_steps; ++step){
+    for (unsigned int k = 0; k < n_new; ++k)
+      Buffered((step*n_new+k)*997%n_nodes, (step*n_new+k)*7919%n_nodes)+=0.5;
+    Buffered.multiply(x, y_buffered);
+  }
+  clock_buffered.stop();
+  clock_rebuilt.start();
+  for (unsigned int step = 0; step < n_steps; ++step){
+    Rebuilt.uncompress();
+    for (unsigned int k = 0; k < n_new; ++k)
+      Rebuilt((step*n_new+k)*997%n_nodes, (step*n_new+k)*7919%n_nodes)+=0.5;
+    std::vector<double>       rebuilt_val;
+    std::vector<unsigned int> rebuilt_col, rebuilt_ptr;
+    Rebuilt.compress(rebuilt_val, rebuilt_col, rebuilt_ptr);
+    Rebuilt.multiply(x, y_rebuilt);
+  }
+  clock_rebuilt.stop();
+  std::cout<<"Insertions in CSR format, same result: "<<(y_buffered==y_rebuilt)
+           <<", elements still in the buffer: "<<Buffered.delta_size()<<std::endl;
+  std::cout<<n_steps<<" steps with the buffer of the insertions. "<<clock_buffered;
+  std::cout<<n_steps<<" steps with uncompress and compress. "<<clock_rebuilt;
+  // a read with the call operator does not change the compressed matrix, even outside of it
+  const std::size_t buffered_before=Buffered.delta_size();
+  const double missing=Buffered(0, n_nodes-1), outside=Buffered(n_nodes+10, 3);
+  check("Reading missing elements with the call operator leaves the matrix unchanged",
+        missing==0 && outside==0 && Buffered.delta_size()==buffered_before && Buffered.rows()==n_nodes);
+  // uncompress gives back the elements of a CSC matrix column by column, and the next
+  // compress rebuilds the same arrays
+  Matrix<double, StorageOrder::ColWise> Columns(n_nodes, n_nodes, rows, cols, values);
+  const std::vector<double>       columns_val(Columns.values().begin(), Columns.values().end());
+  const std::vector<unsigned int> columns_row(Columns.outer_indices().begin(), Columns.outer_indices().end());
+  Columns.uncompress();
+  bool same_elements=!Columns.is_compressed();
+  for (std::size_t k = 0; k < values.size(); ++k)
+    same_elements= same_elements && Columns.at(rows[k], cols[k])==values[k];
+  Columns.compress();
+  check("CSC matrix uncompressed and compressed again",
+        same_elements && std::ranges::equal(Columns.values(), columns_val)
+        && std::ranges::equal(Columns.outer_indices(), columns_row));
+  }
+
 /////////////////////////////////////////////////////////////
 /************************COMPLEX NUMBERS*********************/
 ////////////////////////////////////////////////////////////
@@ -345,5 +1320,77 @@ int main()
   }
   std::cout << "Compressed case(CSC) with complex matrix. "<<clock_complex;
   }
-  return 0;
+
+  // The solvers work with complex matrices too: a hermitian positive definite matrix
+  // (1D Laplacian with a phase on the off-diagonal elements) with CG, and a non-hermitian
+  // one (Laplacian shifted by a complex number) with GMRES and BiCGStab
+  {
+  const unsigned int n_complex{1000};
+  const std::complex<double> phase=std::polar(1.0, 0.3);
+  std::vector<unsigned int> rows, cols;
+  std::vector<std::complex<double>> herm_values, shift_values;
+  for (unsigned int i = 0; i < n_complex; ++i){
+    rows.push_back(i); cols.push_back(i);
+    herm_values.push_back(2.5); shift_values.push_back({2.0, 0.5});
+    if (i > 0){
+      rows.push_back(i); cols.push_back(i-1);
+      herm_values.push_back(-std::conj(phase)); shift_values.push_back(-1.0);
+    }
+    if (i < n_complex-1){
+      rows.push_back(i); cols.push_back(i+1);
+      herm_values.push_back(-phase); shift_values.push_back(-1.0);
+    }
+  }
+  Matrix<std::complex<double>> Herm(n_complex, n_complex, rows, cols, herm_values);
+  Matrix<std::complex<double>> Shift(n_complex, n_complex, rows, cols, shift_values);
+  std::vector<std::complex<double>> b_complex(n_complex, {1.0, 1.0});
+  std::vector<std::complex<double>> x_cg(n_complex), x_gmres(n_complex), x_bicgstab(n_complex);
+  ConjugateGradient<std::complex<double>> cg;
+  GMRES<std::complex<double>> gmres(30);
+  BiCGStab<std::complex<double>> bicgstab;
+  JacobiPreconditioner<std::complex<double>> jacobi(Shift);
+  std::cout<<"CG with Jacobi on the hermitian matrix: "
+           <<cg.solve(Herm, b_complex, x_cg, JacobiPreconditioner<std::complex<double>>(Herm));
+  const SolverResult complex_gmres=gmres.solve(Shift, b_complex, x_gmres, jacobi);
+  const SolverResult complex_bicgstab=bicgstab.solve(Shift, b_complex, x_bicgstab, jacobi);
+  std::cout<<"GMRES(30) with Jacobi on the shifted Laplacian: "<<complex_gmres;
+  std::cout<<"BiCGStab with Jacobi on the shifted Laplacian: "<<complex_bicgstab;
+  check("GMRES(30) and BiCGStab converge on the complex shifted Laplacian",
+        complex_gmres.converged && complex_bicgstab.converged);
+  }
+
+  // Files with the symmetric or hermitian qualifier list only the lower triangle, and they are
+  // stored this way by both readers. A general file read afterwards in the same matrix is
+  // stored in full again
+  {
+  const std::vector<double> x_sym{1, 2, 3, 4}, y_sym{4, 2.5, 9, 12.5};
+  Matrix<double> Sym_map, Sym_compressed;
+  Sym_map.read_market_matrix("./data/symmetric.mtx");
+  Sym_compressed.read_market_matrix_compressed("./data/symmetric.mtx");
+  const bool symmetric_stored= Sym_map.symmetry()==Symmetry::Symmetric && Sym_compressed.symmetry()==Symmetry::Symmetric
+                              && Sym_map.at(0, 3)==0.5 && Sym_compressed.at(0, 3)==0.5;
+  Sym_map.resize(4, 4);
+  const bool symmetric_product= Sym_map*x_sym==y_sym && Sym_compressed*x_sym==y_sym;
+  check("Symmetric Matrix Market file read as a lower triangle", symmetric_stored && symmetric_product);
+  Sym_map.read_market_matrix(filename);
+  Sym_compressed.read_market_matrix_compressed(filename);
+  check("General file read after a symmetric one stored in full",
+        Sym_map.symmetry()==Symmetry::General && Sym_compressed.symmetry()==Symmetry::General
+        && Sym_map.at(2, 27)==0.5 && Sym_compressed.at(2, 27)==0.5 && Sym_compressed*c==prod_mark_compressed);
+
+  using complex=std::complex<double>;
+  const std::vector<complex> x_herm{1.0, complex(0, 1), complex(1, 1)}, y_herm{complex(3, 1), complex(-1, 6), complex(3, 1)};
+  Matrix<complex> Herm_map;
+  Matrix<complex, StorageOrder::ColWise> Herm_compressed;
+  Herm_map.read_market_matrix("./data/hermitian.mtx");
+  Herm_compressed.read_market_matrix_compressed("./data/hermitian.mtx");
+  Herm_map.compress();
+  check("Hermitian Matrix Market file read as a lower triangle, product",
+        Herm_map.symmetry()==Symmetry::Hermitian && Herm_compressed.symmetry()==Symmetry::Hermitian
+        && Herm_map.at(0, 1)==complex(1, -1) && Herm_compressed.at(1, 2)==complex(0, 2)
+        && Herm_map*x_herm==y_herm && Herm_compressed*x_herm==y_herm);
+  }
+  if (n_failed>0)
+    std::cout<<n_failed<<" checks failed"<<std::endl;
+  return n_failed==0 ? 0 : 1;
 }